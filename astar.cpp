@@ -2,6 +2,7 @@
 // Dragos-Ronald Rugescu
 
 #include "astar.hpp"
+#include "cooperative.hpp"
 #include <iostream>
 
 using namespace std;
@@ -45,6 +46,29 @@ int main() {
     std::cout << "Printing map with final path: " << std::endl;
     a.printMap(WITH_PATH);
 
+    std::cout << "Anytime A* running..." << std::endl;
+
+    a.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+    a.runAnytime(std::chrono::steady_clock::now() + std::chrono::milliseconds(10),
+                 [](const anytimeResult& r) {
+                   std::cout << " Improved path : cost " << r.cost << ", epsilon " << r.epsilon
+                             << ", bound " << r.bound << std::endl;
+                 });
+
+    std::cout << "Cooperative A* - two agents crossing..." << std::endl;
+
+    cooperativePlanner team(a, 8);
+    team.addAgent(coords(0, 9), coords(9, 0));
+    team.addAgent(coords(9, 0), coords(0, 9));
+    team.planTick(0);
+
+    for (size_t k = 0; k < team.agentCount(); k++) {
+      std::cout << " Agent " << k << " :";
+      for (auto& c : team.getPlan(k))
+        std::cout << " {" << c.first << "," << c.second << "}";
+      std::cout << std::endl;
+    }
+
     std::cout << "Done." << std::endl;
 
     return 0;
@@ -3,7 +3,20 @@
 //
 // A star algorithm class - matrix and graph
 
+#pragma once
+
 #include "utils.hpp"
+#include "gridmap.hpp"
+#include "tilestore.hpp"
+#include "nodetable.hpp"
+#include "components.hpp"
+#include "clearance.hpp"
+#include "summedarea.hpp"
+#include "los.hpp"
+#include "heuristictable.hpp"
+#include "latency.hpp"
+#include "querylog.hpp"
+#include "graph.hpp"
 
 using namespace Eigen;
 
@@ -20,11 +33,50 @@ class point; // Far declaration
 
 typedef std::vector<point> aStarList;
 
-enum Direction { NORTH = 0, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_EAST, NORTH_WEST, SOUTH_WEST };
+bool matchPointCoords(const point& p, const coords& c); // Far declaration
 
-constexpr std::initializer_list<Direction> dirList = { NORTH, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_EAST, NORTH_WEST, SOUTH_WEST };
+// Result of one anytime (ARA*) iteration
+struct anytimeResult {
+    std::vector<coords> path;
+    float cost = 0.0f;
+    float epsilon = 0.0f;                   // Inflation of the last completed iteration, 0 before one
+    float bound = 0.0f;                     // Achieved bound, cost <= bound * optimal, infinite if
+                                            //   the heuristic is not admissible
+    size_t expansions = 0;                  // Expansions so far, all iterations
+    std::chrono::microseconds elapsed{0};   // Time since the search started
+};
 
-bool matchPointCoords(const point& p, const coords& c); // Far declaration
+typedef std::function<void(const anytimeResult&)> anytimeCallback;
+
+// Cells touched by one map edit, inclusive corners
+struct dirtyRect {
+    uint64_t version;
+    int64_t x0, y0, x1, y1;
+};
+
+struct pathRepairStats {
+    size_t checked = 0;         // Path cells tested against the map
+    size_t broken = 0;
+    size_t segments = 0;        // Stretches re-routed locally
+    bool fullSearch = false;
+    size_t expansions = 0;
+};
+
+struct anytimeNode {
+    float g = std::numeric_limits<float>::infinity();
+    float h = 0.0f;
+    uint8_t parent = NO_PARENT;     // Direction taken from the parent
+    bool open = false;
+    bool closed = false;
+    bool incons = false;
+};
+
+struct thetaNode {
+    float g = std::numeric_limits<float>::infinity();
+    float h = 0.0f;
+    cellIndex parent = INEXISTENT;  // Any cell in sight, not just a neighbour
+    bool closed = false;
+};
 
 auto find_item(std::vector<point> vec, coords c) {
   auto cs = std::vector<coords>();
@@ -135,29 +187,157 @@ class Heuristic {
         void setHeuristic(int num);
         int getHeuristic();
 
+        // Never above the cost of 8-way moves of at least MIN_WEIGHT
+        bool isAdmissible();
+
         float distanceOp(const point p1, const point p2);
 };
 
+// Interface goalSet - several destinations, h is the minimum over all of them. Above
+//   GOAL_INDEX_MIN goals they are bucketed by GOAL_BUCKET cells and scanned ring by ring,
+//   stopping once a ring cannot hold a closer goal (every heuristic is >= Chebyshev distance)
+
+class goalSet {
+    private:
+        Heuristic& metric;
+
+        std::vector<coords> goals;
+        std::vector<int> ids;
+        std::unordered_map<int64_t, int> byCell;
+
+        std::unordered_map<int64_t, std::vector<int>> buckets;
+        int64_t minBx = 0, maxBx = 0, minBy = 0, maxBy = 0;
+        bool indexed = false;
+
+        static int64_t key(int64_t a, int64_t b) { return (a << 32) ^ (b & 0xFFFFFFFFll); }
+        void scanBucket(int64_t bx, int64_t by, const point& p, float& best);
+
+    public:
+        goalSet(Heuristic& metric) : metric(metric) {};
+
+        void add(const coords& c, int id);
+        void build();
+
+        // Id of the goal on c, INEXISTENT if none
+        int goalAt(const coords& c);
+        float distance(const coords& c);
+
+        size_t size() { return goals.size(); }
+        bool empty() { return goals.empty(); }
+};
+
 // Interface aStar
 
 class aStar {
     private:
 
-        uint16_t sizeM, sizeN;
+        int64_t sizeM = 0, sizeN = 0;
+        int storage = DENSE_STORAGE;
 
         point origin, destination;
 
-        aStarList open, closed;
-
         Heuristic h;
 
-        MatrixXd m;
-
-        point path_start = point(INEXISTENT, INEXISTENT);
+        // Per-destination tables, looked up at the start of each search
+        std::shared_ptr<heuristicCache> hCache;
+        int hTableMode = HEURISTIC_TABLE_NONE;
+        std::shared_ptr<const heuristicTable> hTable;
+        void prepareHeuristic();
+        bool fillGeometric(std::vector<float>& values);
+        float goalDistance(cellIndex i);
+
+        // Bumped on every edit of the map. The log holds the edits after version dirtyFrom
+        uint64_t mapVersion = 0;
+        std::deque<dirtyRect> dirtyLog;
+        uint64_t dirtyFrom = 0;
+        void logEdit(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        void resetLog();
+
+        // Path repair
+        uint64_t pathVersion = 0;
+        pathRepairStats repairStats;
+        int route(cellIndex from, cellIndex to, int64_t x0, int64_t y0, int64_t x1, int64_t y1,
+                  std::vector<coords>& segment, float& cost);
+
+        std::unique_ptr<gridMap> m;
 
         std::vector<coords> path;
 
-        std::vector<coords> returnPath();
+        anytimeResult anytime;
+        nodeTable<anytimeNode> anytimeNodes;
+
+        // Any-angle search
+        sightMap sight;
+        nodeTable<thetaNode> thetaNodes;
+        float anyAngleCost = 0.0f;
+        bool sightReady();
+        float segmentCost(const coords& a, const coords& b);
+
+        // Best-first engine shared by the set queries
+        nodeTable<searchNode> searchNodes;
+        searchStats stats;
+        int goalReached = INEXISTENT;
+        int originReached = INEXISTENT;
+
+        int bestFirst(const std::vector<searchSource>& sources, goalSet& goals);
+
+        template<class Node>
+        std::vector<coords> tracePath(nodeTable<Node>& nodes, cellIndex last);
+
+        // Cells are numbered in the storage order of the map
+        cellIndex toIndex(const coords& c) { return m->index(c.first, c.second); }
+        coords toCoords(cellIndex i) { int64_t x, y; m->position(i, x, y); return coords(x, y); }
+        float stepCost(const coords& c);
+
+        // Structures derived from the map, kept current on every edit
+        componentMap components;
+        clearanceMap clearance;
+        summedArea areas;
+        void cellChanged(const coords& c, float before, float after);
+        void bulkChanged(int64_t x0, int64_t y0, int64_t x1, int64_t y1, bool accessibility);
+        bool clip(int64_t& x0, int64_t& y0, int64_t& x1, int64_t& y1);
+        bool wasBlocked(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+
+        // Footprint radius of the agent, cells with less clearance are not valid
+        int agentRadius = 0;
+        bool fits(cellIndex i);
+
+        // Search trace, tracing is the ring of the current search's thread
+        std::shared_ptr<searchTracer> tracer;
+        traceRing* tracing = nullptr;
+        void traceBegin();
+        void traceEnd(cellIndex last, float cost);
+
+        // Hardware counters around the phases of runAlgorithm, counted into stats
+        bool countEvents = false;
+        perfSample phaseMark;
+        void beginPhases();
+        void endPhase(perfReading& into);
+
+        // Times a query from construction to whichever return it takes. Only the outermost
+        //   timer records, so a search falling back to another is counted once
+        std::shared_ptr<latencyRecorder> latency;
+        std::shared_ptr<queryLog> qlog;
+        int timing = 0;
+        float queryCost = 0.0f;     // Of the path found by the current query
+        float pathStart = 0.0f;     // Initial g of the path's first cell, set by multi-source queries
+
+        struct queryTimer {
+            aStar& a;
+            int engine;
+            bool active;
+            std::chrono::steady_clock::time_point start;
+
+            // What the log needs to run the query again
+            const std::vector<point>* goals = nullptr;
+            const std::vector<std::pair<point, float>>* origins = nullptr;
+            float epsilon = 0.0f, delta = 0.0f;
+            std::chrono::steady_clock::time_point deadline;
+
+            queryTimer(aStar& a, int engine);
+            ~queryTimer();
+            void logQuery(const queryRecord& query);
+        };
 
     public:
         // Constructor versions
@@ -179,14 +359,26 @@ class aStar {
         auto const getDestination() { return destination; }
 
         // Size of internal matrix
-        void setMapSize(int size);
-        void setMapSize(int sizeM, int sizeN);
+        void setMapSize(int64_t size);
+        void setMapSize(int64_t sizeM, int64_t sizeN);
+        void setMapSize(int64_t sizeM, int64_t sizeN, int storage);
         coords getMapSize();
+        void setMap(std::unique_ptr<gridMap> map);
+        gridMap& getMap() { return *m; }
 
         // Heuristic
         void setHeuristic();
         Heuristic& getHeuristic() { return h; }
 
+        // Searches towards one destination read h from a table per destination, built on the
+        //   first query and kept in the cache, which may be shared by instances on other threads.
+        //   HEURISTIC_TABLE_GEOMETRIC tabulates the configured heuristic, HEURISTIC_TABLE_EXACT
+        //   the true cost to the destination (for maps up to DENSE_SEARCH_LIMIT cells). Instances
+        //   sharing a cache with exact tables must hold the same map
+        void setHeuristicCache(std::shared_ptr<heuristicCache> cache, int mode = HEURISTIC_TABLE_GEOMETRIC);
+        std::shared_ptr<heuristicCache> getHeuristicCache() { return hCache; }
+        uint64_t getMapVersion() { return mapVersion; }
+
         // Collision map
         void setInaccessible(const point p);
         void setInaccessible(const coords& c);
@@ -195,14 +387,95 @@ class aStar {
         void setWeight(const coords& c, float w);
         void setWeight(const int x, const int y, float w);
 
+        // Bulk edits, clipped to the map. Each call invalidates the derived structures once
+        void fillRect(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w);
+        void applyMask(int64_t x0, int64_t y0, const Array<bool, Dynamic, Dynamic>& mask, float w);
+        void setBlock(int64_t x0, int64_t y0, const MatrixXf& block);
+        void applyEdits(const std::vector<std::pair<coords, float>>& edits);
+
+        // Connectivity - false when origin and destination are in different components
+        bool reachable();
+        componentMap& getComponents() { return components; }
+
+        // Agent footprint of (2 * radius + 1) x (2 * radius + 1) cells centred on its cell
+        void setAgentRadius(int radius);
+        int getAgentRadius() { return agentRadius; }
+        clearanceMap& getClearance() { return clearance; }
+
+        // Rectangle queries in O(1), inclusive corners, tables refreshed on first use after edits
+        bool rectBlocked(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        double rectCost(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        summedArea& getAreas() { return areas; }
+
         // Algorithm
         bool isValid(const coords& p);
         int runAlgorithm();
 
+        // Nearest of many destinations in one search, getGoalReached() tells which
+        int runAlgorithm(const std::vector<point>& goals);
+        int getGoalReached() { return goalReached; }
+
+        // Best path from any of many (origin, initial g) pairs, getOriginReached() tells which
+        int runAlgorithm(const std::vector<std::pair<point, float>>& origins);
+        int getOriginReached() { return originReached; }
+
+        // Dijkstra distances from the sources to every cell, in map storage order. Reverse
+        //   gives the distance from every cell to the nearest source instead
+        int distanceField(const std::vector<std::pair<point, float>>& sources, std::vector<float>& field,
+                          bool reverse = false);
+        searchStats getStats() { return stats; }
+
+        // Anytime algorithm (ARA*) - bounded-suboptimal paths, refined until the deadline
+        int runAnytime(std::chrono::steady_clock::time_point deadline, anytimeCallback onImprove = nullptr);
+        int runAnytime(float epsilon, float delta, std::chrono::steady_clock::time_point deadline,
+                       anytimeCallback onImprove = nullptr);
+        anytimeResult getAnytimeResult() { return anytime; }
+
+        // Lazy Theta* - any-angle path, getPath() gives only the turning points. A segment costs
+        //   what the grid path along its Bresenham line costs
+        int runAnyAngle();
+        float getAnyAngleCost() { return anyAngleCost; }
+        bool lineOfSight(const coords& a, const coords& b);
+
         // Result
         void printMap();
         void printMap(bool with_path);
         std::vector<coords> getPath();
+        float getPathCost() { return queryCost; }   // Of the last query, infinite if it failed
+
+        // Path repair - a path remembers the map version it was found on. The check reads the
+        //   edits since then from the dirty log, or tests every cell if the log is shorter
+        uint64_t getPathVersion() { return pathVersion; }
+        size_t checkPath(const std::vector<coords>& path, uint64_t version, std::vector<size_t>& broken);
+
+        // Broken stretches of an 8-connected path are re-routed between the cells around them,
+        //   within PATH_REPAIR_MARGIN cells. A stretch that cannot be mended locally, or whose
+        //   detour costs more than maxDetour times what it replaces (broken cells at MIN_WEIGHT),
+        //   sends the whole path to a full search. EXIT_FAILURE when no path remains. The first
+        //   form also updates getPathCost(), infinite when no path remains
+        int repairPath(float maxDetour = PATH_REPAIR_DETOUR);
+        int repairPath(std::vector<coords>& path, uint64_t version, float maxDetour = PATH_REPAIR_DETOUR);
+        pathRepairStats getRepairStats() { return repairStats; }
+
+        // Latency of every query, by engine, result and path length. Recorders may be shared by
+        //   instances on many threads; nullptr stops the timing
+        void setLatencyRecorder(std::shared_ptr<latencyRecorder> recorder) { latency = recorder; }
+        std::shared_ptr<latencyRecorder> getLatencyRecorder() { return latency; }
+
+        // Every query with its options, map version, cost, latency and expansions, appended to an
+        //   open log. Logs may be shared by instances on many threads
+        void setQueryLog(std::shared_ptr<queryLog> log) { qlog = log; }
+        std::shared_ptr<queryLog> getQueryLog() { return qlog; }
+
+        // Cycles, instructions, cache and branch misses of each runAlgorithm phase in getStats().
+        //   Linux only, readings stay at -1 where the counters cannot be opened
+        void setPerfCounters(bool enabled) { countEvents = enabled; }
+        bool getPerfCounters() { return countEvents; }
+
+        // Push, pop, expand, prune and reopen events of runAlgorithm and runAnytime, with cell,
+        //   g, h and time, into an open tracer. Tracers may be shared by instances on many threads
+        void setTracer(std::shared_ptr<searchTracer> t) { tracer = t; }
+        std::shared_ptr<searchTracer> getTracer() { return tracer; }
 };
 
 // Implementation Heuristic
@@ -213,6 +486,10 @@ void Heuristic::setHeuristic(int num) {
 
 int Heuristic::getHeuristic() { return internalHeuristic; }
 
+bool Heuristic::isAdmissible() {
+  return internalHeuristic == CHEBYSHEV_DISTANCE || internalHeuristic == 0;
+}
+
 float Heuristic::getDelta(const coords& p1, const coords& p2, const int& power) {
   if (power == IDENTITY)
     return abs(p1.first - p2.first) + abs(p1.second - p2.second);
@@ -237,12 +514,100 @@ float Heuristic::distanceOp(const point p1, const point p2) {
         return (10.0f) * getDelta(p1.pos, p2.pos, IDENTITY)
              + (-6.0f) * getDelta(p1.pos, p2.pos, MINIMUM);
 
+    // Admissible for 8-way moves costing at least MIN_WEIGHT each
+    case CHEBYSHEV_DISTANCE:
+        return COST * MIN_WEIGHT * std::max(abs(p1.pos.first - p2.pos.first),
+                                            abs(p1.pos.second - p2.pos.second));
+
     default:
         return 0.0f;
         break;
     }
 }
 
+// Implementation goalSet
+
+void goalSet::add(const coords& c, int id) {
+  if (byCell.count(key(c.first, c.second)))
+    return;
+
+  byCell[key(c.first, c.second)] = goals.size();
+  goals.push_back(c);
+  ids.push_back(id);
+  indexed = false;
+}
+
+void goalSet::build() {
+  buckets.clear();
+  indexed = (goals.size() > GOAL_INDEX_MIN);
+
+  if (!indexed)
+    return;
+
+  minBx = minBy = std::numeric_limits<int64_t>::max();
+  maxBx = maxBy = std::numeric_limits<int64_t>::min();
+
+  for (size_t k = 0; k < goals.size(); k++) {
+    int64_t bx = goals[k].first / GOAL_BUCKET, by = goals[k].second / GOAL_BUCKET;
+
+    buckets[key(bx, by)].push_back(k);
+    minBx = std::min(minBx, bx);
+    maxBx = std::max(maxBx, bx);
+    minBy = std::min(minBy, by);
+    maxBy = std::max(maxBy, by);
+  }
+}
+
+int goalSet::goalAt(const coords& c) {
+  auto it = byCell.find(key(c.first, c.second));
+  return (it == byCell.end()) ? INEXISTENT : ids[it->second];
+}
+
+void goalSet::scanBucket(int64_t bx, int64_t by, const point& p, float& best) {
+  auto it = buckets.find(key(bx, by));
+  if (it == buckets.end())
+    return;
+
+  for (auto k : it->second)
+    best = std::min(best, metric.distanceOp(p, point(goals[k].first, goals[k].second)));
+}
+
+float goalSet::distance(const coords& c) {
+  float best = std::numeric_limits<float>::infinity();
+  point p(c.first, c.second);
+
+  if (!indexed) {
+    for (auto& g : goals)
+      best = std::min(best, metric.distanceOp(p, point(g.first, g.second)));
+    return best;
+  }
+
+  int64_t bx = c.first / GOAL_BUCKET, by = c.second / GOAL_BUCKET;
+  int64_t rings = std::max({ std::abs(bx - minBx), std::abs(bx - maxBx), std::abs(by - minBy), std::abs(by - maxBy) });
+
+  for (int64_t k = 0; k <= rings; k++) {
+    // Goals k buckets away are at least (k - 1) * GOAL_BUCKET + 1 cells away
+    if (k > 0 && (k - 1) * GOAL_BUCKET + 1 >= best)
+      break;
+
+    if (k == 0) {
+      scanBucket(bx, by, p, best);
+      continue;
+    }
+
+    for (int64_t i = bx - k; i <= bx + k; i++) {
+      scanBucket(i, by - k, p, best);
+      scanBucket(i, by + k, p, best);
+    }
+    for (int64_t j = by - k + 1; j <= by + k - 1; j++) {
+      scanBucket(bx - k, j, p, best);
+      scanBucket(bx + k, j, p, best);
+    }
+  }
+
+  return best;
+}
+
 // Implementation aStar
 
 #pragma region aStar_constructors
@@ -256,7 +621,7 @@ aStar::aStar() {
     destination = d;
 
     // Initialize map with basic size
-    m.resize(INITIAL_SIZE, INITIAL_SIZE);
+    setMapSize(INITIAL_SIZE);
 }
 
 aStar::aStar(int size) {
@@ -268,7 +633,7 @@ aStar::aStar(int size) {
     destination = d;
 
     // Initialize map with basic size
-    m.resize(size, size);
+    setMapSize(size);
 }
 
 aStar::aStar(int size, const point origin, const point destination) {
@@ -277,7 +642,7 @@ aStar::aStar(int size, const point origin, const point destination) {
     aStar::destination = destination;
 
     // Initialize map with basic size
-    m.resize(size, size);
+    setMapSize(size);
 }
 
 aStar::aStar(int sizeM, int sizeN, const point origin, const point destination) {
@@ -286,21 +651,21 @@ aStar::aStar(int sizeM, int sizeN, const point origin, const point destination)
     aStar::destination = destination;
 
     // Initialize map with basic size
-    m.resize(sizeM, sizeN);
+    setMapSize(sizeM, sizeN);
 }
 
 aStar::aStar(const point origin, const point destination) {
     aStar::origin = origin;
     aStar::destination = destination;
 
-    m.resize(INITIAL_SIZE, INITIAL_SIZE);
+    setMapSize(INITIAL_SIZE);
 }
 
 aStar::aStar(const point* origin, const point* destination) {
     aStar::origin = *origin;
     aStar::destination = *destination;
 
-    m.resize(INITIAL_SIZE, INITIAL_SIZE);
+    setMapSize(INITIAL_SIZE);
 }
 
 aStar::aStar(int size, const point* origin, const point* destination) {
@@ -309,7 +674,7 @@ aStar::aStar(int size, const point* origin, const point* destination) {
     aStar::destination = *destination;
 
     // Initialize map with basic size
-    m.resize(size, size);
+    setMapSize(size);
 }
 
 aStar::aStar(int sizeM, int sizeN, const point* origin, const point* destination) {
@@ -318,7 +683,19 @@ aStar::aStar(int sizeM, int sizeN, const point* origin, const point* destination
     aStar::destination = *destination;
 
     // Initialize map with basic size
-    m.resize(sizeM, sizeN);
+    setMapSize(sizeM, sizeN);
+}
+
+#pragma endregion
+
+#pragma region Origin and Destination
+
+void aStar::setOrigin(const point origin) {
+  this->origin = origin;
+}
+
+void aStar::setDestination(const point destination) {
+  this->destination = destination;
 }
 
 #pragma endregion
@@ -327,15 +704,54 @@ aStar::aStar(int sizeM, int sizeN, const point* origin, const point* destination
 
 // Map size
 
-void aStar::setMapSize(int size) {
-  this->sizeM = this->sizeN = size;
-  this->m.resize(size, size);
+void aStar::setMapSize(int64_t size) {
+  setMapSize(size, size, storage);
+}
+
+void aStar::setMapSize(int64_t sizeM, int64_t sizeN) {
+  setMapSize(sizeM, sizeN, storage);
 }
 
-void aStar::setMapSize(int sizeM, int sizeN) {
+// Storage is DENSE_STORAGE, TILED_STORAGE, STREAMED_STORAGE (temporary file),
+//   MORTON_STORAGE or BLOCKED_STORAGE, all cells start at MIN_WEIGHT
+void aStar::setMapSize(int64_t sizeM, int64_t sizeN, int storage) {
   this->sizeM = sizeM;
   this->sizeN = sizeN;
-  this->m.resize(sizeM, sizeN);
+
+  if (!m || storage != this->storage) {
+    this->storage = storage;
+
+    if (storage == TILED_STORAGE)
+      m = std::make_unique<tiledMap>();
+    else if (storage == STREAMED_STORAGE)
+      m = std::make_unique<streamedMap>();
+    else if (storage == MORTON_STORAGE)
+      m = std::make_unique<mortonMap>();
+    else if (storage == BLOCKED_STORAGE)
+      m = std::make_unique<blockedMap>();
+    else
+      m = std::make_unique<denseMap>();
+  }
+
+  m->resize(sizeM, sizeN);
+  resetLog();
+  components.invalidate();
+  clearance.invalidate();
+  areas.invalidate();
+  sight.invalidate();
+}
+
+// Adopt an existing map, e.g. a streamedMap opened on a tile store
+void aStar::setMap(std::unique_ptr<gridMap> map) {
+  m = std::move(map);
+  storage = m->storageType();
+  sizeM = m->rows();
+  sizeN = m->cols();
+  resetLog();
+  components.invalidate();
+  clearance.invalidate();
+  areas.invalidate();
+  sight.invalidate();
 }
 
 coords aStar::getMapSize() { return *(new coords(sizeN, sizeM)); }
@@ -348,6 +764,92 @@ coords aStar::getMapSize() { return *(new coords(sizeN, sizeM)); }
 
 void aStar::setHeuristic() {};
 
+void aStar::setHeuristicCache(std::shared_ptr<heuristicCache> cache, int mode) {
+  hCache = cache;
+  hTableMode = cache ? mode : HEURISTIC_TABLE_NONE;
+  hTable.reset();
+}
+
+// Table for the current destination, or none - searches then call distanceOp
+void aStar::prepareHeuristic() {
+  hTable.reset();
+
+  if (!hCache || hTableMode == HEURISTIC_TABLE_NONE || !isValid(destination.pos))
+    return;
+
+  heuristicKey key;
+  key.goalX = destination.pos.first;
+  key.goalY = destination.pos.second;
+  key.mode = hTableMode;
+  key.rows = sizeM;
+  key.cols = sizeN;
+  key.storage = storage;
+
+  if (hTableMode == HEURISTIC_TABLE_EXACT) {
+    key.version = mapVersion;
+    key.radius = agentRadius;
+    hTable = hCache->get(key, m->indexSpace(), [&](std::vector<float>& values) {
+      return distanceField({ std::pair<point, float>(destination, 0.0f) }, values, true) == EXIT_SUCCESS;
+    });
+  }
+  else {
+    key.heuristic = h.getHeuristic();
+    hTable = hCache->get(key, m->indexSpace(), [&](std::vector<float>& values) { return fillGeometric(values); });
+  }
+}
+
+// The whole grid at once as Eigen arrays of row and column offsets, column-major like denseMap.
+//   Other layouts get the cells scattered to their own order
+bool aStar::fillGeometric(std::vector<float>& values) {
+  if (m->indexSpace() > DENSE_SEARCH_LIMIT)
+    return false;
+
+  ArrayXXd dx = ArrayXd::LinSpaced(sizeM, 0, sizeM - 1).replicate(1, sizeN) - destination.pos.first;
+  ArrayXXd dy = ArrayXd::LinSpaced(sizeN, 0, sizeN - 1).transpose().replicate(sizeM, 1) - destination.pos.second;
+  ArrayXXf grid(sizeM, sizeN);
+
+  switch (h.getHeuristic())
+  {
+  case MANHATTAN_DISTANCE:
+      grid = (dx.abs() + dy.abs()).cast<float>();
+      break;
+
+  case EUCLIDEAN_DISTANCE:
+      grid = (dx.square() + dy.square()).sqrt().cast<float>();
+      break;
+
+  case CHEBYSHEV_DISTANCE:
+      grid = (COST * MIN_WEIGHT * dx.abs().max(dy.abs())).cast<float>();
+      break;
+
+  default:
+      for (int64_t y = 0; y < sizeN; y++)
+        for (int64_t x = 0; x < sizeM; x++)
+          grid(x, y) = h.distanceOp(point(x, y), destination);
+      break;
+  }
+
+  if (storage == DENSE_STORAGE) {
+    values.assign(grid.data(), grid.data() + grid.size());
+    return true;
+  }
+
+  values.assign(m->indexSpace(), std::numeric_limits<float>::infinity());
+  for (int64_t y = 0; y < sizeN; y++)
+    for (int64_t x = 0; x < sizeM; x++)
+      values[m->index(x, y)] = grid(x, y);
+
+  return true;
+}
+
+float aStar::goalDistance(cellIndex i) {
+  if (hTable)
+    return hTable->at(i);
+
+  coords c = toCoords(i);
+  return h.distanceOp(point(c.first, c.second), destination);
+}
+
 #pragma endregion
 
 #pragma region Results and Validity
@@ -358,44 +860,38 @@ bool aStar::isValid(const coords& p) {
   if (p == coords(INEXISTENT, INEXISTENT))
     return false;
 
-  if (p.first > sizeM || p.second > sizeN)
+  if (p.first >= sizeM || p.second >= sizeN)
     return false;
 
   if (p.first < 0 || p.second < 0)
     return false;
 
-  if (this->m(p.first, p.second) == INACCESSIBLE)
+  if (m->get(p.first, p.second) == INACCESSIBLE)
+    return false;
+
+  if (agentRadius > 0 && !fits(toIndex(p)))
     return false;
 
   return true;
 }
 
-std::vector<coords> aStar::returnPath() {
-
-    auto path = std::vector<coords>();
-    auto current_point = path_start;
+// Clearance is transformed on first use; maps above COMPONENT_LIMIT are not filtered
+bool aStar::fits(cellIndex i) {
+  if (!clearance.isBuilt() && !clearance.build(*m))
+    return true;
 
-    // If there has been a run
-    if (isValid(current_point.pos)) {
-      // Insert into final path the destination
-      path.insert(path.begin(), path_start.pos);
-      debug << "  Inserting dest. in path : " << path_start;
+  return clearance.fits(i, agentRadius);
+}
 
-      // While parentage of nodes exist
-      while(isValid(current_point.parent)) {
-        // Find parent
-        auto p = find_item(closed, current_point.parent);
-        debug << "  Found parent : " << *p;
+// O(1) rejection of disconnected queries, labels are built on first use
+bool aStar::reachable() {
+  if (!isValid(origin.pos) || !isValid(destination.pos))
+    return false;
 
-        // Insert into final path
-        path.insert(path.begin(), current_point.parent);
+  if (!components.isBuilt() && !components.build(*m))
+    return true;
 
-        // Look for next parent
-        current_point = *p;
-      }
-    }
-
-    return path;
+  return components.connected(toIndex(origin.pos), toIndex(destination.pos));
 }
 
 #pragma endregion
@@ -447,7 +943,9 @@ void aStar::setInaccessible(const point p) {
 }
 
 void aStar::setInaccessible(const coords& c) {
-  this->m(c.first, c.second) = INACCESSIBLE;
+  float before = m->get(c.first, c.second);
+  m->set(c.first, c.second, INACCESSIBLE);
+  cellChanged(c, before, INACCESSIBLE);
   debug << "Set inaccessible location @" << c;
 }
 
@@ -461,7 +959,9 @@ void aStar::setWeight(const point p, float w) {
 }
 
 void aStar::setWeight(const coords& c, float w) {
-  this->m(c.first, c.second) = w;
+  float before = m->get(c.first, c.second);
+  m->set(c.first, c.second, w);
+  cellChanged(c, before, w);
   debug << "Set inaccessible location @" << c;
 }
 
@@ -470,82 +970,213 @@ void aStar::setInaccessible(const int x, const int y) {
   setInaccessible(c);
 }
 
-#pragma endregion
+void aStar::cellChanged(const coords& c, float before, float after) {
+  logEdit(c.first, c.second, c.first, c.second);
+  areas.cellChanged(c.first, c.second);
 
-#pragma region Algorithm
+  // With a radius the blocked mask follows clearance, which may change around the cell
+  if (sight.getRadius() == 0)
+    sight.cellChanged(c.first, c.second, after);
+  else if ((before == INACCESSIBLE) != (after == INACCESSIBLE))
+    sight.invalidate();
+  else
+    sight.weightChanged(c.first, c.second, after);
 
-// Algorithm
+  if (before != INACCESSIBLE && after == INACCESSIBLE) {
+    components.cellClosed(*m, c.first, c.second);
+    clearance.cellClosed(*m, c.first, c.second);
+  }
+  else if (before == INACCESSIBLE && after != INACCESSIBLE) {
+    components.cellOpened(*m, c.first, c.second);
+    clearance.cellOpened(*m, c.first, c.second);
+  }
+}
 
-int aStar::runAlgorithm() {
+// One round for the whole batch - labels and clearance are rebuilt on next use if any cell
+//   may have changed accessibility, the area tables refill from the batch's top-left corner
+void aStar::bulkChanged(int64_t x0, int64_t y0, int64_t x1, int64_t y1, bool accessibility) {
+  logEdit(x0, y0, x1, y1);
+  areas.cellChanged(x0, y0);
+  sight.invalidate();
 
-    // Let initial lists be empty
-    aStarList emptyO, emptyC;
-    swap(open, emptyO);
-    swap(open, emptyC);
-    path.clear();
+  if (accessibility) {
+    components.invalidate();
+    clearance.invalidate();
+  }
+}
 
-    // Put start node on open list - O(1)
-    path_start = point(INEXISTENT, INEXISTENT);
-    open.push_back(this->origin);
-    debug << "Pushed origin : " << this->origin;
+// The oldest entry is dropped once the log is full, older paths are then checked cell by cell
+void aStar::logEdit(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  dirtyLog.push_back(dirtyRect{ ++mapVersion, x0, y0, x1, y1 });
 
-    // Loop until you find the end
-    while(!open.empty()) {
+  if (dirtyLog.size() > DIRTY_LOG_SIZE) {
+    dirtyFrom = dirtyLog.front().version;
+    dirtyLog.pop_front();
+  }
+}
 
-      debug << "--------------------A*---------------------" << std::endl;
+// A new map or radius, paths found before are checked cell by cell
+void aStar::resetLog() {
+  dirtyLog.clear();
+  dirtyFrom = ++mapVersion;
+}
 
-      // Sort the list - (N*logN)
-      std::sort(open.begin(), open.end());
-      debug << "Sorted list: " << std::endl;
-      for (auto i : open)
-        debug << i;
+void aStar::setAgentRadius(int radius) {
+  radius = std::max(radius, 0);
 
-      // Remove from open - O(1)
-      auto p = open.front();
-      debug << "Removing best point : " << p;
-      open.erase(open.begin()); // O(1) best case
+  if (radius != agentRadius) {
+    agentRadius = radius;
+    resetLog();
+  }
+}
 
-      // Add to closed - O(1)
-      closed.push_back(p);
+bool aStar::clip(int64_t& x0, int64_t& y0, int64_t& x1, int64_t& y1) {
+  x0 = std::max<int64_t>(x0, 0);
+  y0 = std::max<int64_t>(y0, 0);
+  x1 = std::min(x1, sizeM - 1);
+  y1 = std::min(y1, sizeN - 1);
 
-      // If goal, return
-      if (p == destination) {
-        debug << "Arrived at destination." << std::endl;
-        path_start = p;
-        path = returnPath();
-        return EXIT_SUCCESS;
-      }
+  return x0 <= x1 && y0 <= y1;
+}
 
-      // Generate children
-      // For each child
-      for (auto child : p.generateChildren(*this)) {
+// Only asked when there is something to invalidate, so building a map does not build tables
+bool aStar::wasBlocked(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  if (!components.isBuilt() && !clearance.isBuilt())
+    return false;
 
-        debug << "Generated child : " << child;
+  // Current tables answer at once, refilling them for one rectangle would cost more than a scan
+  if (areas.isCurrent())
+    return areas.rectBlocked(x0, y0, x1, y1);
 
-        // If in closed list, continue
-        if (contains(closed, child))
-          continue;
+  for (int64_t y = y0; y <= y1; y++)
+    for (int64_t x = x0; x <= x1; x++)
+      if (m->get(x, y) == INACCESSIBLE)
+        return true;
 
-        // Update g and h - don't forget to look at the map for cost
-        // Replace basic COST with COST*map(parent_height-child_height) unless
-        //   child has height - 1 in which case you cannot use the child...
-        //   but this will be handles in child legality step above
-        //   calculateCost fnction required here.
-        child.setScores(p.g + COST * (int)m(child.pos.first, child.pos.second),
-                        getHeuristic().distanceOp(child, getDestination()));
-
-        debug << "Updated child H : " << child;
-        // Child is already in open, and g higher that open, continue
-        // Add child to open list
-        open.push_back(child);
-      }
+  return false;
+}
+
+void aStar::fillRect(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) {
+  if (!clip(x0, y0, x1, y1))
+    return;
+
+  bool accessibility = (w == INACCESSIBLE) || wasBlocked(x0, y0, x1, y1);
+
+  m->fill(x0, y0, x1, y1, w);
+  bulkChanged(x0, y0, x1, y1, accessibility);
+}
+
+void aStar::applyMask(int64_t x0, int64_t y0, const Array<bool, Dynamic, Dynamic>& mask, float w) {
+  int64_t x1 = x0 + mask.rows() - 1, y1 = y0 + mask.cols() - 1;
+  int64_t ox = x0, oy = y0;
+
+  if (!clip(x0, y0, x1, y1))
+    return;
+
+  bool accessibility = (w == INACCESSIBLE) || wasBlocked(x0, y0, x1, y1);
+
+  // Column by column, as Eigen stores the mask
+  for (int64_t y = y0; y <= y1; y++)
+    for (int64_t x = x0; x <= x1; x++)
+      if (mask(x - ox, y - oy))
+        m->set(x, y, w);
+
+  bulkChanged(x0, y0, x1, y1, accessibility);
+}
+
+void aStar::setBlock(int64_t x0, int64_t y0, const MatrixXf& block) {
+  int64_t x1 = x0 + block.rows() - 1, y1 = y0 + block.cols() - 1;
+  int64_t ox = x0, oy = y0;
+
+  if (!clip(x0, y0, x1, y1))
+    return;
+
+  auto part = block.block(x0 - ox, y0 - oy, x1 - x0 + 1, y1 - y0 + 1);
+  bool accessibility = (part.array() == INACCESSIBLE).any() || wasBlocked(x0, y0, x1, y1);
+
+  m->setBlock(x0, y0, part);
+  bulkChanged(x0, y0, x1, y1, accessibility);
+}
+
+void aStar::applyEdits(const std::vector<std::pair<coords, float>>& edits) {
+  int64_t x0 = sizeM, y0 = sizeN, x1 = 0, y1 = 0;
+  bool accessibility = false;
+
+  for (auto& e : edits) {
+    int64_t x = e.first.first, y = e.first.second;
+    if (x < 0 || y < 0 || x >= sizeM || y >= sizeN)
+      continue;
+
+    float before = m->get(x, y);
+    m->set(x, y, e.second);
+
+    accessibility = accessibility || ((before == INACCESSIBLE) != (e.second == INACCESSIBLE));
+    x0 = std::min(x0, x);
+    y0 = std::min(y0, y);
+    x1 = std::max(x1, x);
+    y1 = std::max(y1, y);
+  }
+
+  if (x0 < sizeM)
+    bulkChanged(x0, y0, x1, y1, accessibility);
+}
+
+// Maps above COMPONENT_LIMIT have no tables and fall back to scanning the rectangle
+bool aStar::rectBlocked(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  if (areas.refresh(*m))
+    return areas.rectBlocked(x0, y0, x1, y1);
+
+  for (int64_t y = std::max<int64_t>(y0, 0); y <= std::min(y1, sizeN - 1); y++)
+    for (int64_t x = std::max<int64_t>(x0, 0); x <= std::min(x1, sizeM - 1); x++)
+      if (m->get(x, y) == INACCESSIBLE)
+        return true;
+
+  return false;
+}
+
+double aStar::rectCost(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  double total = 0.0;
+
+  if (areas.refresh(*m))
+    return areas.rectCost(x0, y0, x1, y1);
+
+  for (int64_t y = std::max<int64_t>(y0, 0); y <= std::min(y1, sizeN - 1); y++)
+    for (int64_t x = std::max<int64_t>(x0, 0); x <= std::min(x1, sizeM - 1); x++)
+      if (m->get(x, y) != INACCESSIBLE)
+        total += COST * (int)m->get(x, y);
+
+  return total;
+}
+
+#pragma endregion
+
+#pragma region Algorithm
+
+// Algorithm
+
+int aStar::runAlgorithm() {
+    queryTimer timer(*this, QUERY_ASTAR);
+    goalSet targets(h);
 
-      debug << "Open list: " << std::endl;
-      for (auto i : open)
-        debug << i;
+    path.clear();
+    pathVersion = mapVersion;
+    stats = searchStats();
+    beginPhases();
+
+    if (!reachable()) {
+      debug << "Destination unreachable from origin." << std::endl;
+      return EXIT_FAILURE;
     }
 
-    return EXIT_FAILURE;
+    targets.add(destination.pos, 0);
+    targets.build();
+    prepareHeuristic();
+
+    return bestFirst({ searchSource{ toIndex(origin.pos), 0.0f, 0 } }, targets);
+}
+
+float aStar::stepCost(const coords& c) {
+  return COST * (int)m->get(c.first, c.second);
 }
 
 std::vector<coords> aStar::getPath() {
@@ -573,7 +1204,7 @@ void aStar::printMap(bool with_path) {
     std::cout << "|";
 
     for (int j = 0; j < this->sizeN; j++) {
-      val = this->m(i,j);
+      val = m->get(i, j);
       c = coords(i,j);
 
       switch (val)
@@ -621,4 +1252,853 @@ void aStar::printMap(bool with_path) {
 
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+#pragma region Anytime
+
+// Anytime Repairing A* (Likhachev et al.) - runs weighted A* with a decreasing inflation,
+//   keeping g-values between iterations and only re-expanding inconsistent nodes.
+
+int aStar::runAnytime(std::chrono::steady_clock::time_point deadline, anytimeCallback onImprove) {
+  return runAnytime(ANYTIME_EPSILON, ANYTIME_EPSILON_DELTA, deadline, onImprove);
+}
+
+int aStar::runAnytime(float epsilon, float delta, std::chrono::steady_clock::time_point deadline,
+                      anytimeCallback onImprove) {
+    typedef std::pair<float, cellIndex> entry; // Key, cell
+
+    queryTimer timer(*this, QUERY_ANYTIME);
+    auto start = std::chrono::steady_clock::now();
+    timer.epsilon = epsilon;
+    timer.delta = delta;
+    timer.deadline = deadline;
+
+    std::vector<entry> openHeap;
+    std::vector<cellIndex> incons;
+    cellIndex adjacent[8];
+    auto cmp = std::greater<entry>();
+
+    path.clear();
+    pathVersion = mapVersion;
+    anytime = anytimeResult();
+
+    if (!reachable())
+      return EXIT_FAILURE;
+
+    epsilon = std::max(epsilon, 1.0f);
+    delta = std::max(delta, 0.0f);
+
+    // Nodes are created on first touch, h is computed once and kept across iterations
+    prepareHeuristic();
+    anytimeNodes.reset(m->indexSpace());
+    traceBegin();
+
+    auto node = [&](cellIndex i) -> anytimeNode& {
+      bool created;
+      auto& n = anytimeNodes.get(i, created);
+      if (created)
+        n.h = goalDistance(i);
+      return n;
+    };
+
+    auto push = [&](cellIndex i, anytimeNode& n) {
+      n.open = true;
+      openHeap.push_back(entry(n.g + epsilon * n.h, i));
+      std::push_heap(openHeap.begin(), openHeap.end(), cmp);
+      if (tracing)
+        tracing->record(TRACE_PUSH, i, n.g, n.h);
+    };
+
+    cellIndex goal = toIndex(destination.pos);
+    cellIndex first = toIndex(origin.pos);
+
+    node(first).g = 0.0f;
+    push(first, node(first));
+    debug << "Anytime pushed origin : " << this->origin;
+
+    float bestCost = std::numeric_limits<float>::infinity();
+    float finished = 0.0f;     // Inflation of the last iteration that ran to completion
+    bool timedOut = false;
+    bool admissible = (hTable && hTableMode == HEURISTIC_TABLE_EXACT) || h.isAdmissible();
+
+    while (!timedOut) {
+
+      // Improve path - weighted A* over the current open list
+      while (!openHeap.empty()) {
+        auto top = openHeap.front();
+        auto& n = node(top.second);
+
+        // Lazy deletion of stale entries
+        if (!n.open || top.first != n.g + epsilon * n.h) {
+          std::pop_heap(openHeap.begin(), openHeap.end(), cmp);
+          openHeap.pop_back();
+          if (tracing) {
+            tracing->record(TRACE_POP, top.second, n.g, n.h);
+            tracing->record(TRACE_PRUNE, top.second, n.g, n.h);
+          }
+          continue;
+        }
+
+        if (node(goal).g <= top.first)
+          break;
+
+        // Checked before the pop, so the node still counts towards the lower bound
+        if (anytime.expansions && anytime.expansions % ANYTIME_CHECK_EVERY == 0 &&
+            std::chrono::steady_clock::now() >= deadline) {
+          timedOut = true;
+          break;
+        }
+
+        std::pop_heap(openHeap.begin(), openHeap.end(), cmp);
+        openHeap.pop_back();
+        n.open = false;
+        n.closed = true;
+        anytime.expansions++;
+        if (tracing) {
+          tracing->record(TRACE_POP, top.second, n.g, n.h);
+          tracing->record(TRACE_EXPAND, top.second, n.g, n.h);
+        }
+
+        coords c = toCoords(top.second);
+        if (n.parent != NO_PARENT)
+          m->prefetch(c.first, c.second, adjacentDelta[n.parent][0], adjacentDelta[n.parent][1]);
+
+        // Neighbours come from the layout's offset tables
+        m->adjacent(c.first, c.second, top.second, adjacent);
+
+        for (auto DIR : dirList) {
+          cellIndex ci = adjacent[DIR];
+          if (ci == INEXISTENT)
+            continue;
+
+          float w = m->at(ci);
+          if (w == INACCESSIBLE || (agentRadius > 0 && !fits(ci)))
+            continue;
+
+          auto& child = node(ci);
+          float g = n.g + COST * (int)w;
+
+          if (g < child.g) {
+            child.g = g;
+            child.parent = DIR;
+
+            if (!child.closed)
+              push(ci, child);
+            else {
+              if (tracing)
+                tracing->record(TRACE_REOPEN, ci, g, child.h);
+
+              if (!child.incons) {
+                child.incons = true;
+                incons.push_back(ci);
+              }
+            }
+          }
+          else if (tracing)
+            tracing->record(TRACE_PRUNE, ci, g, child.h);
+        }
+      }
+
+      // Bound is g(goal) / min(g + h) over OPEN and INCONS
+      float cost = node(goal).g;
+      float lower = std::numeric_limits<float>::infinity();
+      for (auto& e : openHeap) {
+        auto& n = node(e.second);
+        if (n.open)
+          lower = std::min(lower, n.g + n.h);
+      }
+      for (auto i : incons)
+        lower = std::min(lower, node(i).g + node(i).h);
+
+      // An iteration cut off by the deadline guarantees nothing for its epsilon, only the ratio
+      //   holds then. Neither holds if h can overestimate
+      float bound = (lower >= cost) ? 1.0f : (timedOut ? cost / lower : std::min(epsilon, cost / lower));
+      if (!admissible)
+        bound = std::numeric_limits<float>::infinity();
+
+      // Publish if the path got cheaper or its bound got tighter
+      if (cost < bestCost || (cost == bestCost && bound < anytime.bound)) {
+        bestCost = cost;
+
+        path = tracePath(anytimeNodes, goal);
+
+        anytime.path = path;
+        anytime.cost = cost;
+        anytime.epsilon = timedOut ? finished : epsilon;
+        anytime.bound = bound;
+        anytime.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start);
+
+        debug << "Anytime path, cost " << cost << ", bound " << anytime.bound << std::endl;
+
+        if (onImprove)
+          onImprove(anytime);
+      }
+
+      if (timedOut || epsilon <= 1.0f || delta <= 0.0f || openHeap.empty())
+        break;
+
+      finished = epsilon;
+
+      if (std::chrono::steady_clock::now() >= deadline)
+        break;
+
+      // Decrease inflation, move INCONS into OPEN, clear CLOSED and rebuild the keys
+      epsilon = std::max(1.0f, epsilon - delta);
+
+      for (auto i : incons) {
+        node(i).incons = false;
+        node(i).open = true;
+      }
+      incons.clear();
+
+      // In the trace the old entries leave the open list and the open nodes enter it again
+      if (tracing)
+        for (auto& e : openHeap)
+          tracing->record(TRACE_POP, e.second, node(e.second).g, node(e.second).h);
+
+      openHeap.clear();
+      for (auto i : anytimeNodes.used()) {
+        auto& n = node(i);
+        n.closed = false;
+        if (n.open) {
+          openHeap.push_back(entry(n.g + epsilon * n.h, i));
+          if (tracing)
+            tracing->record(TRACE_PUSH, i, n.g, n.h);
+        }
+      }
+      std::make_heap(openHeap.begin(), openHeap.end(), cmp);
+    }
+
+    queryCost = bestCost;
+    traceEnd((bestCost < std::numeric_limits<float>::infinity()) ? goal : INEXISTENT, bestCost);
+    return (bestCost < std::numeric_limits<float>::infinity()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#pragma endregion
+
+
+#pragma region Any-angle
+
+bool aStar::sightReady() {
+  if (sight.isBuilt() && sight.getRadius() == agentRadius)
+    return true;
+
+  if (agentRadius > 0 && !clearance.isBuilt() && !clearance.build(*m))
+    return false;
+
+  return sight.build(*m, &clearance, agentRadius);
+}
+
+bool aStar::lineOfSight(const coords& a, const coords& b) {
+  if (!isValid(a) || !isValid(b) || !sightReady())
+    return false;
+
+  return sight.visible(a.first, a.second, b.first, b.second);
+}
+
+// Uniform segments cost MIN_WEIGHT per step straight from the bitboards, others walk the line
+float aStar::segmentCost(const coords& a, const coords& b) {
+  int64_t dx = b.first - a.first, dy = b.second - a.second;
+  int64_t steps = std::max(std::abs(dx), std::abs(dy));
+
+  if (sight.uniform(a.first, a.second, b.first, b.second))
+    return COST * MIN_WEIGHT * steps;
+
+  float cost = 0.0f;
+  for (int64_t i = 1; i <= steps; i++) {
+    int64_t x = a.first + std::lround((double)i * dx / steps);
+    int64_t y = a.second + std::lround((double)i * dy / steps);
+    float w = m->get(x, y);
+
+    if (w == INACCESSIBLE || (agentRadius > 0 && !fits(toIndex(coords(x, y)))))
+      return std::numeric_limits<float>::infinity();
+
+    cost += COST * (int)w;
+  }
+
+  return cost;
+}
+
+// Lazy Theta* (Nash et al.) - children inherit their parent's parent when that line is no dearer
+//   than the step. Sight is verified once when the child is expanded, falling back to the best
+//   closed neighbour
+int aStar::runAnyAngle() {
+    typedef std::pair<float, cellIndex> entry; // f, cell
+
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+    cellIndex adjacent[8];
+    queryTimer timer(*this, QUERY_ANY_ANGLE);
+
+    path.clear();
+    pathVersion = mapVersion;
+    stats = searchStats();
+    anyAngleCost = std::numeric_limits<float>::infinity();
+
+    if (!reachable())
+      return EXIT_FAILURE;
+
+    // Maps too large for the bitboards get the 8-direction path
+    if (!sightReady())
+      return runAlgorithm({ destination });
+
+    prepareHeuristic();
+    thetaNodes.reset(m->indexSpace());
+
+    auto node = [&](cellIndex i) -> thetaNode& {
+      bool created;
+      auto& n = thetaNodes.get(i, created);
+      if (created)
+        n.h = goalDistance(i);
+      return n;
+    };
+
+    auto passable = [&](cellIndex i) {
+      return m->at(i) != INACCESSIBLE && (agentRadius == 0 || fits(i));
+    };
+
+    cellIndex first = toIndex(origin.pos);
+    cellIndex goal = toIndex(destination.pos);
+
+    node(first).g = 0.0f;
+    node(first).parent = first;
+    openList.push(entry(node(first).h, first));
+
+    while (!openList.empty()) {
+      auto top = openList.top();
+      openList.pop();
+
+      auto& n = node(top.second);
+      if (n.closed || top.first != n.g + n.h)
+        continue;
+
+      coords c = toCoords(top.second);
+      m->adjacent(c.first, c.second, top.second, adjacent);
+
+      // Parent out of sight - take the cheapest expanded neighbour instead
+      coords pc = toCoords(n.parent);
+      if (n.parent != top.second && !sight.visible(pc.first, pc.second, c.first, c.second)) {
+        n.g = std::numeric_limits<float>::infinity();
+
+        for (auto a : adjacent) {
+          if (a == INEXISTENT || !(thetaNodes.contains)(a) || !node(a).closed)
+            continue;
+
+          float g = node(a).g + COST * (int)m->at(top.second);
+          if (g < n.g) {
+            n.g = g;
+            n.parent = a;
+          }
+        }
+      }
+
+      n.closed = true;
+      stats.expansions++;
+
+      if (top.second == goal) {
+        anyAngleCost = n.g;
+        queryCost = n.g;
+
+        for (cellIndex i = goal; ; i = node(i).parent) {
+          path.push_back(toCoords(i));
+          if (node(i).parent == i)
+            break;
+        }
+        std::reverse(path.begin(), path.end());
+
+        return EXIT_SUCCESS;
+      }
+
+      cellIndex parent = n.parent;
+      coords parentCoords = toCoords(parent);
+      float parentG = node(parent).g, ownG = n.g;
+
+      for (auto a : adjacent) {
+        if (a == INEXISTENT || !passable(a))
+          continue;
+
+        auto& child = node(a);
+        if (child.closed)
+          continue;
+
+        // Straight from the parent's parent, or a plain step when that line is blocked or, across
+        //   heavy cells, dearer
+        cellIndex via = top.second;
+        float g = ownG + COST * (int)m->at(a);
+        float line = parentG + segmentCost(parentCoords, toCoords(a));
+        if (line <= g) {
+          via = parent;
+          g = line;
+        }
+
+        if (g < child.g) {
+          child.g = g;
+          child.parent = via;
+          openList.push(entry(g + child.h, a));
+          stats.generated++;
+        }
+      }
+    }
+
+    return EXIT_FAILURE;
+}
+
+#pragma endregion
+
+
+#pragma region Best-first
+
+// Path from the node without parent to last, following parent directions
+template<class Node>
+std::vector<coords> aStar::tracePath(nodeTable<Node>& nodes, cellIndex last) {
+  gridGraph graph(*m);
+  std::vector<coords> trace;
+
+  for (auto i : traceVertices(graph, nodes, last))
+    trace.push_back(toCoords(i));
+
+  return trace;
+}
+
+// A* from a set of (cell, initial g) sources to the first goal popped, on the graph engine
+int aStar::bestFirst(const std::vector<searchSource>& sources, goalSet& goals) {
+    gridGraph graph(*m, (agentRadius > 0 && (clearance.isBuilt() || clearance.build(*m))) ? &clearance : nullptr,
+                    agentRadius);
+    cellIndex last;
+
+    goalReached = INEXISTENT;
+    originReached = INEXISTENT;
+
+    perfReading setup;
+    endPhase(setup);
+    traceBegin();
+
+    int result = bestFirstSearch(graph, searchNodes, sources,
+                                 [&](cellIndex i) { return hTable ? hTable->at(i) : goals.distance(toCoords(i)); },
+                                 [&](cellIndex i) { return goals.goalAt(toCoords(i)); },
+                                 stats, last, goalReached, tracing);
+
+    stats.setup = setup;
+    endPhase(stats.search);
+    queryCost = (result == EXIT_SUCCESS) ? searchNodes.get(last).g : std::numeric_limits<float>::infinity();
+    traceEnd(last, queryCost);
+
+    if (result != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+
+    debug << "Arrived at goal " << goalReached << " : " << toCoords(last);
+    originReached = searchNodes.get(last).source;
+    path = tracePath(searchNodes, last);
+    pathStart = searchNodes.get(toIndex(path.front())).g;
+    endPhase(stats.trace);
+
+    return EXIT_SUCCESS;
+}
+
+int aStar::runAlgorithm(const std::vector<point>& goals) {
+    queryTimer timer(*this, QUERY_MULTI_GOAL);
+    timer.goals = &goals;
+    goalSet targets(h);
+
+    path.clear();
+    pathVersion = mapVersion;
+    stats = searchStats();
+    beginPhases();
+    goalReached = INEXISTENT;
+
+    if (!isValid(origin.pos))
+      return EXIT_FAILURE;
+
+    if (!components.isBuilt())
+      components.build(*m);
+
+    // Goals walled off from the origin are dropped before searching
+    cellIndex first = toIndex(origin.pos);
+    for (size_t k = 0; k < goals.size(); k++)
+      if (isValid(goals[k].pos) && components.connected(first, toIndex(goals[k].pos)))
+        targets.add(goals[k].pos, k);
+
+    if (targets.empty())
+      return EXIT_FAILURE;
+
+    targets.build();
+    hTable.reset();
+
+    return bestFirst({ searchSource{ first, 0.0f, 0 } }, targets);
+}
+
+int aStar::runAlgorithm(const std::vector<std::pair<point, float>>& origins) {
+    queryTimer timer(*this, QUERY_MULTI_SOURCE);
+    timer.origins = &origins;
+    goalSet targets(h);
+    std::vector<searchSource> sources;
+
+    path.clear();
+    pathVersion = mapVersion;
+    stats = searchStats();
+    beginPhases();
+    goalReached = originReached = INEXISTENT;
+
+    if (!isValid(destination.pos))
+      return EXIT_FAILURE;
+
+    if (!components.isBuilt())
+      components.build(*m);
+
+    // Origins walled off from the destination are dropped before searching
+    cellIndex last = toIndex(destination.pos);
+    for (size_t k = 0; k < origins.size(); k++)
+      if (isValid(origins[k].first.pos) && components.connected(toIndex(origins[k].first.pos), last))
+        sources.push_back(searchSource{ toIndex(origins[k].first.pos), origins[k].second, (int)k });
+
+    if (sources.empty())
+      return EXIT_FAILURE;
+
+    targets.add(destination.pos, 0);
+    targets.build();
+    prepareHeuristic();
+
+    return bestFirst(sources, targets);
+}
+
+int aStar::distanceField(const std::vector<std::pair<point, float>>& sources, std::vector<float>& field,
+                         bool reverse) {
+    typedef std::pair<float, cellIndex> entry; // distance, cell
+
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+    cellIndex adjacent[8];
+
+    if (m->indexSpace() > DENSE_SEARCH_LIMIT)
+      return EXIT_FAILURE;
+
+    field.assign(m->indexSpace(), std::numeric_limits<float>::infinity());
+
+    for (auto& s : sources) {
+      if (!isValid(s.first.pos))
+        continue;
+
+      cellIndex i = toIndex(s.first.pos);
+      if (s.second < field[i]) {
+        field[i] = s.second;
+        openList.push(entry(s.second, i));
+      }
+    }
+
+    while (!openList.empty()) {
+      auto top = openList.top();
+      openList.pop();
+
+      if (top.first != field[top.second])
+        continue;
+
+      int64_t x, y;
+      m->position(top.second, x, y);
+      m->adjacent(x, y, top.second, adjacent);
+
+      // Forward steps pay for the cell entered; reversed, a step into this cell costs its weight
+      float here = COST * (int)m->at(top.second);
+
+      for (auto a : adjacent) {
+        if (a == INEXISTENT || m->at(a) == INACCESSIBLE)
+          continue;
+
+        float d = top.first + (reverse ? here : COST * (int)m->at(a));
+        if (d < field[a]) {
+          field[a] = d;
+          openList.push(entry(d, a));
+        }
+      }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Instrumentation
+
+void aStar::traceBegin() {
+  tracing = (tracer && tracer->isOpen()) ? &tracer->local() : nullptr;
+
+  if (tracing)
+    tracing->begin(m->rows(), m->cols(), m->storageType());
+}
+
+void aStar::traceEnd(cellIndex last, float cost) {
+  if (tracing)
+    tracing->end(last, cost, last != INEXISTENT);
+  tracing = nullptr;
+}
+
+void aStar::beginPhases() {
+  if (countEvents)
+    phaseMark = perfCounters::local().sample();
+}
+
+// Counts since the previous mark
+void aStar::endPhase(perfReading& into) {
+  if (!countEvents)
+    return;
+
+  perfSample now = perfCounters::local().sample();
+  into = perfCounters::difference(phaseMark, now);
+  phaseMark = now;
+}
+
+aStar::queryTimer::queryTimer(aStar& a, int engine) : a(a), engine(engine) {
+  bool outermost = a.timing++ == 0;
+  if (outermost) {
+    a.queryCost = std::numeric_limits<float>::infinity();
+    a.pathStart = 0.0f;
+  }
+
+  active = outermost && (a.latency || (a.qlog && a.qlog->isOpen()));
+  if (active)
+    start = std::chrono::steady_clock::now();
+}
+
+// The path's ends name the query, which for set searches is the origin or goal actually used
+aStar::queryTimer::~queryTimer() {
+  a.timing--;
+  if (!active)
+    return;
+
+  queryRecord query;
+  query.engine = engine;
+  query.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  query.found = !a.path.empty();
+  query.length = a.path.size();
+
+  coords from = query.found ? a.path.front() : a.origin.pos;
+  coords to = query.found ? a.path.back() : a.destination.pos;
+  query.ox = from.first; query.oy = from.second;
+  query.dx = to.first; query.dy = to.second;
+
+  if (engine == QUERY_ANYTIME)
+    query.expansions = a.anytime.expansions;
+  else
+    query.expansions = a.stats.expansions;
+
+  if (a.latency)
+    a.latency->record(query);
+
+  if (a.qlog)
+    logQuery(query);
+}
+
+// The query as it was asked - set searches log their whole set as extra points
+void aStar::queryTimer::logQuery(const queryRecord& query) {
+  queryLogRecord r;
+  std::memset(&r, 0, sizeof(r));
+  std::vector<queryLogPoint> points;
+
+  r.when = std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch()).count();
+  r.mapVersion = a.mapVersion;
+  r.nanos = query.nanos;
+  r.expansions = query.expansions;
+  r.ox = a.origin.pos.first; r.oy = a.origin.pos.second;
+  r.dx = a.destination.pos.first; r.dy = a.destination.pos.second;
+  r.cost = query.found ? a.queryCost : std::numeric_limits<float>::infinity();
+  r.length = query.length;
+  r.radius = a.agentRadius;
+  r.engine = engine;
+  r.heuristic = a.h.getHeuristic();
+  r.tableMode = a.hTableMode;
+  r.found = query.found;
+
+  if (engine == QUERY_ANYTIME) {
+    r.epsilon = epsilon;
+    r.delta = delta;
+    r.budget = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(deadline - start).count());
+  }
+
+  if (goals)
+    for (auto& g : *goals)
+      points.push_back(queryLogPoint{ g.pos.first, g.pos.second, 0.0f, 0 });
+
+  if (origins)
+    for (auto& o : *origins)
+      points.push_back(queryLogPoint{ o.first.pos.first, o.first.pos.second, o.second, 0 });
+
+  a.qlog->append(r, points);
+}
+
+#pragma endregion
+
+#pragma region Path repair
+
+// Only cells inside an edit since version (grown by the agent radius, as clearance changes
+//   around an edit) are tested. Single-cell edits go in a hash set, rectangles are scanned
+size_t aStar::checkPath(const std::vector<coords>& path, uint64_t version, std::vector<size_t>& broken) {
+  std::unordered_map<int64_t, bool> cells;
+  std::vector<dirtyRect> rects;
+  bool everyCell = version < dirtyFrom || version > mapVersion;
+
+  auto key = [](int64_t x, int64_t y) { return (x << 32) ^ (y & 0xFFFFFFFFll); };
+
+  broken.clear();
+  repairStats = pathRepairStats();
+
+  if (!everyCell)
+    for (auto it = dirtyLog.rbegin(); it != dirtyLog.rend() && it->version > version; ++it) {
+      if (agentRadius == 0 && it->x0 == it->x1 && it->y0 == it->y1)
+        cells[key(it->x0, it->y0)] = true;
+      else
+        rects.push_back(dirtyRect{ it->version, it->x0 - agentRadius, it->y0 - agentRadius,
+                                   it->x1 + agentRadius, it->y1 + agentRadius });
+    }
+
+  for (size_t k = 0; k < path.size(); k++) {
+    int64_t x = path[k].first, y = path[k].second;
+    bool touched = everyCell || cells.count(key(x, y));
+
+    for (size_t r = 0; !touched && r < rects.size(); r++)
+      touched = x >= rects[r].x0 && y >= rects[r].y0 && x <= rects[r].x1 && y <= rects[r].y1;
+
+    if (!touched)
+      continue;
+
+    repairStats.checked++;
+    if (!isValid(path[k]))
+      broken.push_back(k);
+  }
+
+  repairStats.broken = broken.size();
+  return broken.size();
+}
+
+// A* from one cell to another on the graph engine, never leaving the window
+int aStar::route(cellIndex from, cellIndex to, int64_t x0, int64_t y0, int64_t x1, int64_t y1,
+                 std::vector<coords>& segment, float& cost) {
+    gridGraph graph(*m, (agentRadius > 0 && (clearance.isBuilt() || clearance.build(*m))) ? &clearance : nullptr,
+                    agentRadius);
+    coords goal = toCoords(to);
+    searchStats local;
+    cellIndex last;
+    int reached;
+
+    // Cells outside the window get an infinite h and are never entered
+    int result = bestFirstSearch(graph, searchNodes, { searchSource{ from, 0.0f, 0 } },
+                                 [&](cellIndex i) {
+                                   coords c = toCoords(i);
+                                   if (c.first < x0 || c.second < y0 || c.first > x1 || c.second > y1)
+                                     return std::numeric_limits<float>::infinity();
+                                   return COST * MIN_WEIGHT * std::max(std::abs(c.first - goal.first),
+                                                                       std::abs(c.second - goal.second));
+                                 },
+                                 [&](cellIndex i) { return (i == to) ? 0 : INEXISTENT; },
+                                 local, last, reached);
+
+    repairStats.expansions += local.expansions;
+
+    if (result != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+
+    segment = tracePath(searchNodes, last);
+    cost = searchNodes.get(last).g;
+    return EXIT_SUCCESS;
+}
+
+// The cost is priced again on the current map, edits may have changed cells the path kept. An
+//   any-angle path left whole keeps its lines
+int aStar::repairPath(float maxDetour) {
+  int result = repairPath(path, pathVersion, maxDetour);
+  pathVersion = mapVersion;
+
+  queryCost = std::numeric_limits<float>::infinity();
+  if (result == EXIT_SUCCESS) {
+    queryCost = pathStart;
+    for (size_t k = 1; k < path.size(); k++) {
+      bool step = std::max(std::abs(path[k].first - path[k - 1].first),
+                           std::abs(path[k].second - path[k - 1].second)) == 1;
+      queryCost += step ? stepCost(path[k]) : segmentCost(path[k - 1], path[k]);
+    }
+  }
+
+  return result;
+}
+
+int aStar::repairPath(std::vector<coords>& path, uint64_t version, float maxDetour) {
+  std::vector<size_t> broken;
+  std::vector<coords> repaired, segment;
+  float cost;
+
+  checkPath(path, version, broken);
+
+  if (path.empty())
+    return EXIT_FAILURE;
+
+  if (broken.empty())
+    return EXIT_SUCCESS;
+
+  coords first = path.front(), last = path.back();
+
+  // Ends must survive and every step be a grid step for a local repair
+  bool local = broken.front() > 0 && broken.back() + 1 < path.size();
+  for (size_t k = 1; local && k < path.size(); k++)
+    local = std::max(std::abs(path[k].first - path[k - 1].first), std::abs(path[k].second - path[k - 1].second)) == 1;
+
+  size_t cursor = 0, k = 0;
+
+  while (local && k < broken.size()) {
+    // Maximal run of broken cells [i, j], re-routed from path[i - 1] to path[j + 1]
+    size_t i = broken[k], j = i;
+    while (k + 1 < broken.size() && broken[k + 1] == j + 1) {
+      k++;
+      j++;
+    }
+    k++;
+
+    size_t a = i - 1, b = j + 1;
+    int64_t x0 = sizeM, y0 = sizeN, x1 = 0, y1 = 0;
+    float replaced = 0.0f;
+
+    for (size_t c = a; c <= b; c++) {
+      x0 = std::min<int64_t>(x0, path[c].first);
+      y0 = std::min<int64_t>(y0, path[c].second);
+      x1 = std::max<int64_t>(x1, path[c].first);
+      y1 = std::max<int64_t>(y1, path[c].second);
+
+      if (c > a)
+        replaced += isValid(path[c]) ? stepCost(path[c]) : COST * MIN_WEIGHT;
+    }
+
+    if (route(toIndex(path[a]), toIndex(path[b]), x0 - PATH_REPAIR_MARGIN, y0 - PATH_REPAIR_MARGIN,
+              x1 + PATH_REPAIR_MARGIN, y1 + PATH_REPAIR_MARGIN, segment, cost) != EXIT_SUCCESS ||
+        cost > maxDetour * replaced) {
+      local = false;
+      break;
+    }
+
+    repaired.insert(repaired.end(), path.begin() + cursor, path.begin() + a);
+    repaired.insert(repaired.end(), segment.begin(), segment.end() - 1);
+    cursor = b;
+    repairStats.segments++;
+  }
+
+  if (local) {
+    repaired.insert(repaired.end(), path.begin() + cursor, path.end());
+    path.swap(repaired);
+    return EXIT_SUCCESS;
+  }
+
+  debug << "Path repair falls back to a full search." << std::endl;
+  repairStats.segments = 0;
+  repairStats.fullSearch = true;
+  path.clear();
+
+  if (!isValid(first) || !isValid(last))
+    return EXIT_FAILURE;
+
+  if ((components.isBuilt() || components.build(*m)) && !components.connected(toIndex(first), toIndex(last)))
+    return EXIT_FAILURE;
+
+  if (route(toIndex(first), toIndex(last), 0, 0, sizeM - 1, sizeN - 1, segment, cost) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  path.swap(segment);
+  return EXIT_SUCCESS;
+}
+
+#pragma endregion
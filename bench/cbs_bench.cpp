@@ -0,0 +1,99 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// CBS on Moving AI MAPF instances - time, cost and constraint tree size per agent count
+//
+// Usage: cbs_bench [map scen] [agents] [threads] [budget]
+//   Without files a random 32x32 instance is written to /tmp and used
+
+#include "cbs.hpp"
+#include "mapio.hpp"
+#include <random>
+
+using namespace std;
+
+// 32x32 with 15% obstacles and 64 start/goal pairs on open cells
+static void writeInstance(const string& mapPath, const string& scenPath) {
+    mt19937 rng(11);
+    aStar a;
+    a.setMapSize(32, 32);
+
+    for (int x = 0; x < 32; x++)
+      for (int y = 0; y < 32; y++)
+        if (rng() % 100 < 15)
+          a.setInaccessible(x, y);
+
+    vector<scenarioEntry> entries;
+    vector<coords> used;
+    auto pick = [&]() {
+      coords c;
+      do
+        c = coords(rng() % 32, rng() % 32);
+      while (a.getMap().get(c.first, c.second) == INACCESSIBLE || contains(used, c));
+      used.push_back(c);
+      return c;
+    };
+
+    for (int i = 0; i < 64; i++) {
+      scenarioEntry e;
+      e.map = "random-32-32.map";
+      e.start = pick();
+      e.goal = pick();
+      entries.push_back(e);
+    }
+
+    saveMovingAiMap(mapPath, a);
+    saveMovingAiScenario(scenPath, a, entries);
+}
+
+int main(int argc, char** argv) {
+    string mapPath = "/tmp/random-32-32.map", scenPath = "/tmp/random-32-32.scen";
+    int arg = 1;
+
+    if (argc > 2 && !isdigit(argv[1][0])) {
+      mapPath = argv[1];
+      scenPath = argv[2];
+      arg = 3;
+    }
+    else
+      writeInstance(mapPath, scenPath);
+
+    int agents = (argc > arg) ? atoi(argv[arg]) : 16;
+    int threads = (argc > arg + 1) ? atoi(argv[arg + 1]) : 4;
+    size_t budget = (argc > arg + 2) ? atoll(argv[arg + 2]) : CBS_NODE_BUDGET;
+
+    aStar a;
+    vector<scenarioEntry> entries;
+
+    if (loadMovingAiMap(mapPath, a) != EXIT_SUCCESS || loadMovingAiScenario(scenPath, entries) != EXIT_SUCCESS) {
+      cerr << "Cannot read " << mapPath << " / " << scenPath << endl;
+      return EXIT_FAILURE;
+    }
+
+    agents = min(agents, (int)entries.size());
+    cout << "Map " << mapPath << " (" << a.getMap().rows() << "x" << a.getMap().cols() << "), "
+         << entries.size() << " scenario entries" << endl;
+    cout << "agents threads  solved        ms      cost  expanded  generated  low_level  cache_hits  bypasses  cardinal" << endl;
+
+    for (int k = 2; k <= agents; k += 2) {
+      for (int t : { 1, threads }) {
+        cbsSolver cbs(a);
+        for (int i = 0; i < k; i++)
+          cbs.addAgent(entries[i].start, entries[i].goal);
+        cbs.setNodeBudget(budget);
+
+        auto t0 = chrono::steady_clock::now();
+        bool solved = cbs.solve(t) == EXIT_SUCCESS;
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        auto s = cbs.getStats();
+
+        printf("%6d %7d %7s %9.2f %9.0f %9zu %10zu %10zu %11zu %9zu %9zu\n", k, t, solved ? "yes" : "no", ms,
+               solved ? cbs.getCost() : 0.0f, s.expanded, s.generated, s.lowLevel, s.cacheHits, s.bypasses, s.cardinal);
+
+        if (t == threads)
+          break;
+      }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Search time and last level cache misses per map layout
+//
+// Usage: layout_bench [size] [queries]
+
+#include "astar.hpp"
+#include <random>
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    int64_t size = (argc > 1) ? atoll(argv[1]) : 4096;
+    int queries = (argc > 2) ? atoi(argv[2]) : 20;
+
+    // Same obstacles and query pairs for every layout
+    mt19937 rng(7);
+    vector<pair<int64_t, int64_t>> walls;
+    for (int64_t i = 0; i < size * size / 256; i++)
+      walls.push_back(make_pair(rng() % size, rng() % size));
+
+    vector<pair<coords, coords>> pairs;
+    for (int i = 0; i < queries; i++)
+      pairs.push_back(make_pair(coords(rng() % size, rng() % size), coords(rng() % size, rng() % size)));
+
+    cout << "Map " << size << "x" << size << ", " << queries << " queries" << endl;
+    cout << "layout      ms/query  expansions/query  llc_misses/query" << endl;
+
+    const pair<int, const char*> layouts[] = { { DENSE_STORAGE, "dense" }, { MORTON_STORAGE, "morton" },
+                                               { BLOCKED_STORAGE, "blocked" }, { TILED_STORAGE, "tiled" } };
+
+    for (auto& layout : layouts) {
+      aStar a;
+      a.setMapSize(size, size, layout.first);
+      a.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+
+      // Short vertical and horizontal walls
+      for (size_t i = 0; i < walls.size(); i++)
+        for (int k = 0; k < 16; k++) {
+          int64_t x = walls[i].first + ((i & 1) ? k : 0), y = walls[i].second + ((i & 1) ? 0 : k);
+          if (x < size && y < size)
+            a.setInaccessible(x, y);
+        }
+
+      perfCounters& counters = perfCounters::local();
+      double ms = 0.0;
+      size_t expansions = 0;
+      int64_t misses = 0;
+
+      for (auto& q : pairs) {
+        a.setWeight(q.first.first, q.first.second, MIN_WEIGHT);
+        a.setWeight(q.second.first, q.second.second, MIN_WEIGHT);
+        a.setOrigin(point(q.first.first, q.first.second));
+        a.setDestination(point(q.second.first, q.second.second));
+
+        auto t0 = chrono::steady_clock::now();
+        perfSample before = counters.sample();
+        a.runAnytime(1.0f, 0.0f, t0 + chrono::seconds(600));
+        int64_t count = perfCounters::difference(before, counters.sample()).cacheMisses;
+
+        ms += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        expansions += a.getAnytimeResult().expansions;
+        misses = (count < 0 || misses < 0) ? -1 : misses + count;
+      }
+
+      printf("%-10s %9.2f %17zu ", layout.second, ms / queries, expansions / queries);
+      if (misses < 0)
+        printf("%17s\n", "n/a");
+      else
+        printf("%17lld\n", (long long)(misses / queries));
+    }
+
+    return EXIT_SUCCESS;
+}
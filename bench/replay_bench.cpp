@@ -0,0 +1,195 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Replays a query log against this build and compares latency, expansions and cost with the
+//   recorded run
+//
+// Usage: replay_bench log map [-t threads] [-v map_version] [-n top]
+//   The map is a Moving AI file holding the map the log was recorded on. Map edits are not in
+//   the log, so a log spanning several map versions should be replayed one version at a time.
+//   Anytime queries run to their recorded budget and are not expected to match exactly
+
+#include "astar.hpp"
+#include "mapio.hpp"
+#include <iomanip>
+#include <set>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+struct replayResult {
+    uint64_t nanos = 0;
+    uint64_t expansions = 0;
+    float cost = 0.0f;
+    bool found = false;
+};
+
+static void replay(aStar& world, shared_ptr<heuristicCache> cache, const loggedQuery& q, replayResult& out) {
+    auto& r = q.record;
+
+    world.setOrigin(point(r.ox, r.oy));
+    world.setDestination(point(r.dx, r.dy));
+    world.getHeuristic().setHeuristic(r.heuristic);
+    world.setAgentRadius(r.radius);
+    world.setHeuristicCache(r.tableMode == HEURISTIC_TABLE_NONE ? nullptr : cache, r.tableMode);
+
+    vector<point> goals;
+    vector<pair<point, float>> origins;
+    for (auto& p : q.points) {
+      goals.push_back(point(p.x, p.y));
+      origins.push_back(make_pair(point(p.x, p.y), p.g));
+    }
+
+    auto start = steady_clock::now();
+    int result = EXIT_FAILURE;
+
+    if (r.engine == QUERY_MULTI_GOAL)
+      result = world.runAlgorithm(goals);
+    else if (r.engine == QUERY_MULTI_SOURCE)
+      result = world.runAlgorithm(origins);
+    else if (r.engine == QUERY_ANYTIME)
+      result = world.runAnytime(r.epsilon, r.delta, start + microseconds(r.budget));
+    else if (r.engine == QUERY_ANY_ANGLE)
+      result = world.runAnyAngle();
+    else
+      result = world.runAlgorithm();
+
+    out.nanos = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    out.expansions = (r.engine == QUERY_ANYTIME) ? world.getAnytimeResult().expansions : world.getStats().expansions;
+    out.found = result == EXIT_SUCCESS;
+    out.cost = world.getPathCost();
+}
+
+static uint64_t percentile(vector<uint64_t> values, double q) {
+    if (values.empty())
+      return 0;
+
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(q * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+      cerr << "Usage: replay_bench log map [-t threads] [-v map_version] [-n top]" << endl;
+      return EXIT_FAILURE;
+    }
+
+    int threads = max(1u, thread::hardware_concurrency());
+    int64_t version = -1;
+    size_t top = 10;
+
+    for (int i = 3; i + 1 < argc; i += 2) {
+      string arg = argv[i];
+      if (arg == "-t")
+        threads = max(1, atoi(argv[i + 1]));
+      else if (arg == "-v")
+        version = atoll(argv[i + 1]);
+      else if (arg == "-n")
+        top = atoi(argv[i + 1]);
+    }
+
+    vector<loggedQuery> all, queries;
+    if (queryLog::read(argv[1], all) != EXIT_SUCCESS) {
+      cerr << "Cannot read query log " << argv[1] << endl;
+      return EXIT_FAILURE;
+    }
+
+    set<uint64_t> versions;
+    for (auto& q : all) {
+      versions.insert(q.record.mapVersion);
+      if (version < 0 || q.record.mapVersion == (uint64_t)version)
+        queries.push_back(q);
+    }
+
+    cout << all.size() << " queries in the log, " << versions.size() << " map versions, replaying "
+         << queries.size() << " on " << threads << " threads" << endl;
+
+    if (versions.size() > 1 && version < 0)
+      cout << "Warning - the log spans several map versions, differences may come from map edits" << endl;
+
+    if (queries.empty())
+      return EXIT_SUCCESS;
+
+    // Every thread has its own copy of the map, the heuristic tables are shared
+    auto cache = make_shared<heuristicCache>();
+    vector<replayResult> results(queries.size());
+    atomic<size_t> next{0};
+    atomic<bool> failed{false};
+    vector<thread> workers;
+
+    for (int t = 0; t < threads; t++)
+      workers.emplace_back([&]() {
+        aStar world;
+        if (loadMovingAiMap(argv[2], world) != EXIT_SUCCESS) {
+          failed = true;
+          return;
+        }
+
+        for (size_t k = next++; k < queries.size(); k = next++)
+          replay(world, cache, queries[k], results[k]);
+      });
+
+    for (auto& w : workers)
+      w.join();
+
+    if (failed) {
+      cerr << "Cannot load map " << argv[2] << endl;
+      return EXIT_FAILURE;
+    }
+
+    // Recorded against replayed
+    vector<uint64_t> before, after;
+    uint64_t expansionsBefore = 0, expansionsAfter = 0;
+    size_t expansionDiffs = 0, costDiffs = 0, foundDiffs = 0;
+    vector<pair<double, size_t>> slower;
+
+    for (size_t k = 0; k < queries.size(); k++) {
+      auto& r = queries[k].record;
+      auto& n = results[k];
+
+      before.push_back(r.nanos);
+      after.push_back(n.nanos);
+      expansionsBefore += r.expansions;
+      expansionsAfter += n.expansions;
+
+      if (r.engine == QUERY_ANYTIME)
+        continue;
+
+      expansionDiffs += (n.expansions != r.expansions);
+      foundDiffs += (n.found != (bool)r.found);
+      costDiffs += (n.found && r.found && std::fabs(n.cost - r.cost) > 1e-3f * std::max(1.0f, r.cost));
+      slower.push_back(make_pair((double)n.nanos / std::max<uint64_t>(r.nanos, 1), k));
+    }
+
+    auto micros = [](uint64_t nanos) { return nanos / 1000.0; };
+
+    cout << fixed << setprecision(1) << endl;
+    cout << "            " << setw(10) << "p50 us" << setw(10) << "p90 us" << setw(10) << "p99 us" << setw(10)
+         << "p999 us" << setw(10) << "max us" << setw(14) << "expansions" << endl;
+    cout << "recorded    " << setw(10) << micros(percentile(before, 0.5)) << setw(10) << micros(percentile(before, 0.9))
+         << setw(10) << micros(percentile(before, 0.99)) << setw(10) << micros(percentile(before, 0.999)) << setw(10)
+         << micros(percentile(before, 1.0)) << setw(14) << expansionsBefore << endl;
+    cout << "replayed    " << setw(10) << micros(percentile(after, 0.5)) << setw(10) << micros(percentile(after, 0.9))
+         << setw(10) << micros(percentile(after, 0.99)) << setw(10) << micros(percentile(after, 0.999)) << setw(10)
+         << micros(percentile(after, 1.0)) << setw(14) << expansionsAfter << endl << endl;
+
+    cout << expansionDiffs << " queries expanded a different number of nodes, " << foundDiffs
+         << " changed found / not found, " << costDiffs << " changed cost" << endl;
+
+    sort(slower.rbegin(), slower.rend());
+    if (!slower.empty())
+      cout << endl << "Largest slowdowns" << endl;
+
+    for (size_t k = 0; k < min(top, slower.size()); k++) {
+      auto& q = queries[slower[k].second].record;
+      auto& n = results[slower[k].second];
+
+      cout << setw(8) << setprecision(2) << slower[k].first << "x  " << queryEngineNames[min<int>(q.engine, QUERY_ENGINES - 1)]
+           << " (" << q.ox << ", " << q.oy << ") -> (" << q.dx << ", " << q.dy << ")  " << setprecision(1)
+           << micros(q.nanos) << " -> " << micros(n.nanos) << " us, " << q.expansions << " -> " << n.expansions
+           << " expansions" << endl;
+    }
+
+    return (foundDiffs || costDiffs) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Path service load generator - open-loop requests at fixed rates, latency percentiles per rate
+//
+// Usage: service_bench [socket map] [seconds] [rate ...]
+//   Without a socket an in-process service is started on a random 256x256 map written to /tmp.
+//   Latency runs from the time a request was due, so a stalled service is not hidden
+
+#include "service.hpp"
+#include "mapio.hpp"
+#include <iomanip>
+#include <random>
+
+using namespace std;
+using namespace std::chrono;
+
+static void writeMap(const string& path) {
+    mt19937 rng(5);
+    aStar a;
+    a.setMapSize(256, 256);
+
+    for (int x = 0; x < 256; x++)
+      for (int y = 0; y < 256; y++)
+        if (rng() % 100 < 20)
+          a.setInaccessible(x, y);
+
+    saveMovingAiMap(path, a);
+}
+
+int main(int argc, char** argv) {
+    string socketPath = "/tmp/astar_service_bench.sock", mapPath = "/tmp/random-256-256.map";
+    vector<double> rates = { 1000, 5000, 20000, 50000 };
+    double seconds = 2.0;
+    int arg = 1;
+    serviceServer local;
+
+    if (argc > 2 && !isdigit(argv[1][0])) {
+      socketPath = argv[1];
+      mapPath = argv[2];
+      arg = 3;
+    }
+    else {
+      writeMap(mapPath);
+      aStar world;
+      loadMovingAiMap(mapPath, world);
+      local.addMap(world);
+      if (local.start(socketPath) != EXIT_SUCCESS) {
+        cerr << "Cannot start the service" << endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (arg < argc)
+      seconds = atof(argv[arg++]);
+    if (arg < argc)
+      rates.clear();
+    while (arg < argc)
+      rates.push_back(atof(argv[arg++]));
+
+    // Query endpoints on open cells of the map
+    aStar world;
+    if (loadMovingAiMap(mapPath, world) != EXIT_SUCCESS) {
+      cerr << "Cannot load " << mapPath << endl;
+      return EXIT_FAILURE;
+    }
+
+    mt19937 rng(7);
+    auto pick = [&]() {
+      coords c;
+      do
+        c = coords(rng() % world.getMap().rows(), rng() % world.getMap().cols());
+      while (world.getMap().get(c.first, c.second) == INACCESSIBLE);
+      return c;
+    };
+
+    cout << setw(10) << "rate/s" << setw(10) << "sent" << setw(10) << "done" << setw(10) << "found"
+         << setw(10) << "p50 us" << setw(10) << "p90 us" << setw(10) << "p99 us" << setw(10) << "p999 us"
+         << setw(10) << "max us" << endl;
+
+    for (double rate : rates) {
+      serviceClient client;
+      if (client.connect(socketPath) != EXIT_SUCCESS) {
+        cerr << "Cannot connect to " << socketPath << endl;
+        return EXIT_FAILURE;
+      }
+
+      size_t total = (size_t)(rate * seconds);
+      vector<serviceRequest> requests(total);
+      vector<steady_clock::time_point> due(total);
+      vector<double> latency;
+      size_t found = 0;
+
+      for (size_t k = 0; k < total; k++) {
+        coords o = pick(), d = pick();
+        requests[k] = serviceRequest{ (uint32_t)k, 0, 0, o.first, o.second, d.first, d.second };
+      }
+
+      // Receiver runs alongside, requests are pipelined
+      thread receiver([&]() {
+        serviceResponse response;
+        vector<coords> path;
+
+        for (size_t k = 0; k < total && client.receive(response, path) == EXIT_SUCCESS; k++) {
+          latency.push_back(duration<double, micro>(steady_clock::now() - due[response.id]).count());
+          found += (response.status == EXIT_SUCCESS);
+        }
+      });
+
+      auto start = steady_clock::now();
+      size_t sent = 0;
+
+      while (sent < total) {
+        auto now = steady_clock::now();
+        size_t ready = min(total, (size_t)(duration<double>(now - start).count() * rate) + 1);
+
+        if (ready > sent) {
+          for (size_t k = sent; k < ready; k++)
+            due[k] = start + duration_cast<steady_clock::duration>(duration<double>(k / rate));
+
+          vector<serviceRequest> burst(requests.begin() + sent, requests.begin() + ready);
+          if (client.send(burst) != EXIT_SUCCESS)
+            break;
+          sent = ready;
+        }
+        else
+          this_thread::sleep_until(start + duration_cast<steady_clock::duration>(duration<double>(sent / rate)));
+      }
+
+      receiver.join();
+      sort(latency.begin(), latency.end());
+
+      auto at = [&](double q) { return latency.empty() ? 0.0 : latency[min(latency.size() - 1, (size_t)(q * latency.size()))]; };
+
+      cout << fixed << setprecision(0) << setw(10) << rate << setw(10) << sent << setw(10) << latency.size()
+           << setw(10) << found << setw(10) << at(0.5) << setw(10) << at(0.9) << setw(10) << at(0.99)
+           << setw(10) << at(0.999) << setw(10) << (latency.empty() ? 0.0 : latency.back()) << endl;
+    }
+
+    local.stop();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Query latency of an out-of-core map as the tile cache grows
+//
+// Usage: stream_bench [size] [queries] [store path]
+
+#include "astar.hpp"
+#include "tilestore.hpp"
+#include <random>
+#include <string>
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    int64_t size = (argc > 1) ? atoll(argv[1]) : 2048;
+    int queries = (argc > 2) ? atoi(argv[2]) : 50;
+    string path = (argc > 3) ? argv[3] : "/tmp/astar_stream_bench.tiles";
+
+    // Mostly uniform world with scattered walls and patches of rough terrain
+    mt19937 rng(42);
+    tiledMap world(size, size);
+
+    for (int64_t i = 0; i < size * size / 2048; i++) {
+      int64_t x = rng() % size, y = rng() % size;
+      int len = 4 + rng() % 28;
+
+      for (int k = 0; k < len && y + k < size; k++)
+        world.set(x, y + k, INACCESSIBLE);
+    }
+
+    for (int64_t i = 0; i < size * size / 4096; i++) {
+      int64_t x0 = rng() % size, y0 = rng() % size;
+      float w = MIN_WEIGHT + rng() % (int)HALF_WEIGHT;
+
+      for (int64_t x = x0; x < min(size, x0 + 12); x++)
+        for (int64_t y = y0; y < min(size, y0 + 12); y++)
+          world.set(x, y, w);
+    }
+
+    if (streamedMap::write(path, world) != EXIT_SUCCESS) {
+      cout << "Cannot write tile store " << path << endl;
+      return EXIT_FAILURE;
+    }
+
+    // Same query pairs for every cache size
+    vector<pair<coords, coords>> pairs;
+    int64_t reach = max<int64_t>(16, size / 4);
+
+    while ((int)pairs.size() < queries) {
+      coords o(rng() % size, rng() % size);
+      coords d(min<int64_t>(size - 1, o.first + rng() % reach), min<int64_t>(size - 1, o.second + rng() % reach));
+
+      if (world.get(o.first, o.second) != INACCESSIBLE && world.get(d.first, d.second) != INACCESSIBLE)
+        pairs.push_back(make_pair(o, d));
+    }
+
+    cout << "Map " << size << "x" << size << ", " << world.allocatedTiles() << "/" << world.tileCount()
+         << " tiles stored, " << queries << " queries" << endl;
+    cout << "cache_tiles  mean_ms   p50_ms   p99_ms  hit_rate  misses  evictions  prefetches" << endl;
+
+    for (size_t capacity : { 4, 16, 64, 256, 1024, 4096 }) {
+      aStar a;
+      a.setMap(make_unique<streamedMap>(path, capacity));
+      a.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+
+      vector<double> latency;
+      for (auto& q : pairs) {
+        a.setOrigin(point(q.first.first, q.first.second));
+        a.setDestination(point(q.second.first, q.second.second));
+
+        auto t0 = chrono::steady_clock::now();
+        a.runAnytime(1.0f, 0.0f, t0 + chrono::seconds(60));
+        latency.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+      }
+
+      sort(latency.begin(), latency.end());
+      double mean = 0.0;
+      for (auto l : latency)
+        mean += l / latency.size();
+
+      auto stats = ((streamedMap&)a.getMap()).getStats();
+      printf("%11zu %8.3f %8.3f %8.3f %9.4f %7zu %10zu %11zu\n", capacity, mean,
+             latency[latency.size() / 2], latency[latency.size() * 99 / 100], stats.hitRate(),
+             stats.misses, stats.evictions, stats.prefetches);
+    }
+
+    remove(path.c_str());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Query latency and expansions on the generated map suite (mapgen.hpp)
+//
+// Usage: suite_bench [-n min_size] [-x max_size] [-q scenarios] [-s seed] [-l storage] [-o dir]
+//   Sizes are powers of four from min_size (64) to max_size (1024, up to 16384). Every map is
+//   printed with its checksum: equal checksums mean runs on other machines searched the same
+//   maps and scenarios. With -o the maps and scenarios are also written to dir. A dense 16384 map
+//   takes 1 GB, and searches across a whole maze of that size several more
+//
+// Rows are the generated map name, generation time, checksum, then per scenario set the found
+//   and unreachable queries, p50 / p90 latency and mean expansions
+
+#include "mapgen.hpp"
+#include <iomanip>
+
+using namespace std;
+using namespace std::chrono;
+
+static double percentile(vector<double> values, double q) {
+    if (values.empty())
+      return 0.0;
+
+    sort(values.begin(), values.end());
+    return values[min(values.size() - 1, (size_t)(q * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    int64_t minSize = 64, maxSize = 1024;
+    size_t count = 20;
+    uint64_t seed = MAPGEN_SEED;
+    int storage = DENSE_STORAGE;
+    string dir;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+      string arg = argv[i];
+      if (arg == "-n")
+        minSize = atoll(argv[i + 1]);
+      else if (arg == "-x")
+        maxSize = atoll(argv[i + 1]);
+      else if (arg == "-q")
+        count = atoi(argv[i + 1]);
+      else if (arg == "-s")
+        seed = strtoull(argv[i + 1], nullptr, 10);
+      else if (arg == "-l")
+        storage = atoi(argv[i + 1]);
+      else if (arg == "-o")
+        dir = argv[i + 1];
+    }
+
+    mapGenerator generator(seed);
+    auto specs = mapGenerator::suite(minSize, maxSize);
+
+    cout << specs.size() << " maps, seed " << seed << ", " << count << " scenarios per map, storage " << storage << endl
+         << endl;
+    cout << left << setw(22) << "map" << right << setw(10) << "gen ms" << setw(18) << "checksum" << setw(7) << "found"
+         << setw(7) << "split" << setw(11) << "p50 us" << setw(11) << "p90 us" << setw(12) << "expansions" << endl;
+
+    int result = EXIT_SUCCESS;
+
+    for (auto& spec : specs) {
+      aStar world;
+
+      auto start = steady_clock::now();
+      if (generator.generate(spec, world, storage) != EXIT_SUCCESS) {
+        cerr << "Cannot generate " << spec.name() << endl;
+        return EXIT_FAILURE;
+      }
+      double ms = duration<double, milli>(steady_clock::now() - start).count();
+
+      vector<scenarioEntry> entries;
+      generator.scenarios(spec, world, count, entries);
+
+      if (!dir.empty() && generator.save(dir, spec, world, entries) != EXIT_SUCCESS) {
+        cerr << "Cannot write " << spec.name() << " to " << dir << endl;
+        result = EXIT_FAILURE;
+      }
+
+      vector<double> micros;
+      size_t found = 0, split = 0, expansions = 0;
+
+      for (auto& e : entries) {
+        world.setOrigin(point(e.start.first, e.start.second));
+        world.setDestination(point(e.goal.first, e.goal.second));
+        vector<pair<point, float>> origin = { make_pair(world.getOrigin(), 0.0f) };
+
+        auto t0 = steady_clock::now();
+        bool ok = world.runAlgorithm(origin) == EXIT_SUCCESS;
+        micros.push_back(duration<double, micro>(steady_clock::now() - t0).count());
+
+        found += ok;
+        split += (e.optimal < 0.0);
+        expansions += world.getStats().expansions;
+      }
+
+      cout << left << setw(22) << spec.name() << right << fixed << setprecision(1) << setw(10) << ms << "  "
+           << hex << setw(16) << setfill('0') << mapGenerator::checksum(world) << dec << setfill(' ') << setw(7)
+           << found << setw(7) << split << setw(11) << percentile(micros, 0.5) << setw(11) << percentile(micros, 0.9)
+           << setw(12) << (entries.empty() ? 0 : expansions / entries.size()) << endl;
+    }
+
+    return result;
+}
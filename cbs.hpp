@@ -0,0 +1,490 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Conflict-based search (CBS) - optimal multi-agent paths. A constraint tree on top,
+//   a space-time A* per agent underneath honouring that agent's constraints
+
+#pragma once
+
+#include "astar.hpp"
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+
+// Agent may not be at cell at time, or with to set, may not move cell -> to leaving at time
+struct cbsConstraint {
+    int32_t agent;
+    cellIndex cell;
+    cellIndex to = INEXISTENT;
+    int64_t time;
+
+    bool operator<(const cbsConstraint& o) const {
+      return std::tie(agent, time, cell, to) < std::tie(o.agent, o.time, o.cell, o.to);
+    }
+    bool operator==(const cbsConstraint& o) const {
+      return agent == o.agent && time == o.time && cell == o.cell && to == o.to;
+    }
+};
+
+// Both agents at cell at time, or with to set, a moves cell -> to while b moves to -> cell
+struct cbsConflict {
+    int32_t a, b;
+    cellIndex cell;
+    cellIndex to = INEXISTENT;
+    int64_t time;
+};
+
+struct cbsStats {
+    size_t expanded = 0;        // Constraint tree nodes split or bypassed
+    size_t generated = 0;       // Constraint tree nodes created
+    size_t lowLevel = 0;        // Single agent searches run
+    size_t cacheHits = 0;       // Single agent searches answered from the cache
+    size_t bypasses = 0;        // Conflicts resolved without branching
+    size_t cardinal = 0;        // Splits on a cardinal conflict
+    size_t semiCardinal = 0;    // Splits on a semi-cardinal conflict
+
+    void add(const cbsStats& o) {
+      expanded += o.expanded; generated += o.generated; lowLevel += o.lowLevel; cacheHits += o.cacheHits;
+      bypasses += o.bypasses; cardinal += o.cardinal; semiCardinal += o.semiCardinal;
+    }
+};
+
+// Interface cbsSolver - sum of costs optimal, waiting costs COST * MIN_WEIGHT until an agent's
+//   last arrival and nothing once it stays on its goal
+class cbsSolver {
+    private:
+        struct plan {
+            std::vector<cellIndex> cells;   // Cell per tick until the final arrival
+            float cost = 0.0f;
+        };
+
+        struct ctNode {
+            std::vector<cbsConstraint> constraints;     // Sorted, agent first
+            std::vector<std::shared_ptr<const plan>> plans;
+            float cost = 0.0f;
+            int conflicts = 0;
+            size_t id = 0;
+        };
+
+        struct ctOrder {
+            bool operator()(const std::shared_ptr<ctNode>& a, const std::shared_ptr<ctNode>& b) const {
+              return std::tie(a->cost, a->conflicts, a->id) > std::tie(b->cost, b->conflicts, b->id);
+            }
+        };
+
+        struct stNode {
+            float g = std::numeric_limits<float>::infinity();
+            float h = 0.0f;
+            int64_t parent = INEXISTENT;
+            bool closed = false;
+        };
+
+        aStar& world;
+        std::vector<coords> starts, goals;
+        std::vector<std::shared_ptr<std::vector<float>>> fields;
+
+        size_t budget = CBS_NODE_BUDGET;
+        std::shared_ptr<ctNode> solution;
+        cbsStats stats;
+
+        // Low level results per (agent, constraints of that agent), shared by the constraint tree
+        std::mutex cacheLock;
+        std::map<std::pair<int32_t, std::vector<cbsConstraint>>, std::shared_ptr<const plan>> cache;
+
+        std::shared_ptr<const plan> lowLevel(int32_t agent, const std::vector<cbsConstraint>& constraints,
+                                             nodeTable<stNode>& nodes, cbsStats& local);
+        std::shared_ptr<const plan> search(int32_t agent, const std::vector<cbsConstraint>& own, nodeTable<stNode>& nodes);
+        int findConflicts(const ctNode& node, std::vector<cbsConflict>* conflicts);
+        void expand(std::shared_ptr<ctNode> node, std::vector<std::shared_ptr<ctNode>>& children,
+                    nodeTable<stNode>& nodes, cbsStats& local);
+
+    public:
+        cbsSolver(aStar& world) : world(world) {};
+
+        int addAgent(const coords& start, const coords& goal);
+        size_t agentCount() { return starts.size(); }
+
+        // Constraint tree nodes to expand before giving up
+        void setNodeBudget(size_t nodes) { budget = nodes; }
+
+        // Expands up to threads constraint tree nodes at once, EXIT_FAILURE if no collision
+        //   free plan exists or the budget ran out. One at a time on maps that cannot take
+        //   concurrent reads (streamed maps)
+        int solve(int threads = 1);
+
+        std::vector<coords> getPath(int agent);
+        float getCost() { return solution ? solution->cost : std::numeric_limits<float>::infinity(); }
+        cbsStats getStats() { return stats; }
+};
+
+// Implementation cbsSolver
+
+int cbsSolver::addAgent(const coords& start, const coords& goal) {
+  starts.push_back(start);
+  goals.push_back(goal);
+
+  return starts.size() - 1;
+}
+
+std::vector<coords> cbsSolver::getPath(int agent) {
+  std::vector<coords> path;
+
+  if (!solution)
+    return path;
+
+  for (auto c : solution->plans[agent]->cells) {
+    int64_t x, y;
+    world.getMap().position(c, x, y);
+    path.push_back(coords(x, y));
+  }
+
+  return path;
+}
+
+std::shared_ptr<const cbsSolver::plan> cbsSolver::lowLevel(int32_t agent, const std::vector<cbsConstraint>& constraints,
+                                                           nodeTable<stNode>& nodes, cbsStats& local) {
+  auto first = std::lower_bound(constraints.begin(), constraints.end(), cbsConstraint{ agent, INEXISTENT, INEXISTENT, INEXISTENT },
+                                [](const cbsConstraint& a, const cbsConstraint& b) { return a.agent < b.agent; });
+  auto last = std::upper_bound(first, constraints.end(), cbsConstraint{ agent, INEXISTENT, INEXISTENT, INEXISTENT },
+                               [](const cbsConstraint& a, const cbsConstraint& b) { return a.agent < b.agent; });
+  auto key = std::make_pair(agent, std::vector<cbsConstraint>(first, last));
+
+  {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+      local.cacheHits++;
+      return it->second;
+    }
+  }
+
+  local.lowLevel++;
+  auto result = search(agent, key.second, nodes);
+
+  std::lock_guard<std::mutex> guard(cacheLock);
+  cache.emplace(std::move(key), result);
+  return result;
+}
+
+// Space-time A* over (cell, tick). Past the last constraint every tick looks the same, so time
+//   is clamped there and the state space stays finite
+std::shared_ptr<const cbsSolver::plan> cbsSolver::search(int32_t agent, const std::vector<cbsConstraint>& own,
+                                                         nodeTable<stNode>& nodes) {
+    typedef std::pair<float, int64_t> entry; // f, state
+
+    auto& map = world.getMap();
+    auto& field = *fields[agent];
+
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+    std::unordered_set<int64_t> vertices;
+    std::set<std::tuple<cellIndex, cellIndex, int64_t>> edges;
+    cellIndex adjacent[8];
+
+    cellIndex start = map.index(starts[agent].first, starts[agent].second);
+    cellIndex goal = map.index(goals[agent].first, goals[agent].second);
+
+    if (field[start] == std::numeric_limits<float>::infinity())
+      return nullptr;
+
+    int64_t horizon = 0, goalFree = 0;
+    for (auto& c : own)
+      horizon = std::max(horizon, c.time + 1);
+    int64_t span = horizon + 1;
+
+    for (auto& c : own) {
+      if (c.to == INEXISTENT) {
+        vertices.insert(c.cell * span + c.time);
+        if (c.cell == goal)
+          goalFree = std::max(goalFree, c.time + 1);
+      }
+      else
+        edges.insert(std::make_tuple(c.cell, c.to, c.time));
+    }
+
+    if (vertices.count(start * span))
+      return nullptr;
+
+    nodes.reset(map.indexSpace() * span);
+
+    auto& first = nodes.get(start * span);
+    first.g = 0.0f;
+    first.h = field[start];
+    openList.push(entry(first.h, start * span));
+
+    int64_t last = INEXISTENT;
+
+    while (!openList.empty()) {
+      auto top = openList.top();
+      openList.pop();
+
+      auto& n = nodes.get(top.second);
+      if (n.closed || top.first != n.g + n.h)
+        continue;
+      n.closed = true;
+
+      cellIndex c = top.second / span;
+      int64_t t = top.second % span;
+
+      if (c == goal && t >= goalFree) {
+        last = top.second;
+        break;
+      }
+
+      int64_t x, y;
+      map.position(c, x, y);
+      map.adjacent(x, y, c, adjacent);
+
+      // Waiting is the ninth move
+      for (int d = 0; d <= 8; d++) {
+        cellIndex to = (d == 8) ? c : adjacent[d];
+        if (to == INEXISTENT)
+          continue;
+
+        float w = map.at(to);
+        if (w == INACCESSIBLE || (t + 1 < horizon && vertices.count(to * span + t + 1)))
+          continue;
+
+        if (d != 8 && !edges.empty() && edges.count(std::make_tuple(c, to, t)))
+          continue;
+
+        int64_t state = to * span + std::min(t + 1, horizon);
+        bool created;
+        auto& child = nodes.get(state, created);
+        if (created)
+          child.h = field[to];
+
+        float g = n.g + ((d == 8) ? COST * MIN_WEIGHT : COST * (int)w);
+        if (child.closed || g >= child.g)
+          continue;
+
+        child.g = g;
+        child.parent = top.second;
+        openList.push(entry(g + child.h, state));
+      }
+    }
+
+    if (last == INEXISTENT)
+      return nullptr;
+
+    auto result = std::make_shared<plan>();
+    result->cost = nodes.get(last).g;
+
+    for (int64_t s = last; s != INEXISTENT; s = nodes.get(s).parent)
+      result->cells.push_back(s / span);
+    std::reverse(result->cells.begin(), result->cells.end());
+
+    return result;
+}
+
+// Counts every conflicting (pair, tick), agents stay on their goal once done
+int cbsSolver::findConflicts(const ctNode& node, std::vector<cbsConflict>* conflicts) {
+  size_t ticks = 0;
+  for (auto& p : node.plans)
+    ticks = std::max(ticks, p->cells.size());
+
+  auto at = [&](int32_t a, size_t t) {
+    auto& cells = node.plans[a]->cells;
+    return cells[std::min(t, cells.size() - 1)];
+  };
+
+  std::unordered_map<cellIndex, int32_t> now, next;
+  int count = 0;
+
+  for (size_t t = 0; t < ticks; t++) {
+    now.clear();
+    next.clear();
+
+    for (int32_t a = 0; a < (int32_t)node.plans.size(); a++) {
+      auto it = now.emplace(at(a, t), a);
+      if (!it.second) {
+        count++;
+        if (conflicts)
+          conflicts->push_back(cbsConflict{ it.first->second, a, at(a, t), INEXISTENT, (int64_t)t });
+      }
+    }
+
+    if (t + 1 == ticks)
+      break;
+
+    for (int32_t a = 0; a < (int32_t)node.plans.size(); a++) {
+      cellIndex from = at(a, t), to = at(a, t + 1);
+      if (from == to)
+        continue;
+
+      // Whoever stands on our next cell now and moves onto our cell swaps with us
+      auto it = now.find(to);
+      if (it != now.end() && it->second < a && at(it->second, t + 1) == from) {
+        count++;
+        if (conflicts)
+          conflicts->push_back(cbsConflict{ it->second, a, to, from, (int64_t)t });
+      }
+    }
+  }
+
+  return count;
+}
+
+// Splits on the most constraining conflict among the first few - cardinal (both costs rise),
+//   then semi-cardinal (one rises). A child as cheap as its parent with fewer conflicts
+//   replaces the parent's plan instead (bypass)
+void cbsSolver::expand(std::shared_ptr<ctNode> node, std::vector<std::shared_ptr<ctNode>>& children,
+                       nodeTable<stNode>& nodes, cbsStats& local) {
+  std::vector<cbsConflict> conflicts;
+  findConflicts(*node, &conflicts);
+  local.expanded++;
+
+  struct split {
+      cbsConstraint constraint[2];
+      std::shared_ptr<const plan> plans[2];
+      int rises = 0;
+  };
+
+  split best;
+  best.rises = INEXISTENT;
+
+  for (size_t k = 0; k < conflicts.size() && k < CBS_CONFLICT_PROBES; k++) {
+    auto& c = conflicts[k];
+    split s;
+
+    if (c.to == INEXISTENT) {
+      s.constraint[0] = cbsConstraint{ c.a, c.cell, INEXISTENT, c.time };
+      s.constraint[1] = cbsConstraint{ c.b, c.cell, INEXISTENT, c.time };
+    }
+    else {
+      s.constraint[0] = cbsConstraint{ c.a, c.cell, c.to, c.time };
+      s.constraint[1] = cbsConstraint{ c.b, c.to, c.cell, c.time };
+    }
+
+    for (int side = 0; side < 2; side++) {
+      auto constraints = node->constraints;
+      constraints.insert(std::upper_bound(constraints.begin(), constraints.end(), s.constraint[side]), s.constraint[side]);
+
+      int32_t agent = s.constraint[side].agent;
+      s.plans[side] = lowLevel(agent, constraints, nodes, local);
+
+      if (!s.plans[side] || s.plans[side]->cost > node->plans[agent]->cost) {
+        s.rises++;
+        continue;
+      }
+
+      // Same cost under one more constraint - take it if it clears conflicts
+      auto trial = *node;
+      trial.plans[agent] = s.plans[side];
+      trial.conflicts = findConflicts(trial, nullptr);
+
+      if (trial.conflicts < node->conflicts) {
+        node->plans[agent] = s.plans[side];
+        node->conflicts = trial.conflicts;
+        local.bypasses++;
+        children.push_back(node);
+        return;
+      }
+    }
+
+    if (s.rises > best.rises)
+      best = s;
+    if (best.rises == 2)
+      break;
+  }
+
+  if (best.rises == 2)
+    local.cardinal++;
+  else if (best.rises == 1)
+    local.semiCardinal++;
+
+  for (int side = 0; side < 2; side++) {
+    if (!best.plans[side])
+      continue;
+
+    auto child = std::make_shared<ctNode>(*node);
+    int32_t agent = best.constraint[side].agent;
+
+    child->constraints.insert(std::upper_bound(child->constraints.begin(), child->constraints.end(), best.constraint[side]),
+                              best.constraint[side]);
+    child->cost += best.plans[side]->cost - child->plans[agent]->cost;
+    child->plans[agent] = best.plans[side];
+    child->conflicts = findConflicts(*child, nullptr);
+
+    local.generated++;
+    children.push_back(child);
+  }
+}
+
+int cbsSolver::solve(int threads) {
+  std::priority_queue<std::shared_ptr<ctNode>, std::vector<std::shared_ptr<ctNode>>, ctOrder> openList;
+  if (!world.getMap().concurrentReads())
+    threads = 1;
+
+  std::vector<nodeTable<stNode>> tables(std::max(1, threads));
+  size_t ids = 0;
+
+  solution.reset();
+  stats = cbsStats();
+  cache.clear();
+  fields.clear();
+
+  // Reverse distance fields - exact heuristic ignoring other agents
+  std::unordered_map<cellIndex, std::shared_ptr<std::vector<float>>> byGoal;
+  for (auto& g : goals) {
+    auto& field = byGoal[world.getMap().index(g.first, g.second)];
+    if (!field) {
+      field = std::make_shared<std::vector<float>>();
+      if (world.distanceField({ std::make_pair(point(g.first, g.second), 0.0f) }, *field, true) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    }
+    fields.push_back(field);
+  }
+
+  auto root = std::make_shared<ctNode>();
+  for (int32_t a = 0; a < (int32_t)starts.size(); a++) {
+    auto p = lowLevel(a, root->constraints, tables[0], stats);
+    if (!p)
+      return EXIT_FAILURE;
+
+    root->plans.push_back(p);
+    root->cost += p->cost;
+  }
+  root->conflicts = findConflicts(*root, nullptr);
+  root->id = ids++;
+  stats.generated++;
+  openList.push(root);
+
+  while (!openList.empty() && stats.expanded < budget) {
+    std::vector<std::shared_ptr<ctNode>> batch;
+
+    // The cheapest node is conflict free - nothing left can beat it
+    if (openList.top()->conflicts == 0) {
+      solution = openList.top();
+      return EXIT_SUCCESS;
+    }
+
+    while (!openList.empty() && (int)batch.size() < (int)tables.size() && openList.top()->conflicts > 0) {
+      batch.push_back(openList.top());
+      openList.pop();
+    }
+
+    std::vector<std::vector<std::shared_ptr<ctNode>>> children(batch.size());
+    std::vector<cbsStats> local(batch.size());
+    std::vector<std::thread> pool;
+
+    for (size_t b = 1; b < batch.size(); b++)
+      pool.push_back(std::thread([&, b]() { expand(batch[b], children[b], tables[b], local[b]); }));
+    expand(batch[0], children[0], tables[0], local[0]);
+
+    for (auto& t : pool)
+      t.join();
+
+    // Ids in batch order keep tie breaking deterministic
+    for (size_t b = 0; b < batch.size(); b++) {
+      stats.add(local[b]);
+      for (auto& child : children[b]) {
+        child->id = ids++;
+        openList.push(child);
+      }
+    }
+  }
+
+  return EXIT_FAILURE;
+}
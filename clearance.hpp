@@ -0,0 +1,213 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Clearance map - Chebyshev distance transform of the blocked cells, so one map serves
+//   agents of every square footprint
+
+#pragma once
+
+#include "gridmap.hpp"
+#include <deque>
+
+// Interface clearanceMap - per cell, in map storage order, the Chebyshev distance to the
+//   nearest inaccessible cell or to the outside of the map. An agent of radius r (a
+//   (2r + 1) x (2r + 1) footprint) fits on a cell whose clearance is at least r.
+//   Built with Meijster's two-pass transform in O(cells); on edits, a local wave repairs
+//   only the cells whose nearest obstacle changed
+class clearanceMap {
+    private:
+        std::vector<int32_t> dist;      // 0 on inaccessible cells
+        const int32_t* values = nullptr;    // dist, or attached read-only distances
+        bool built = false, attached = false;
+
+        int32_t edge(gridMap& map, int64_t x, int64_t y);
+        void lower(gridMap& map, std::deque<cellIndex>& wave);
+
+    public:
+        // Transform every cell, false when the map is larger than COMPONENT_LIMIT
+        bool build(gridMap& map);
+        void invalidate() { built = attached = false; values = nullptr; dist.clear(); }
+        bool isBuilt() { return built; }
+
+        // Read-only distances kept elsewhere (a shared segment). Edits are ignored while attached
+        void attach(const int32_t* distances) { dist.clear(); values = distances; built = attached = true; }
+        bool isAttached() { return attached; }
+        const int32_t* data() { return values; }
+
+        // Keep distances current, call after the cell at (x, y) changed accessibility
+        void cellOpened(gridMap& map, int64_t x, int64_t y);
+        void cellClosed(gridMap& map, int64_t x, int64_t y);
+
+        // Largest radius that fits on the cell, -1 on inaccessible cells
+        int32_t clearance(cellIndex i) { return values[i] - 1; }
+        bool fits(cellIndex i, int radius) { return values[i] > radius; }
+};
+
+// Implementation clearanceMap
+
+// Distance to the nearest cell outside the map
+int32_t clearanceMap::edge(gridMap& map, int64_t x, int64_t y) {
+  return std::min({ x + 1, y + 1, map.rows() - x, map.cols() - y });
+}
+
+bool clearanceMap::build(gridMap& map) {
+  built = attached = false;
+
+  if (map.indexSpace() > COMPONENT_LIMIT)
+    return false;
+
+  int64_t rows = map.rows(), cols = map.cols();
+  std::vector<int32_t> g(rows * cols);
+
+  dist.assign(map.indexSpace(), 0);
+
+  // Phase 1 - distance along each column, the rows above and below the map count as blocked
+  for (int64_t y = 0; y < cols; y++) {
+    for (int64_t x = 0; x < rows; x++) {
+      bool blocked = map.get(x, y) == INACCESSIBLE;
+      g[x * cols + y] = blocked ? 0 : ((x == 0) ? 1 : g[(x - 1) * cols + y] + 1);
+    }
+
+    for (int64_t x = rows - 1; x >= 0; x--) {
+      int32_t below = (x == rows - 1) ? 1 : g[(x + 1) * cols + y] + 1;
+      g[x * cols + y] = std::min(g[x * cols + y], below);
+    }
+  }
+
+  // Phase 2 - lower envelope of f(u, i) = max(|u - i|, g(i)) along each row
+  std::vector<int64_t> s(cols), t(cols);
+
+  for (int64_t x = 0; x < rows; x++) {
+    const int32_t* row = &g[x * cols];
+
+    auto f = [&](int64_t u, int64_t i) { return std::max<int64_t>(std::abs(u - i), row[i]); };
+    auto sep = [&](int64_t i, int64_t u) {
+      return (row[i] <= row[u]) ? std::max<int64_t>(i + row[u], (i + u) / 2)
+                                : std::min<int64_t>(u - row[i], (i + u) / 2);
+    };
+
+    int64_t q = 0;
+    s[0] = t[0] = 0;
+
+    for (int64_t u = 1; u < cols; u++) {
+      while (q >= 0 && f(t[q], s[q]) > f(t[q], u))
+        q--;
+
+      if (q < 0) {
+        q = 0;
+        s[0] = u;
+      }
+      else {
+        int64_t w = 1 + sep(s[q], u);
+        if (w < cols) {
+          q++;
+          s[q] = u;
+          t[q] = w;
+        }
+      }
+    }
+
+    for (int64_t u = cols - 1; u >= 0; u--) {
+      // The columns left and right of the map count as blocked
+      dist[map.index(x, u)] = std::min<int64_t>(f(u, s[q]), std::min(u + 1, cols - u));
+      if (u == t[q])
+        q--;
+    }
+  }
+
+  values = dist.data();
+  built = true;
+  return true;
+}
+
+// Label-correcting wave - Chebyshev distance is the 8-connected step count
+void clearanceMap::lower(gridMap& map, std::deque<cellIndex>& wave) {
+  cellIndex adjacent[8];
+
+  while (!wave.empty()) {
+    cellIndex i = wave.front();
+    wave.pop_front();
+
+    int64_t x, y;
+    map.position(i, x, y);
+    map.adjacent(x, y, i, adjacent);
+
+    for (auto a : adjacent)
+      if (a != INEXISTENT && dist[a] > dist[i] + 1) {
+        dist[a] = dist[i] + 1;
+        wave.push_back(a);
+      }
+  }
+}
+
+void clearanceMap::cellClosed(gridMap& map, int64_t x, int64_t y) {
+  if (!built || attached)
+    return;
+
+  std::deque<cellIndex> wave;
+  cellIndex i = map.index(x, y);
+
+  dist[i] = 0;
+  wave.push_back(i);
+  lower(map, wave);
+}
+
+// Cells whose nearest obstacle was (x, y) form a star around it - every step towards it
+//   keeps that property. They are reset to their edge distance and refilled from the rest
+void clearanceMap::cellOpened(gridMap& map, int64_t x, int64_t y) {
+  if (!built || attached)
+    return;
+
+  std::vector<cellIndex> region, stack;
+  std::deque<cellIndex> wave;
+  cellIndex adjacent[8];
+
+  std::unordered_map<cellIndex, bool> seen;
+  cellIndex i = map.index(x, y);
+
+  seen[i] = true;
+  stack.push_back(i);
+
+  while (!stack.empty()) {
+    cellIndex c = stack.back();
+    stack.pop_back();
+    region.push_back(c);
+
+    int64_t cx, cy;
+    map.position(c, cx, cy);
+    map.adjacent(cx, cy, c, adjacent);
+
+    for (auto a : adjacent) {
+      if (a == INEXISTENT || seen.count(a))
+        continue;
+
+      int64_t ax, ay;
+      map.position(a, ax, ay);
+      if (dist[a] == std::max(std::abs(ax - x), std::abs(ay - y))) {
+        seen[a] = true;
+        stack.push_back(a);
+      }
+    }
+  }
+
+  for (auto c : region) {
+    int64_t cx, cy;
+    map.position(c, cx, cy);
+    dist[c] = edge(map, cx, cy);
+  }
+
+  // Seed from the untouched cells around the region
+  for (auto c : region) {
+    int64_t cx, cy;
+    map.position(c, cx, cy);
+    map.adjacent(cx, cy, c, adjacent);
+
+    for (auto a : adjacent)
+      if (a != INEXISTENT && !seen.count(a))
+        dist[c] = std::min(dist[c], dist[a] + 1);
+
+    wave.push_back(c);
+  }
+
+  lower(map, wave);
+}
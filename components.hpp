@@ -0,0 +1,256 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Connected components of the passable cells, kept up to date as the map is edited
+
+#pragma once
+
+#include "gridmap.hpp"
+#include <deque>
+
+// Interface componentMap - 8-connected labels in map storage order. Labels are joined with
+//   union-find when a cell opens; when a cell closes, lockstep searches from its neighbours
+//   relabel only the pieces that broke off, so the cost follows the smaller pieces
+class componentMap {
+    private:
+        std::vector<int32_t> label;     // Raw label per cell, INEXISTENT when inaccessible
+        std::vector<int32_t> parent;    // Union-find over raw labels
+        const int32_t* labels = nullptr;    // label, or attached read-only labels
+        bool built = false, attached = false;
+
+        int32_t fresh();
+        int32_t find(int32_t l);
+        void unite(int32_t a, int32_t b);
+        void split(gridMap& map, int64_t x, int64_t y, cellIndex i);
+
+    public:
+        // Label every cell, false when the map is larger than COMPONENT_LIMIT
+        bool build(gridMap& map);
+        void invalidate() { built = attached = false; labels = nullptr; label.clear(); parent.clear(); }
+        bool isBuilt() { return built; }
+
+        // Read-only labels kept elsewhere (a shared segment), each below count. Edits are ignored
+        //   while attached, the map they describe does not change
+        void attach(const int32_t* labels, int32_t count);
+        bool isAttached() { return attached; }
+        int32_t labelCount() { return parent.size(); }
+
+        // Keep labels current, call after the cell at (x, y) changed accessibility
+        void cellOpened(gridMap& map, int64_t x, int64_t y);
+        void cellClosed(gridMap& map, int64_t x, int64_t y);
+
+        // Component id, INEXISTENT for inaccessible cells
+        int32_t component(cellIndex i) { return (labels[i] == INEXISTENT) ? INEXISTENT : find(labels[i]); }
+        bool connected(cellIndex a, cellIndex b);
+};
+
+// Implementation componentMap
+
+int32_t componentMap::fresh() {
+  parent.push_back(parent.size());
+  return parent.back();
+}
+
+int32_t componentMap::find(int32_t l) {
+  while (parent[l] != l) {
+    parent[l] = parent[parent[l]];
+    l = parent[l];
+  }
+  return l;
+}
+
+void componentMap::unite(int32_t a, int32_t b) {
+  a = find(a);
+  b = find(b);
+
+  if (a != b)
+    parent[std::max(a, b)] = std::min(a, b);
+}
+
+bool componentMap::build(gridMap& map) {
+  built = attached = false;
+
+  if (map.indexSpace() > COMPONENT_LIMIT)
+    return false;
+
+  label.assign(map.indexSpace(), INEXISTENT);
+  parent.clear();
+
+  std::vector<cellIndex> stack;
+  cellIndex adjacent[8];
+
+  // Flood fill every unlabelled passable cell
+  for (int64_t x = 0; x < map.rows(); x++) {
+    for (int64_t y = 0; y < map.cols(); y++) {
+      cellIndex start = map.index(x, y);
+
+      if (label[start] != INEXISTENT || map.at(start) == INACCESSIBLE)
+        continue;
+
+      int32_t l = fresh();
+      label[start] = l;
+      stack.push_back(start);
+
+      while (!stack.empty()) {
+        cellIndex i = stack.back();
+        int64_t cx, cy;
+        stack.pop_back();
+
+        map.position(i, cx, cy);
+        map.adjacent(cx, cy, i, adjacent);
+
+        for (auto a : adjacent) {
+          if (a == INEXISTENT || label[a] != INEXISTENT || map.at(a) == INACCESSIBLE)
+            continue;
+
+          label[a] = l;
+          stack.push_back(a);
+        }
+      }
+    }
+  }
+
+  labels = label.data();
+  built = true;
+  debug << "Components built, " << parent.size() << " labels" << std::endl;
+
+  return true;
+}
+
+bool componentMap::connected(cellIndex a, cellIndex b) {
+  if (!built)
+    return true;
+
+  int32_t ca = component(a), cb = component(b);
+
+  return (ca != INEXISTENT) && (ca == cb);
+}
+
+void componentMap::attach(const int32_t* labels, int32_t count) {
+  label.clear();
+  parent.resize(count);
+  for (int32_t l = 0; l < count; l++)
+    parent[l] = l;
+
+  this->labels = labels;
+  built = attached = true;
+}
+
+void componentMap::cellOpened(gridMap& map, int64_t x, int64_t y) {
+  if (!built || attached)
+    return;
+
+  cellIndex i = map.index(x, y), adjacent[8];
+  if (label[i] != INEXISTENT)
+    return;
+
+  label[i] = fresh();
+  map.adjacent(x, y, i, adjacent);
+
+  for (auto a : adjacent)
+    if (a != INEXISTENT && label[a] != INEXISTENT)
+      unite(label[i], label[a]);
+}
+
+void componentMap::cellClosed(gridMap& map, int64_t x, int64_t y) {
+  if (!built || attached)
+    return;
+
+  cellIndex i = map.index(x, y);
+  if (label[i] == INEXISTENT)
+    return;
+
+  label[i] = INEXISTENT;
+  split(map, x, y, i);
+
+  // Raw labels are never reused, start over once they outnumber the cells
+  if ((int64_t)parent.size() > 2 * map.indexSpace())
+    build(map);
+}
+
+void componentMap::split(gridMap& map, int64_t x, int64_t y, cellIndex i) {
+  cellIndex adjacent[8];
+  map.adjacent(x, y, i, adjacent);
+
+  // One search per passable neighbour, searches that meet are merged into one group
+  std::vector<std::deque<cellIndex>> frontier;
+  std::vector<int> group;
+  std::vector<bool> done;
+  std::unordered_map<cellIndex, int> visited;
+
+  for (auto a : adjacent) {
+    if (a == INEXISTENT || label[a] == INEXISTENT || visited.count(a))
+      continue;
+
+    visited[a] = frontier.size();
+    group.push_back(frontier.size());
+    done.push_back(false);
+    frontier.push_back(std::deque<cellIndex>(1, a));
+  }
+
+  if (frontier.size() < 2)
+    return;
+
+  auto root = [&](int s) { while (group[s] != s) s = group[s]; return s; };
+
+  // Active groups expand one cell per round until a single group is left,
+  //   every group that runs dry before that is a piece that broke off
+  size_t active = frontier.size();
+
+  while (active > 1) {
+    for (int s = 0; s < (int)frontier.size() && active > 1; s++) {
+      if (root(s) != s || done[s])
+        continue;
+
+      // Pop from any member search of group s
+      int member = INEXISTENT;
+      for (int t = 0; t < (int)frontier.size() && member == INEXISTENT; t++)
+        if (root(t) == s && !frontier[t].empty())
+          member = t;
+
+      if (member == INEXISTENT)
+        continue;
+
+      cellIndex c = frontier[member].front();
+      int64_t cx, cy;
+      cellIndex around[8];
+
+      frontier[member].pop_front();
+      map.position(c, cx, cy);
+      map.adjacent(cx, cy, c, around);
+
+      for (auto a : around) {
+        if (a == INEXISTENT || label[a] == INEXISTENT)
+          continue;
+
+        auto seen = visited.find(a);
+        if (seen == visited.end()) {
+          visited[a] = member;
+          frontier[member].push_back(a);
+        }
+        else if (root(seen->second) != s) {
+          // Met another search - same piece
+          group[root(seen->second)] = s;
+          active--;
+        }
+      }
+
+      // Group exhausted - its cells form a new component
+      bool empty = true;
+      for (int t = 0; t < (int)frontier.size() && empty; t++)
+        if (root(t) == s && !frontier[t].empty())
+          empty = false;
+
+      if (empty && active > 1) {
+        int32_t l = fresh();
+        for (auto& v : visited)
+          if (root(v.second) == s)
+            label[v.first] = l;
+
+        done[s] = true;
+        active--;
+        debug << "Component split off, label " << l << std::endl;
+      }
+    }
+  }
+}
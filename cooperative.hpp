@@ -0,0 +1,378 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Cooperative pathfinding - windowed hierarchical cooperative A* (WHCA*) over a
+//   shared space-time reservation table
+
+#pragma once
+
+#include "astar.hpp"
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+// Interface reservationTable - (cell, tick) -> agent, sharded so planners on
+//   several threads can reserve at once
+class reservationTable {
+    private:
+        struct shard {
+            std::mutex lock;
+            std::unordered_map<uint64_t, int32_t> owners;
+        };
+
+        shard shards[RESERVATION_SHARDS];
+
+        static uint64_t key(cellIndex c, int64_t t) { return ((uint64_t)c << 24) | ((uint64_t)t & 0xFFFFFF); }
+        shard& shardOf(uint64_t k) { return shards[(k * 0x9E3779B97F4A7C15ull) >> 58 & (RESERVATION_SHARDS - 1)]; }
+
+    public:
+        // False if another agent already holds (c, t)
+        bool reserve(cellIndex c, int64_t t, int32_t agent);
+        void release(cellIndex c, int64_t t, int32_t agent);
+
+        // Agent holding (c, t), INEXISTENT if free
+        int32_t owner(cellIndex c, int64_t t);
+
+        void clear();
+        size_t size();
+};
+
+struct cooperativeAgent {
+    coords position;
+    coords goal;
+    std::vector<coords> plan;   // Cell per tick from the planning tick, window + 1 entries
+    bool planned = false;
+};
+
+// Interface cooperativePlanner - every agent searches (cell, time) over the next window
+//   and respects the reservations of the agents planned before it
+class cooperativePlanner {
+    private:
+        aStar& world;
+        int window;
+
+        std::vector<cooperativeAgent> agents;
+        reservationTable reservations;
+
+        // Reverse distance fields per goal - the true distance ignoring other agents, for the
+        //   map version they were computed on
+        std::unordered_map<cellIndex, std::shared_ptr<std::vector<float>>> fields;
+        uint64_t fieldsVersion = 0;
+
+        struct stNode {
+            float g = std::numeric_limits<float>::infinity();
+            float h = 0.0f;
+            int64_t parent = INEXISTENT;
+            bool closed = false;
+        };
+
+        std::shared_ptr<std::vector<float>> fieldFor(const coords& goal);
+        int planAgent(int id, int64_t now, nodeTable<stNode>& nodes);
+        void planGroup(const std::vector<int>& group, int64_t now, nodeTable<stNode>& nodes);
+        std::vector<std::vector<int>> partition(int64_t now);
+
+    public:
+        cooperativePlanner(aStar& world, int window = WHCA_WINDOW) : world(world), window(window) {};
+
+        int addAgent(const coords& start, const coords& goal);
+        void setPosition(int agent, const coords& c) { agents[agent].position = c; }
+        void setGoal(int agent, const coords& c) { agents[agent].goal = c; }
+
+        // Plan every agent for ticks [now, now + window], returns the number that found a plan.
+        //   Agents whose windows cannot overlap are planned on separate threads, unless the map
+        //   cannot take concurrent reads (streamed maps), which plans on the calling thread
+        int planTick(int64_t now, int threads = 1);
+
+        std::vector<coords>& getPlan(int agent) { return agents[agent].plan; }
+        size_t agentCount() { return agents.size(); }
+        int getWindow() { return window; }
+        reservationTable& getReservations() { return reservations; }
+};
+
+// Implementation reservationTable
+
+bool reservationTable::reserve(cellIndex c, int64_t t, int32_t agent) {
+  uint64_t k = key(c, t);
+  auto& s = shardOf(k);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.owners.try_emplace(k, agent);
+  return it.second || it.first->second == agent;
+}
+
+void reservationTable::release(cellIndex c, int64_t t, int32_t agent) {
+  uint64_t k = key(c, t);
+  auto& s = shardOf(k);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.owners.find(k);
+  if (it != s.owners.end() && it->second == agent)
+    s.owners.erase(it);
+}
+
+int32_t reservationTable::owner(cellIndex c, int64_t t) {
+  uint64_t k = key(c, t);
+  auto& s = shardOf(k);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.owners.find(k);
+  return (it == s.owners.end()) ? INEXISTENT : it->second;
+}
+
+void reservationTable::clear() {
+  for (auto& s : shards) {
+    std::lock_guard<std::mutex> guard(s.lock);
+    s.owners.clear();
+  }
+}
+
+size_t reservationTable::size() {
+  size_t total = 0;
+
+  for (auto& s : shards) {
+    std::lock_guard<std::mutex> guard(s.lock);
+    total += s.owners.size();
+  }
+
+  return total;
+}
+
+// Implementation cooperativePlanner
+
+int cooperativePlanner::addAgent(const coords& start, const coords& goal) {
+  cooperativeAgent a;
+  a.position = start;
+  a.goal = goal;
+  agents.push_back(a);
+
+  return agents.size() - 1;
+}
+
+std::shared_ptr<std::vector<float>> cooperativePlanner::fieldFor(const coords& goal) {
+  cellIndex g = world.getMap().index(goal.first, goal.second);
+  auto it = fields.find(g);
+
+  if (it != fields.end())
+    return it->second;
+
+  auto field = std::make_shared<std::vector<float>>();
+  if (world.distanceField({ std::make_pair(point(goal.first, goal.second), 0.0f) }, *field, true) != EXIT_SUCCESS)
+    field.reset();
+
+  fields[g] = field;
+  return field;
+}
+
+// Space-time A* over (cell, tick) up to the window, waiting costs COST * MIN_WEIGHT
+int cooperativePlanner::planAgent(int id, int64_t now, nodeTable<stNode>& nodes) {
+    typedef std::pair<float, int64_t> entry; // f, state
+
+    auto& agent = agents[id];
+    auto& map = world.getMap();
+    auto field = fields.find(map.index(agent.goal.first, agent.goal.second))->second;
+
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+    cellIndex adjacent[8];
+    int64_t span = window + 1;
+
+    cellIndex start = map.index(agent.position.first, agent.position.second);
+    cellIndex goal = map.index(agent.goal.first, agent.goal.second);
+
+    agent.plan.clear();
+    agent.planned = false;
+    nodes.reset(map.indexSpace() * span);
+
+    auto h = [&](cellIndex c) {
+      if (field)
+        return (*field)[c];
+
+      int64_t x, y;
+      map.position(c, x, y);
+      return world.getHeuristic().distanceOp(point(x, y), point(agent.goal.first, agent.goal.second));
+    };
+
+    auto free = [&](cellIndex c, int64_t dt) {
+      int32_t o = reservations.owner(c, now + dt);
+      return o == INEXISTENT || o == id;
+    };
+
+    auto& first = nodes.get(start * span);
+    first.g = 0.0f;
+    first.h = h(start);
+    openList.push(entry(first.h, start * span));
+
+    int64_t last = INEXISTENT;
+
+    while (!openList.empty()) {
+      auto top = openList.top();
+      openList.pop();
+
+      auto& n = nodes.get(top.second);
+      if (n.closed || top.first != n.g + n.h)
+        continue;
+      n.closed = true;
+
+      cellIndex c = top.second / span;
+      int64_t dt = top.second % span;
+
+      // Done at the horizon, or at the goal if it stays free for the rest of the window
+      bool settled = (dt == window);
+      if (c == goal && !settled) {
+        settled = true;
+        for (int64_t t = dt + 1; t <= window && settled; t++)
+          settled = free(goal, t);
+      }
+
+      if (settled) {
+        last = top.second;
+        break;
+      }
+
+      int64_t x, y;
+      map.position(c, x, y);
+      map.adjacent(x, y, c, adjacent);
+
+      // Waiting is the ninth move
+      for (int d = 0; d <= 8; d++) {
+        cellIndex to = (d == 8) ? c : adjacent[d];
+        if (to == INEXISTENT)
+          continue;
+
+        float w = map.at(to);
+        if (w == INACCESSIBLE || !free(to, dt + 1))
+          continue;
+
+        // No swapping places with the agent coming the other way
+        int32_t other = reservations.owner(to, now + dt);
+        if (d != 8 && other != INEXISTENT && other != id && reservations.owner(c, now + dt + 1) == other)
+          continue;
+
+        int64_t state = to * span + dt + 1;
+        bool created;
+        auto& child = nodes.get(state, created);
+        if (created)
+          child.h = h(to);
+
+        float g = n.g + ((d == 8) ? COST * MIN_WEIGHT : COST * (int)w);
+        if (child.closed || g >= child.g)
+          continue;
+
+        child.g = g;
+        child.parent = top.second;
+        openList.push(entry(g + child.h, state));
+      }
+    }
+
+    if (last == INEXISTENT) {
+      // Boxed in - stay put and hope the others route around
+      agent.plan.assign(span, agent.position);
+      for (int64_t t = 0; t <= window; t++)
+        reservations.reserve(start, now + t, id);
+      return EXIT_FAILURE;
+    }
+
+    for (int64_t s = last; s != INEXISTENT; s = nodes.get(s).parent) {
+      int64_t x, y;
+      map.position(s / span, x, y);
+      agent.plan.insert(agent.plan.begin(), coords(x, y));
+    }
+
+    // Arrived early - wait on the goal until the horizon
+    while ((int64_t)agent.plan.size() < span)
+      agent.plan.push_back(agent.plan.back());
+
+    for (int64_t t = 0; t <= window; t++)
+      reservations.reserve(map.index(agent.plan[t].first, agent.plan[t].second), now + t, id);
+
+    agent.planned = true;
+    return EXIT_SUCCESS;
+}
+
+void cooperativePlanner::planGroup(const std::vector<int>& group, int64_t now, nodeTable<stNode>& nodes) {
+  for (auto id : group)
+    planAgent(id, now, nodes);
+}
+
+// Agents more than 2 * window apart (Chebyshev) cannot meet inside the window
+std::vector<std::vector<int>> cooperativePlanner::partition(int64_t now) {
+  std::vector<int> parent(agents.size());
+  std::unordered_map<int64_t, std::vector<int>> buckets;
+  int64_t size = 2 * window + 1;
+
+  auto root = [&](int a) { while (parent[a] != a) a = parent[a] = parent[parent[a]]; return a; };
+  auto bucketKey = [](int64_t bx, int64_t by) { return (bx << 32) ^ (by & 0xFFFFFFFFll); };
+
+  for (size_t a = 0; a < agents.size(); a++) {
+    parent[a] = a;
+    buckets[bucketKey(agents[a].position.first / size, agents[a].position.second / size)].push_back(a);
+  }
+
+  for (size_t a = 0; a < agents.size(); a++) {
+    int64_t bx = agents[a].position.first / size, by = agents[a].position.second / size;
+
+    for (int64_t i = bx - 1; i <= bx + 1; i++) {
+      for (int64_t j = by - 1; j <= by + 1; j++) {
+        auto it = buckets.find(bucketKey(i, j));
+        if (it == buckets.end())
+          continue;
+
+        for (auto b : it->second) {
+          int64_t dx = std::abs(agents[a].position.first - agents[b].position.first);
+          int64_t dy = std::abs(agents[a].position.second - agents[b].position.second);
+
+          if (std::max(dx, dy) < size)
+            parent[root(a)] = root(b);
+        }
+      }
+    }
+  }
+
+  // Priorities rotate with the tick so no agent always yields
+  std::unordered_map<int, std::vector<int>> groups;
+  for (size_t k = 0; k < agents.size(); k++) {
+    int a = (k + now) % agents.size();
+    groups[root(a)].push_back(a);
+  }
+
+  std::vector<std::vector<int>> result;
+  for (auto& g : groups)
+    result.push_back(g.second);
+
+  return result;
+}
+
+int cooperativePlanner::planTick(int64_t now, int threads) {
+  reservations.clear();
+
+  // Distance fields are shared read-only by the workers, fill them first. Any edit, resize or
+  //   new map since the last tick makes them stale
+  if (world.getMapVersion() != fieldsVersion) {
+    fields.clear();
+    fieldsVersion = world.getMapVersion();
+  }
+
+  for (auto& a : agents)
+    fieldFor(a.goal);
+
+  auto groups = partition(now);
+  std::atomic<size_t> next(0);
+  threads = std::max(1, std::min(threads, (int)groups.size()));
+  if (!world.getMap().concurrentReads())
+    threads = 1;
+
+  auto worker = [&]() {
+    nodeTable<stNode> nodes;
+    for (size_t g = next++; g < groups.size(); g = next++)
+      planGroup(groups[g], now, nodes);
+  };
+
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++)
+    pool.push_back(std::thread(worker));
+  worker();
+
+  for (auto& t : pool)
+    t.join();
+
+  return std::count_if(agents.begin(), agents.end(), [](const cooperativeAgent& a) { return a.planned; });
+}
@@ -0,0 +1,469 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Compressed path database - the optimal first move from every cell towards every target,
+//   precomputed for static maps and read back without any search
+
+#pragma once
+
+#include "astar.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CPD_MAGIC       0x44504341  // "ACPD"
+#define CPD_VERSION     1
+
+// Move stored for the target itself and for cells that cannot reach it
+#define CPD_NO_MOVE     8
+
+// On-disk layout, every section padded to 8 bytes so the file maps as is: header, rank of
+//   each cell (row-major, -1 if blocked), target slot of each cell (-1 if not a target),
+//   slots + 1 run offsets, then the runs
+struct cpdHeader {
+    uint32_t magic = CPD_MAGIC;
+    uint32_t version = CPD_VERSION;
+    int64_t rows = 0, cols = 0;
+    int64_t cells = 0;          // Ranked (passable) cells
+    int64_t targets = 0;
+    int64_t runs = 0;
+};
+
+// Interface cpdTable - one row per target. A row lists the first move of every passable cell,
+//   cells ranked in depth-first order so that neighbours sit close together, and is stored as
+//   runs of (first rank, move) packed as rank << 4 | move. A lookup is a binary search in the
+//   target's row; a path is one lookup per step.
+//   Where several moves are optimal, the one that extends the current run is kept
+class cpdTable {
+    private:
+        int64_t rows = 0, cols = 0;
+        int64_t cells = 0, targets = 0, runCount = 0;
+
+        // Built in memory, or views into the mapped file
+        std::vector<int32_t> rankStore, slotStore;
+        std::vector<uint64_t> offsetStore;
+        std::vector<uint32_t> runStore;
+
+        const int32_t* rank = nullptr;
+        const int32_t* slot = nullptr;
+        const uint64_t* offsets = nullptr;
+        const uint32_t* runs = nullptr;
+
+        void* mapped = nullptr;
+        size_t mappedSize = 0;
+
+        void release();
+        void attach();
+        static size_t padded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+
+        void order(const std::vector<float>& w);
+        void row(const std::vector<float>& w, const std::vector<int64_t>& byRank, int64_t target,
+                 std::vector<double>& dist, std::vector<uint32_t>& out);
+
+    public:
+        cpdTable() {};
+        ~cpdTable() { release(); }
+        cpdTable(const cpdTable&) = delete;
+        cpdTable& operator=(const cpdTable&) = delete;
+
+        // Rows for the given targets, every passable cell when empty. The world's agent radius
+        //   is honoured. EXIT_FAILURE above COMPONENT_LIMIT cells or for an invalid target
+        int build(aStar& world, const std::vector<coords>& targets = {},
+                  int threads = std::thread::hardware_concurrency());
+
+        // Write the table, or map one read-only; a mapped table is shared through the page cache
+        int save(const std::string& path);
+        int open(const std::string& path);
+
+        bool isBuilt() { return runs != nullptr; }
+        bool isMapped() { return mapped != nullptr; }
+        int64_t targetCount() { return targets; }
+        int64_t runTotal() { return runCount; }
+        size_t memoryUsage();
+
+        // EXIT_FAILURE when to is not a target, from is blocked or cannot reach to, or from == to
+        int firstMove(const coords& from, const coords& to, Direction& move);
+
+        // Cells from origin to destination, both included
+        int getPath(const coords& from, const coords& to, std::vector<coords>& path);
+};
+
+// Implementation cpdTable
+
+void cpdTable::release() {
+  if (mapped)
+    munmap(mapped, mappedSize);
+
+  mapped = nullptr;
+  mappedSize = 0;
+  rank = slot = nullptr;
+  offsets = nullptr;
+  runs = nullptr;
+}
+
+void cpdTable::attach() {
+  rank = rankStore.data();
+  slot = slotStore.data();
+  offsets = offsetStore.data();
+  runs = runStore.data();
+}
+
+// Depth-first ranks over the 8-connected passable cells, one tree per component
+void cpdTable::order(const std::vector<float>& w) {
+  std::vector<int64_t> stack;
+  int32_t next = 0;
+
+  rankStore.assign(rows * cols, INEXISTENT);
+
+  for (int64_t start = 0; start < rows * cols; start++) {
+    if (w[start] == INACCESSIBLE || rankStore[start] != INEXISTENT)
+      continue;
+
+    stack.push_back(start);
+
+    while (!stack.empty()) {
+      int64_t c = stack.back();
+      stack.pop_back();
+
+      if (rankStore[c] != INEXISTENT)
+        continue;
+      rankStore[c] = next++;
+
+      // Pushed in reverse so the walk goes north, south, east, west first
+      for (int d = 7; d >= 0; d--) {
+        int64_t x = c / cols + adjacentDelta[d][0], y = c % cols + adjacentDelta[d][1];
+        if (x < 0 || y < 0 || x >= rows || y >= cols)
+          continue;
+
+        int64_t a = x * cols + y;
+        if (w[a] != INACCESSIBLE && rankStore[a] == INEXISTENT)
+          stack.push_back(a);
+      }
+    }
+  }
+
+  cells = next;
+}
+
+// Reverse Dijkstra from the target - the cost of reaching it from every cell - then the runs.
+//   A run stays open while some move is optimal for all of its cells
+void cpdTable::row(const std::vector<float>& w, const std::vector<int64_t>& byRank, int64_t target,
+                   std::vector<double>& dist, std::vector<uint32_t>& out) {
+  typedef std::pair<double, int64_t> entry; // distance, cell
+
+  std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+
+  dist.assign(rows * cols, std::numeric_limits<double>::infinity());
+  dist[target] = 0.0;
+  openList.push(entry(0.0, target));
+
+  while (!openList.empty()) {
+    auto top = openList.top();
+    openList.pop();
+
+    if (top.first != dist[top.second])
+      continue;
+
+    // A step into this cell costs its weight
+    double d = top.first + COST * (int)w[top.second];
+    int64_t cx = top.second / cols, cy = top.second % cols;
+
+    for (auto DIR : dirList) {
+      int64_t x = cx + adjacentDelta[DIR][0], y = cy + adjacentDelta[DIR][1];
+      if (x < 0 || y < 0 || x >= rows || y >= cols)
+        continue;
+
+      int64_t a = x * cols + y;
+      if (w[a] != INACCESSIBLE && d < dist[a]) {
+        dist[a] = d;
+        openList.push(entry(d, a));
+      }
+    }
+  }
+
+  out.clear();
+  uint32_t open = 0;      // Moves optimal for every cell of the current run
+  int64_t runStart = 0;
+
+  for (int64_t r = 0; r < cells; r++) {
+    int64_t c = byRank[r];
+    uint32_t moves = 0;
+
+    if (c == target || dist[c] == std::numeric_limits<double>::infinity())
+      moves = 1u << CPD_NO_MOVE;
+    else {
+      int64_t cx = c / cols, cy = c % cols;
+
+      for (auto DIR : dirList) {
+        int64_t x = cx + adjacentDelta[DIR][0], y = cy + adjacentDelta[DIR][1];
+        if (x < 0 || y < 0 || x >= rows || y >= cols)
+          continue;
+
+        int64_t a = x * cols + y;
+        if (w[a] != INACCESSIBLE && COST * (int)w[a] + dist[a] == dist[c])
+          moves |= 1u << DIR;
+      }
+    }
+
+    if (r > 0 && (open & moves))
+      open &= moves;
+    else {
+      if (r > 0)
+        out.push_back((uint32_t)runStart << 4 | __builtin_ctz(open));
+      open = moves;
+      runStart = r;
+    }
+  }
+
+  if (cells > 0)
+    out.push_back((uint32_t)runStart << 4 | __builtin_ctz(open));
+}
+
+int cpdTable::build(aStar& world, const std::vector<coords>& targetList, int threads) {
+  gridMap& map = world.getMap();
+
+  if (map.rows() * map.cols() > COMPONENT_LIMIT)
+    return EXIT_FAILURE;
+
+  release();
+  rows = map.rows();
+  cols = map.cols();
+
+  // Row-major snapshot, cells the agent does not fit on count as blocked
+  std::vector<float> w(rows * cols);
+  for (int64_t x = 0; x < rows; x++)
+    for (int64_t y = 0; y < cols; y++)
+      w[x * cols + y] = world.isValid(coords(x, y)) ? map.get(x, y) : INACCESSIBLE;
+
+  order(w);
+
+  std::vector<int64_t> byRank(cells);
+  for (int64_t c = 0; c < rows * cols; c++)
+    if (rankStore[c] != INEXISTENT)
+      byRank[rankStore[c]] = c;
+
+  std::vector<int64_t> chosen;
+  slotStore.assign(rows * cols, INEXISTENT);
+
+  if (targetList.empty())
+    chosen = byRank;
+  else
+    for (auto& t : targetList) {
+      if (t.first < 0 || t.second < 0 || t.first >= rows || t.second >= cols || w[t.first * cols + t.second] == INACCESSIBLE)
+        return EXIT_FAILURE;
+      if (slotStore[t.first * cols + t.second] == INEXISTENT) {
+        slotStore[t.first * cols + t.second] = chosen.size();
+        chosen.push_back(t.first * cols + t.second);
+      }
+    }
+
+  if (targetList.empty())
+    for (size_t k = 0; k < chosen.size(); k++)
+      slotStore[chosen[k]] = k;
+
+  targets = chosen.size();
+
+  // Targets are handed out one at a time, each thread with its own Dijkstra buffers
+  std::vector<std::vector<uint32_t>> perTarget(targets);
+  std::atomic<int64_t> next(0);
+  std::vector<std::thread> pool;
+
+  auto work = [&]() {
+    std::vector<double> dist;
+    for (int64_t k = next++; k < targets; k = next++)
+      row(w, byRank, chosen[k], dist, perTarget[k]);
+  };
+
+  for (int t = 0; t < std::max(1, threads) - 1; t++)
+    pool.push_back(std::thread(work));
+  work();
+  for (auto& t : pool)
+    t.join();
+
+  offsetStore.assign(targets + 1, 0);
+  for (int64_t k = 0; k < targets; k++)
+    offsetStore[k + 1] = offsetStore[k] + perTarget[k].size();
+
+  runCount = offsetStore[targets];
+  runStore.resize(runCount);
+  for (int64_t k = 0; k < targets; k++) {
+    std::copy(perTarget[k].begin(), perTarget[k].end(), runStore.begin() + offsetStore[k]);
+    std::vector<uint32_t>().swap(perTarget[k]);
+  }
+
+  attach();
+  return EXIT_SUCCESS;
+}
+
+int cpdTable::save(const std::string& path) {
+  if (!isBuilt())
+    return EXIT_FAILURE;
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  cpdHeader header;
+  header.rows = rows;
+  header.cols = cols;
+  header.cells = cells;
+  header.targets = targets;
+  header.runs = runCount;
+
+  const uint64_t zero = 0;
+  auto put = [&](const void* data, size_t bytes) {
+    return write(fd, data, bytes) == (ssize_t)bytes &&
+           write(fd, &zero, padded(bytes) - bytes) == (ssize_t)(padded(bytes) - bytes);
+  };
+
+  bool ok = put(&header, sizeof(header)) && put(rank, rows * cols * sizeof(int32_t)) &&
+            put(slot, rows * cols * sizeof(int32_t)) && put(offsets, (targets + 1) * sizeof(uint64_t)) &&
+            put(runs, runCount * sizeof(uint32_t));
+
+  close(fd);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int cpdTable::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  struct stat info;
+  cpdHeader header;
+
+  if (fstat(fd, &info) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != CPD_MAGIC || header.version != CPD_VERSION) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  // Counts against each other and the file size first, so the sizes below cannot overflow. Ranks
+  //   are packed above the 4 move bits of a run
+  uint64_t size = info.st_size;
+  bool ok = header.rows > 0 && header.cols > 0 &&
+            (uint64_t)header.cols <= size / (2 * sizeof(int32_t)) / (uint64_t)header.rows &&
+            header.cells >= 0 && header.cells <= header.rows * header.cols && header.cells <= (1ll << 28) &&
+            header.targets >= 0 && header.targets <= header.cells &&
+            header.runs >= header.targets && (uint64_t)header.runs <= size / sizeof(uint32_t);
+
+  size_t grid = 0, expected = 0;
+  if (ok) {
+    grid = padded(header.rows * header.cols * sizeof(int32_t));
+    expected = padded(sizeof(header)) + 2 * grid + padded((header.targets + 1) * sizeof(uint64_t)) +
+               padded(header.runs * sizeof(uint32_t));
+    ok = size >= expected;
+  }
+
+  if (!ok) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  void* view = mmap(nullptr, expected, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (view == MAP_FAILED)
+    return EXIT_FAILURE;
+
+  // Every lookup must stay inside the mapping: ranks and slots in range, and each target's row
+  //   a non-empty slice of the runs starting at rank 0, so a binary search always lands in it
+  const char* base = (const char*)view + padded(sizeof(header));
+  const int32_t* rankView = (const int32_t*)base;
+  const int32_t* slotView = (const int32_t*)(base + grid);
+  const uint64_t* offsetView = (const uint64_t*)(base + 2 * grid);
+  const uint32_t* runView = (const uint32_t*)(base + 2 * grid + padded((header.targets + 1) * sizeof(uint64_t)));
+
+  ok = offsetView[0] == 0 && offsetView[header.targets] == (uint64_t)header.runs;
+  for (int64_t k = 0; ok && k < header.targets; k++)
+    ok = offsetView[k] < offsetView[k + 1] && (runView[offsetView[k]] >> 4) == 0;
+  for (int64_t i = 0; ok && i < header.rows * header.cols; i++)
+    ok = rankView[i] >= INEXISTENT && rankView[i] < header.cells &&
+         slotView[i] >= INEXISTENT && slotView[i] < header.targets;
+
+  if (!ok) {
+    munmap(view, expected);
+    return EXIT_FAILURE;
+  }
+
+  release();
+  rankStore.clear();
+  slotStore.clear();
+  offsetStore.clear();
+  runStore.clear();
+
+  mapped = view;
+  mappedSize = expected;
+  rows = header.rows;
+  cols = header.cols;
+  cells = header.cells;
+  targets = header.targets;
+  runCount = header.runs;
+
+  rank = rankView;
+  slot = slotView;
+  offsets = offsetView;
+  runs = runView;
+
+  return EXIT_SUCCESS;
+}
+
+size_t cpdTable::memoryUsage() {
+  return rankStore.capacity() * sizeof(int32_t) + slotStore.capacity() * sizeof(int32_t) +
+         offsetStore.capacity() * sizeof(uint64_t) + runStore.capacity() * sizeof(uint32_t);
+}
+
+int cpdTable::firstMove(const coords& from, const coords& to, Direction& move) {
+  if (!isBuilt())
+    return EXIT_FAILURE;
+
+  if (from.first < 0 || from.second < 0 || from.first >= rows || from.second >= cols ||
+      to.first < 0 || to.second < 0 || to.first >= rows || to.second >= cols)
+    return EXIT_FAILURE;
+
+  int32_t r = rank[from.first * cols + from.second];
+  int32_t k = slot[to.first * cols + to.second];
+  if (r == INEXISTENT || k == INEXISTENT)
+    return EXIT_FAILURE;
+
+  // Last run starting at or before r
+  const uint32_t* first = runs + offsets[k];
+  const uint32_t* last = runs + offsets[k + 1];
+  const uint32_t* it = std::upper_bound(first, last, ((uint32_t)r << 4) | 0xF) - 1;
+
+  uint32_t m = *it & 0xF;
+  if (m == CPD_NO_MOVE)
+    return EXIT_FAILURE;
+
+  move = (Direction)m;
+  return EXIT_SUCCESS;
+}
+
+int cpdTable::getPath(const coords& from, const coords& to, std::vector<coords>& path) {
+  path.clear();
+
+  if (!isBuilt() || from.first < 0 || from.second < 0 || from.first >= rows || from.second >= cols ||
+      rank[from.first * cols + from.second] == INEXISTENT)
+    return EXIT_FAILURE;
+
+  coords at = from;
+  Direction move;
+  path.push_back(at);
+
+  // A sound table reaches the target within cells steps, a corrupt one could cycle
+  while (at != to) {
+    if ((int64_t)path.size() > cells || firstMove(at, to, move) != EXIT_SUCCESS) {
+      path.clear();
+      return EXIT_FAILURE;
+    }
+
+    at = coords(at.first + adjacentDelta[move][0], at.second + adjacentDelta[move][1]);
+    path.push_back(at);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,486 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Graph form of the search - the best-first engine over any graph, the grid as one
+//   graph and a compressed sparse row (CSR) adjacency with edge weights as another
+
+#pragma once
+
+#include "utils.hpp"
+#include "gridmap.hpp"
+#include "nodetable.hpp"
+#include "clearance.hpp"
+#include "perfcounters.hpp"
+#include "trace.hpp"
+#include <cstdio>
+#include <tuple>
+#include <sys/stat.h>
+
+// A Graph provides
+//   typedef link                        - what a node keeps to find its parent, noLink for none
+//   int64_t vertexCount()               - vertices are numbered [0, vertexCount)
+//   void forEachEdge(v, parent, f)      - f(to, cost, link) for every usable edge out of v,
+//                                         parent is the link stored in v (prefetch hint)
+//   cellIndex follow(v, link)           - the parent of v
+//   float distance(a, b)                - admissible lower bound of the cost from a to b
+
+// Counters of the last search
+struct searchStats {
+    size_t expansions = 0;
+    size_t generated = 0;
+
+    // Hardware counters per phase when enabled on the aStar - preparation up to the first
+    //   expansion, the expansion loop, and path reconstruction
+    perfReading setup, search, trace;
+};
+
+// Search seed - a vertex with its initial g
+struct searchSource {
+    cellIndex cell;
+    float g;
+    int id;
+};
+
+template<class Graph>
+struct graphNode {
+    float g = std::numeric_limits<float>::infinity();
+    float h = 0.0f;
+    int32_t source = INEXISTENT;                    // Id of the origin the node was reached from
+    typename Graph::link parent = Graph::noLink;
+    bool closed = false;
+};
+
+// Interface gridGraph - the map seen as a graph, a step pays COST * weight of the cell entered
+//   and links are Directions. With a clearance map and radius, cells the agent does not fit
+//   on have no edges into them
+class gridGraph {
+    private:
+        gridMap& map;
+        clearanceMap* clearance;
+        int radius;
+
+    public:
+        typedef uint8_t link;
+        static constexpr link noLink = NO_PARENT;
+
+        gridGraph(gridMap& map, clearanceMap* clearance = nullptr, int radius = 0)
+          : map(map), clearance(clearance), radius(radius) {};
+
+        int64_t vertexCount() { return map.indexSpace(); }
+
+        template<class F>
+        void forEachEdge(cellIndex v, link parent, F f);
+        cellIndex follow(cellIndex v, link l);
+        float distance(cellIndex a, cellIndex b);
+};
+
+typedef graphNode<gridGraph> searchNode;
+
+// CSR file - header, offsets[vertices + 1], targets[edges], weights[edges] and, with
+//   CSR_COORDINATES set, x[vertices] and y[vertices]
+#define CSR_MAGIC       0x31525343  // "CSR1"
+#define CSR_VERSION     1
+#define CSR_COORDINATES 1
+
+struct csrHeader {
+    uint32_t magic = CSR_MAGIC;
+    uint32_t version = CSR_VERSION;
+    uint32_t flags = 0;
+    uint32_t reserved = 0;
+    uint64_t vertices = 0;
+    uint64_t edges = 0;
+};
+
+// Interface csrGraph - directed weighted edges, out-edges of v at [offsets[v], offsets[v + 1]).
+//   Links are parent vertices. With coordinates, distance is the straight line scaled by the
+//   smallest weight per unit length of any edge, so it stays admissible; without, it is 0
+class csrGraph {
+    private:
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> targets;
+        std::vector<float> weights;
+        std::vector<float> xs, ys;
+        float scale = 0.0f;
+
+        void computeScale();
+
+    public:
+        typedef uint32_t link;
+        static constexpr link noLink = 0xFFFFFFFF;
+
+        csrGraph() : offsets(1, 0) {};
+
+        // Edges as (from, to, weight), any order
+        int build(int64_t vertices, const std::vector<std::tuple<int64_t, int64_t, float>>& edges);
+        int setCoordinates(const std::vector<float>& x, const std::vector<float>& y);
+
+        int load(const std::string& path);
+        int save(const std::string& path);
+
+        int64_t vertexCount() { return (int64_t)offsets.size() - 1; }
+        int64_t edgeCount() { return targets.size(); }
+        bool hasCoordinates() { return !xs.empty(); }
+
+        template<class F>
+        void forEachEdge(cellIndex v, link parent, F f);
+        cellIndex follow(cellIndex, link l) { return l; }
+        float distance(cellIndex a, cellIndex b);
+};
+
+// A* from a set of sources until goalAt(v) names a goal, h(v) must be admissible. Returns
+//   EXIT_SUCCESS with last set to the goal vertex and goal to its id. Events go to trace if set
+template<class Graph, class H, class G>
+int bestFirstSearch(Graph& graph, nodeTable<graphNode<Graph>>& nodes, const std::vector<searchSource>& sources,
+                    H h, G goalAt, searchStats& stats, cellIndex& last, int& goal, traceRing* trace = nullptr);
+
+// Vertices from the node without parent to last
+template<class Graph, class Node>
+std::vector<cellIndex> traceVertices(Graph& graph, nodeTable<Node>& nodes, cellIndex last);
+
+// Cheapest path from one vertex to another, guided by graph.distance
+template<class Graph>
+int shortestPath(Graph& graph, nodeTable<graphNode<Graph>>& nodes, cellIndex from, cellIndex to,
+                 std::vector<cellIndex>& path, float& cost, searchStats& stats);
+
+// Implementation gridGraph
+
+template<class F>
+void gridGraph::forEachEdge(cellIndex v, link parent, F f) {
+  cellIndex adjacent[8];
+  int64_t x, y;
+
+  map.position(v, x, y);
+  if (parent != noLink)
+    map.prefetch(x, y, adjacentDelta[parent][0], adjacentDelta[parent][1]);
+
+  // Neighbours come from the layout's offset tables
+  map.adjacent(x, y, v, adjacent);
+
+  for (auto DIR : dirList) {
+    cellIndex to = adjacent[DIR];
+    if (to == INEXISTENT)
+      continue;
+
+    float w = map.at(to);
+    if (w == INACCESSIBLE || (clearance && !clearance->fits(to, radius)))
+      continue;
+
+    f(to, COST * (int)w, (link)DIR);
+  }
+}
+
+cellIndex gridGraph::follow(cellIndex v, link l) {
+  cellIndex adjacent[8];
+  int64_t x, y;
+
+  map.position(v, x, y);
+  map.adjacent(x, y, v, adjacent);
+  return adjacent[oppositeDir[l]];
+}
+
+float gridGraph::distance(cellIndex a, cellIndex b) {
+  int64_t ax, ay, bx, by;
+
+  map.position(a, ax, ay);
+  map.position(b, bx, by);
+  return COST * MIN_WEIGHT * std::max(std::abs(ax - bx), std::abs(ay - by));
+}
+
+// Implementation csrGraph
+
+int csrGraph::build(int64_t vertices, const std::vector<std::tuple<int64_t, int64_t, float>>& edges) {
+  if (vertices < 0 || vertices >= noLink)
+    return EXIT_FAILURE;
+
+  for (auto& e : edges)
+    if (std::get<0>(e) < 0 || std::get<0>(e) >= vertices || std::get<1>(e) < 0 || std::get<1>(e) >= vertices
+        || !(std::get<2>(e) >= 0.0f))
+      return EXIT_FAILURE;
+
+  // Counting sort by source
+  offsets.assign(vertices + 1, 0);
+  for (auto& e : edges)
+    offsets[std::get<0>(e) + 1]++;
+  for (int64_t v = 0; v < vertices; v++)
+    offsets[v + 1] += offsets[v];
+
+  std::vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+  targets.resize(edges.size());
+  weights.resize(edges.size());
+
+  for (auto& e : edges) {
+    uint64_t k = fill[std::get<0>(e)]++;
+    targets[k] = std::get<1>(e);
+    weights[k] = std::get<2>(e);
+  }
+
+  xs.clear();
+  ys.clear();
+  scale = 0.0f;
+
+  return EXIT_SUCCESS;
+}
+
+int csrGraph::setCoordinates(const std::vector<float>& x, const std::vector<float>& y) {
+  if ((int64_t)x.size() != vertexCount() || (int64_t)y.size() != vertexCount())
+    return EXIT_FAILURE;
+
+  xs = x;
+  ys = y;
+  computeScale();
+
+  return EXIT_SUCCESS;
+}
+
+void csrGraph::computeScale() {
+  scale = std::numeric_limits<float>::infinity();
+
+  for (int64_t v = 0; v < vertexCount(); v++)
+    for (uint64_t k = offsets[v]; k < offsets[v + 1]; k++) {
+      float length = std::hypot(xs[v] - xs[targets[k]], ys[v] - ys[targets[k]]);
+      if (length > 0.0f)
+        scale = std::min(scale, weights[k] / length);
+    }
+
+  if (scale == std::numeric_limits<float>::infinity())
+    scale = 0.0f;
+}
+
+int csrGraph::load(const std::string& path) {
+  FILE* f = std::fopen(path.c_str(), "rb");
+  csrHeader header;
+
+  if (!f)
+    return EXIT_FAILURE;
+
+  bool ok = std::fread(&header, sizeof(header), 1, f) == 1 && header.magic == CSR_MAGIC
+            && header.version == CSR_VERSION && header.vertices < noLink;
+
+  // The arrays must fill the rest of the file exactly, checked before anything is allocated
+  struct stat info;
+  if (ok && fstat(fileno(f), &info) == 0) {
+    uint64_t size = info.st_size;
+    uint64_t coordinates = (header.flags & CSR_COORDINATES) ? header.vertices * 2 * sizeof(float) : 0;
+
+    ok = header.edges <= size / (sizeof(uint32_t) + sizeof(float))
+         && sizeof(header) + (header.vertices + 1) * sizeof(uint64_t)
+            + header.edges * (sizeof(uint32_t) + sizeof(float)) + coordinates == size;
+  }
+  else
+    ok = false;
+
+  if (ok) {
+    offsets.resize(header.vertices + 1);
+    targets.resize(header.edges);
+    weights.resize(header.edges);
+
+    // One read per array
+    ok = std::fread(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size()
+         && std::fread(targets.data(), sizeof(uint32_t), targets.size(), f) == targets.size()
+         && std::fread(weights.data(), sizeof(float), weights.size(), f) == weights.size();
+  }
+
+  xs.clear();
+  ys.clear();
+
+  if (ok && (header.flags & CSR_COORDINATES)) {
+    xs.resize(header.vertices);
+    ys.resize(header.vertices);
+    ok = std::fread(xs.data(), sizeof(float), xs.size(), f) == xs.size()
+         && std::fread(ys.data(), sizeof(float), ys.size(), f) == ys.size();
+  }
+
+  std::fclose(f);
+
+  // Offsets must be monotone and end at the edge count, targets in range
+  for (uint64_t v = 0; ok && v < header.vertices; v++)
+    ok = offsets[v] <= offsets[v + 1];
+  ok = ok && offsets[0] == 0 && offsets[header.vertices] == header.edges;
+  for (uint64_t k = 0; ok && k < header.edges; k++)
+    ok = targets[k] < header.vertices && weights[k] >= 0.0f;
+
+  if (!ok) {
+    offsets.assign(1, 0);
+    targets.clear();
+    weights.clear();
+    xs.clear();
+    ys.clear();
+    return EXIT_FAILURE;
+  }
+
+  if (hasCoordinates())
+    computeScale();
+  else
+    scale = 0.0f;
+
+  return EXIT_SUCCESS;
+}
+
+int csrGraph::save(const std::string& path) {
+  FILE* f = std::fopen(path.c_str(), "wb");
+  csrHeader header;
+
+  if (!f)
+    return EXIT_FAILURE;
+
+  header.vertices = vertexCount();
+  header.edges = edgeCount();
+  header.flags = hasCoordinates() ? CSR_COORDINATES : 0;
+
+  bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+            && std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size()
+            && std::fwrite(targets.data(), sizeof(uint32_t), targets.size(), f) == targets.size()
+            && std::fwrite(weights.data(), sizeof(float), weights.size(), f) == weights.size();
+
+  if (ok && hasCoordinates())
+    ok = std::fwrite(xs.data(), sizeof(float), xs.size(), f) == xs.size()
+         && std::fwrite(ys.data(), sizeof(float), ys.size(), f) == ys.size();
+
+  ok = (std::fclose(f) == 0) && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+template<class F>
+void csrGraph::forEachEdge(cellIndex v, link, F f) {
+  for (uint64_t k = offsets[v]; k < offsets[v + 1]; k++)
+    f((cellIndex)targets[k], weights[k], (link)v);
+}
+
+float csrGraph::distance(cellIndex a, cellIndex b) {
+  if (scale == 0.0f)
+    return 0.0f;
+
+  return scale * std::hypot(xs[a] - xs[b], ys[a] - ys[b]);
+}
+
+// Implementation search
+
+template<class Graph, class H, class G>
+int bestFirstSearch(Graph& graph, nodeTable<graphNode<Graph>>& nodes, const std::vector<searchSource>& sources,
+                    H h, G goalAt, searchStats& stats, cellIndex& last, int& goal, traceRing* trace) {
+    typedef std::pair<float, cellIndex> entry; // f, vertex
+
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+
+    stats = searchStats();
+    last = INEXISTENT;
+    goal = INEXISTENT;
+    nodes.reset(graph.vertexCount());
+
+    // h is evaluated once per node, on first touch
+    auto node = [&](cellIndex i) -> graphNode<Graph>& {
+      bool created;
+      auto& n = nodes.get(i, created);
+      if (created)
+        n.h = h(i);
+      return n;
+    };
+
+    // All sources share the open list, the cheapest seed of a vertex wins
+    for (auto& s : sources) {
+      auto& n = node(s.cell);
+      if (s.g < n.g) {
+        n.g = s.g;
+        n.source = s.id;
+        n.parent = Graph::noLink;
+        openList.push(entry(n.g + n.h, s.cell));
+        if (trace)
+          trace->record(TRACE_PUSH, s.cell, n.g, n.h);
+      }
+    }
+
+    while (!openList.empty()) {
+      auto top = openList.top();
+      openList.pop();
+
+      auto& n = node(top.second);
+      if (trace)
+        trace->record(TRACE_POP, top.second, n.g, n.h);
+
+      if (n.closed || top.first != n.g + n.h) {
+        if (trace)
+          trace->record(TRACE_PRUNE, top.second, n.g, n.h);
+        continue;
+      }
+
+      n.closed = true;
+      stats.expansions++;
+      if (trace)
+        trace->record(TRACE_EXPAND, top.second, n.g, n.h);
+
+      goal = goalAt(top.second);
+      if (goal != INEXISTENT) {
+        last = top.second;
+        return EXIT_SUCCESS;
+      }
+
+      float g0 = n.g;
+      int32_t source = n.source;
+
+      graph.forEachEdge(top.second, n.parent, [&](cellIndex to, float cost, typename Graph::link l) {
+        auto& child = node(to);
+        float g = g0 + cost;
+
+        // Infinite h - the goal cannot be reached from there
+        if (child.closed || g >= child.g || child.h == std::numeric_limits<float>::infinity()) {
+          if (trace)
+            trace->record(TRACE_PRUNE, to, g, child.h);
+          return;
+        }
+
+        child.g = g;
+        child.parent = l;
+        child.source = source;
+        openList.push(entry(g + child.h, to));
+        stats.generated++;
+        if (trace)
+          trace->record(TRACE_PUSH, to, g, child.h);
+      });
+    }
+
+    return EXIT_FAILURE;
+}
+
+template<class Graph, class Node>
+std::vector<cellIndex> traceVertices(Graph& graph, nodeTable<Node>& nodes, cellIndex last) {
+  std::vector<cellIndex> trace;
+
+  for (cellIndex i = last; ; ) {
+    trace.push_back(i);
+
+    auto parent = nodes.get(i).parent;
+    if (parent == Graph::noLink)
+      break;
+
+    i = graph.follow(i, parent);
+  }
+
+  std::reverse(trace.begin(), trace.end());
+  return trace;
+}
+
+template<class Graph>
+int shortestPath(Graph& graph, nodeTable<graphNode<Graph>>& nodes, cellIndex from, cellIndex to,
+                 std::vector<cellIndex>& path, float& cost, searchStats& stats) {
+  cellIndex last;
+  int goal;
+
+  path.clear();
+  cost = std::numeric_limits<float>::infinity();
+
+  if (from < 0 || from >= graph.vertexCount() || to < 0 || to >= graph.vertexCount())
+    return EXIT_FAILURE;
+
+  int result = bestFirstSearch(graph, nodes, { searchSource{ from, 0.0f, 0 } },
+                               [&](cellIndex v) { return graph.distance(v, to); },
+                               [&](cellIndex v) { return (v == to) ? 0 : INEXISTENT; },
+                               stats, last, goal);
+
+  if (result != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  path = traceVertices(graph, nodes, last);
+  cost = nodes.get(last).g;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,446 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Collision map storage - dense matrix, sparse tiles and cache-friendly layouts
+
+#pragma once
+
+#include "utils.hpp"
+
+using namespace Eigen;
+
+typedef int64_t cellIndex;
+
+// Row and column steps, in Direction order
+constexpr int adjacentDelta[8][2] = { { -1, 0 }, { 1, 0 }, { 0, 1 }, { 0, -1 },
+                                      { -1, 1 }, { 1, 1 }, { -1, -1 }, { 1, -1 } };
+
+enum Direction { NORTH = 0, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_EAST, NORTH_WEST, SOUTH_WEST };
+
+constexpr std::initializer_list<Direction> dirList = { NORTH, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_EAST, NORTH_WEST, SOUTH_WEST };
+
+constexpr Direction oppositeDir[8] = { SOUTH, NORTH, WEST, EAST, SOUTH_WEST, NORTH_WEST, SOUTH_EAST, NORTH_EAST };
+
+// Interface gridMap - weights addressed by (row, column), 64-bit sizes
+//   Each storage also numbers its cells in its own memory order, searches key their
+//   per-cell state by that index so it shares the locality of the layout
+class gridMap {
+    protected:
+        int64_t sizeM = 0, sizeN = 0;
+
+    public:
+        virtual ~gridMap() {};
+
+        virtual void resize(int64_t sizeM, int64_t sizeN) = 0;
+        virtual float get(int64_t x, int64_t y) = 0;
+        virtual void set(int64_t x, int64_t y, float w) = 0;
+
+        // Bytes held by the cell storage
+        virtual size_t memoryUsage() = 0;
+        virtual int storageType() = 0;
+
+        // Bulk writes, corners inclusive and inside the map. Cell by cell unless the storage
+        //   has something faster
+        virtual void fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w);
+        virtual void setBlock(int64_t x0, int64_t y0, const MatrixXf& block);
+
+        // Hint that the search expands (x, y) heading along (dx, dy)
+        virtual void prefetch(int64_t, int64_t, int, int) {};
+
+        // True, with its weight, if tile (tx, ty) is known to be uniform without reading its cells
+        virtual bool uniformTile(int64_t, int64_t, float&) { return false; }
+
+        // False if reads change the storage (a tile cache), so one thread at a time may read
+        virtual bool concurrentReads() { return true; }
+
+        // Storage order - indices lie in [0, indexSpace())
+        virtual cellIndex index(int64_t x, int64_t y) = 0;
+        virtual void position(cellIndex i, int64_t& x, int64_t& y) = 0;
+        virtual cellIndex indexSpace() = 0;
+        virtual float at(cellIndex i) = 0;
+
+        // Indices of the 8 neighbours of (x, y) = i in Direction order, INEXISTENT off the map
+        virtual void adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out);
+
+        int64_t rows() { return sizeM; }
+        int64_t cols() { return sizeN; }
+
+        float operator() (int64_t x, int64_t y) { return get(x, y); }
+};
+
+// Interface denseMap - one Eigen matrix, every cell stored
+class denseMap : public gridMap {
+    private:
+        MatrixXd m;
+
+    public:
+        denseMap() {};
+        denseMap(int64_t sizeM, int64_t sizeN) { resize(sizeM, sizeN); }
+
+        void resize(int64_t sizeM, int64_t sizeN) override;
+        float get(int64_t x, int64_t y) override { return m(x, y); }
+        void set(int64_t x, int64_t y, float w) override { m(x, y) = w; }
+        size_t memoryUsage() override { return m.size() * sizeof(double); }
+        int storageType() override { return DENSE_STORAGE; }
+        void fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) override;
+        void setBlock(int64_t x0, int64_t y0, const MatrixXf& block) override;
+
+        // Column-major, as Eigen stores it
+        cellIndex index(int64_t x, int64_t y) override { return y * sizeM + x; }
+        void position(cellIndex i, int64_t& x, int64_t& y) override { x = i % sizeM; y = i / sizeM; }
+        cellIndex indexSpace() override { return m.size(); }
+        float at(cellIndex i) override { return m.data()[i]; }
+        void adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) override;
+};
+
+// Interface tiledMap - TILE_SIZE x TILE_SIZE tiles, a uniform tile is a single value
+//   and its cells are only allocated on the first write that breaks uniformity
+typedef Matrix<float, TILE_SIZE, TILE_SIZE, RowMajor> tileCells;
+
+struct mapTile {
+    float uniform = MIN_WEIGHT;
+    std::unique_ptr<tileCells> cells;
+};
+
+class tiledMap : public gridMap {
+    private:
+        int64_t tilesM = 0, tilesN = 0;
+        float background = MIN_WEIGHT;
+
+        std::vector<mapTile> tiles;
+
+        mapTile& tileAt(int64_t x, int64_t y) { return tiles[(x >> TILE_SHIFT) * tilesN + (y >> TILE_SHIFT)]; }
+
+    public:
+        tiledMap() {};
+        tiledMap(int64_t sizeM, int64_t sizeN, float background = MIN_WEIGHT);
+
+        void resize(int64_t sizeM, int64_t sizeN) override;
+        float get(int64_t x, int64_t y) override;
+        void set(int64_t x, int64_t y, float w) override;
+        size_t memoryUsage() override;
+        int storageType() override { return TILED_STORAGE; }
+        void fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) override;
+        bool uniformTile(int64_t tx, int64_t ty, float& w) override;
+
+        // Tile by tile, row-major inside a tile
+        cellIndex index(int64_t x, int64_t y) override;
+        void position(cellIndex i, int64_t& x, int64_t& y) override;
+        cellIndex indexSpace() override { return (cellIndex)tiles.size() << (2 * TILE_SHIFT); }
+        float at(cellIndex i) override;
+
+        // Release tiles whose cells have become uniform again
+        size_t compact();
+        size_t allocatedTiles();
+        size_t tileCount() { return tiles.size(); }
+};
+
+// Interface mortonMap - Z-order over the enclosing power of two square, best for square maps
+class mortonMap : public gridMap {
+    private:
+        int64_t side = 0;
+        std::vector<float> cells;
+
+        static uint64_t dilate(uint64_t v);
+        static uint64_t undilate(uint64_t v);
+
+    public:
+        mortonMap() {};
+        mortonMap(int64_t sizeM, int64_t sizeN) { resize(sizeM, sizeN); }
+
+        void resize(int64_t sizeM, int64_t sizeN) override;
+        float get(int64_t x, int64_t y) override { return cells[index(x, y)]; }
+        void set(int64_t x, int64_t y, float w) override { cells[index(x, y)] = w; }
+        size_t memoryUsage() override { return cells.size() * sizeof(float); }
+        int storageType() override { return MORTON_STORAGE; }
+
+        // Row bits on odd positions, column bits on even positions
+        cellIndex index(int64_t x, int64_t y) override { return (dilate(x) << 1) | dilate(y); }
+        void position(cellIndex i, int64_t& x, int64_t& y) override { x = undilate(i >> 1); y = undilate(i); }
+        cellIndex indexSpace() override { return cells.size(); }
+        float at(cellIndex i) override { return cells[i]; }
+        void adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) override;
+};
+
+// Interface blockedMap - BLOCK_SIZE x BLOCK_SIZE blocks, each block one contiguous run of cells
+class blockedMap : public gridMap {
+    private:
+        int64_t blocksN = 0;
+        std::vector<float> cells;
+
+    public:
+        blockedMap() {};
+        blockedMap(int64_t sizeM, int64_t sizeN) { resize(sizeM, sizeN); }
+
+        void resize(int64_t sizeM, int64_t sizeN) override;
+        float get(int64_t x, int64_t y) override { return cells[index(x, y)]; }
+        void set(int64_t x, int64_t y, float w) override { cells[index(x, y)] = w; }
+        size_t memoryUsage() override { return cells.size() * sizeof(float); }
+        int storageType() override { return BLOCKED_STORAGE; }
+
+        cellIndex index(int64_t x, int64_t y) override {
+          return ((((x >> BLOCK_SHIFT) * blocksN + (y >> BLOCK_SHIFT)) << (2 * BLOCK_SHIFT))
+                  | ((x & BLOCK_MASK) << BLOCK_SHIFT) | (y & BLOCK_MASK));
+        }
+        void position(cellIndex i, int64_t& x, int64_t& y) override;
+        cellIndex indexSpace() override { return cells.size(); }
+        float at(cellIndex i) override { return cells[i]; }
+        void adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) override;
+};
+
+// Implementation gridMap
+
+void gridMap::adjacent(int64_t x, int64_t y, cellIndex, cellIndex* out) {
+  for (int d = 0; d < 8; d++) {
+    int64_t nx = x + adjacentDelta[d][0], ny = y + adjacentDelta[d][1];
+    out[d] = (nx >= 0 && ny >= 0 && nx < sizeM && ny < sizeN) ? index(nx, ny) : INEXISTENT;
+  }
+}
+
+void gridMap::fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) {
+  for (int64_t x = x0; x <= x1; x++)
+    for (int64_t y = y0; y <= y1; y++)
+      set(x, y, w);
+}
+
+void gridMap::setBlock(int64_t x0, int64_t y0, const MatrixXf& block) {
+  for (int64_t x = 0; x < block.rows(); x++)
+    for (int64_t y = 0; y < block.cols(); y++)
+      set(x0 + x, y0 + y, block(x, y));
+}
+
+// Implementation denseMap
+
+void denseMap::fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) {
+  m.block(x0, y0, x1 - x0 + 1, y1 - y0 + 1).setConstant(w);
+}
+
+void denseMap::setBlock(int64_t x0, int64_t y0, const MatrixXf& block) {
+  m.block(x0, y0, block.rows(), block.cols()) = block.cast<double>();
+}
+
+void denseMap::resize(int64_t sizeM, int64_t sizeN) {
+  this->sizeM = sizeM;
+  this->sizeN = sizeN;
+  m.resize(sizeM, sizeN);
+  m.setConstant(MIN_WEIGHT);
+}
+
+void denseMap::adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) {
+  if (x < 1 || y < 1 || x >= sizeM - 1 || y >= sizeN - 1) {
+    gridMap::adjacent(x, y, i, out);
+    return;
+  }
+
+  // Interior cells - a row step is 1, a column step is a whole column
+  const cellIndex offsets[8] = { -1, 1, sizeM, -sizeM, sizeM - 1, sizeM + 1, -sizeM - 1, 1 - sizeM };
+  for (int d = 0; d < 8; d++)
+    out[d] = i + offsets[d];
+}
+
+// Implementation mortonMap
+
+uint64_t mortonMap::dilate(uint64_t v) {
+  v &= 0xFFFFFFFFull;
+  v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+  v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+  v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+  v = (v | (v << 2))  & 0x3333333333333333ull;
+  v = (v | (v << 1))  & 0x5555555555555555ull;
+  return v;
+}
+
+uint64_t mortonMap::undilate(uint64_t v) {
+  v &= 0x5555555555555555ull;
+  v = (v | (v >> 1))  & 0x3333333333333333ull;
+  v = (v | (v >> 2))  & 0x0F0F0F0F0F0F0F0Full;
+  v = (v | (v >> 4))  & 0x00FF00FF00FF00FFull;
+  v = (v | (v >> 8))  & 0x0000FFFF0000FFFFull;
+  v = (v | (v >> 16)) & 0x00000000FFFFFFFFull;
+  return v;
+}
+
+void mortonMap::resize(int64_t sizeM, int64_t sizeN) {
+  this->sizeM = sizeM;
+  this->sizeN = sizeN;
+
+  for (side = 1; side < std::max(sizeM, sizeN); side <<= 1);
+  cells.assign(side * side, MIN_WEIGHT);
+}
+
+void mortonMap::adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) {
+  if (x < 1 || y < 1 || x >= sizeM - 1 || y >= sizeN - 1) {
+    gridMap::adjacent(x, y, i, out);
+    return;
+  }
+
+  // Dilated arithmetic - step one coordinate and carry through the other's bits
+  const uint64_t rowBits = 0xAAAAAAAAAAAAAAAAull, colBits = 0x5555555555555555ull;
+  uint64_t z = i, row = z & rowBits, col = z & colBits;
+
+  uint64_t up    = ((row & rowBits) - 1) & rowBits;
+  uint64_t down  = ((row | colBits) + 1) & rowBits;
+  uint64_t right = ((col | rowBits) + 1) & colBits;
+  uint64_t left  = ((col & colBits) - 1) & colBits;
+
+  const uint64_t steps[8] = { up | col, down | col, row | right, row | left,
+                              up | right, down | right, up | left, down | left };
+  for (int d = 0; d < 8; d++)
+    out[d] = steps[d];
+}
+
+// Implementation blockedMap
+
+void blockedMap::resize(int64_t sizeM, int64_t sizeN) {
+  this->sizeM = sizeM;
+  this->sizeN = sizeN;
+
+  int64_t blocksM = (sizeM + BLOCK_MASK) >> BLOCK_SHIFT;
+  blocksN = (sizeN + BLOCK_MASK) >> BLOCK_SHIFT;
+  cells.assign((blocksM * blocksN) << (2 * BLOCK_SHIFT), MIN_WEIGHT);
+}
+
+void blockedMap::position(cellIndex i, int64_t& x, int64_t& y) {
+  cellIndex block = i >> (2 * BLOCK_SHIFT);
+
+  x = ((block / blocksN) << BLOCK_SHIFT) | ((i >> BLOCK_SHIFT) & BLOCK_MASK);
+  y = ((block % blocksN) << BLOCK_SHIFT) | (i & BLOCK_MASK);
+}
+
+void blockedMap::adjacent(int64_t x, int64_t y, cellIndex i, cellIndex* out) {
+  int64_t bx = x & BLOCK_MASK, by = y & BLOCK_MASK;
+
+  if (bx < 1 || by < 1 || bx >= BLOCK_MASK || by >= BLOCK_MASK || x >= sizeM - 1 || y >= sizeN - 1) {
+    gridMap::adjacent(x, y, i, out);
+    return;
+  }
+
+  // Inside a block - fixed offsets
+  const cellIndex offsets[8] = { -BLOCK_SIZE, BLOCK_SIZE, 1, -1,
+                                 1 - BLOCK_SIZE, BLOCK_SIZE + 1, -BLOCK_SIZE - 1, BLOCK_SIZE - 1 };
+  for (int d = 0; d < 8; d++)
+    out[d] = i + offsets[d];
+}
+
+// Implementation tiledMap
+
+tiledMap::tiledMap(int64_t sizeM, int64_t sizeN, float background) {
+  this->background = background;
+  resize(sizeM, sizeN);
+}
+
+void tiledMap::resize(int64_t sizeM, int64_t sizeN) {
+  this->sizeM = sizeM;
+  this->sizeN = sizeN;
+  tilesM = (sizeM + TILE_MASK) >> TILE_SHIFT;
+  tilesN = (sizeN + TILE_MASK) >> TILE_SHIFT;
+
+  tiles.clear();
+  tiles.resize(tilesM * tilesN);
+  for (auto& t : tiles)
+    t.uniform = background;
+}
+
+float tiledMap::get(int64_t x, int64_t y) {
+  auto& t = tileAt(x, y);
+
+  if (!t.cells)
+    return t.uniform;
+
+  return (*t.cells)(x & TILE_MASK, y & TILE_MASK);
+}
+
+void tiledMap::set(int64_t x, int64_t y, float w) {
+  auto& t = tileAt(x, y);
+
+  if (!t.cells) {
+    if (w == t.uniform)
+      return;
+
+    // First non-uniform write - allocate the tile
+    t.cells = std::make_unique<tileCells>();
+    t.cells->setConstant(t.uniform);
+  }
+
+  (*t.cells)(x & TILE_MASK, y & TILE_MASK) = w;
+}
+
+// Tiles fully inside the rectangle become uniform and drop their cells
+void tiledMap::fill(int64_t x0, int64_t y0, int64_t x1, int64_t y1, float w) {
+  for (int64_t tx = x0 >> TILE_SHIFT; tx <= x1 >> TILE_SHIFT; tx++) {
+    for (int64_t ty = y0 >> TILE_SHIFT; ty <= y1 >> TILE_SHIFT; ty++) {
+      auto& t = tiles[tx * tilesN + ty];
+      int64_t ax = std::max(x0, tx << TILE_SHIFT), bx = std::min(x1, (tx << TILE_SHIFT) + TILE_MASK);
+      int64_t ay = std::max(y0, ty << TILE_SHIFT), by = std::min(y1, (ty << TILE_SHIFT) + TILE_MASK);
+
+      if (bx - ax == TILE_MASK && by - ay == TILE_MASK) {
+        t.cells.reset();
+        t.uniform = w;
+        continue;
+      }
+
+      if (!t.cells) {
+        if (w == t.uniform)
+          continue;
+
+        t.cells = std::make_unique<tileCells>();
+        t.cells->setConstant(t.uniform);
+      }
+
+      t.cells->block(ax & TILE_MASK, ay & TILE_MASK, bx - ax + 1, by - ay + 1).setConstant(w);
+    }
+  }
+}
+
+cellIndex tiledMap::index(int64_t x, int64_t y) {
+  return ((((x >> TILE_SHIFT) * tilesN + (y >> TILE_SHIFT)) << (2 * TILE_SHIFT))
+          | ((x & TILE_MASK) << TILE_SHIFT) | (y & TILE_MASK));
+}
+
+void tiledMap::position(cellIndex i, int64_t& x, int64_t& y) {
+  cellIndex tile = i >> (2 * TILE_SHIFT);
+
+  x = ((tile / tilesN) << TILE_SHIFT) | ((i >> TILE_SHIFT) & TILE_MASK);
+  y = ((tile % tilesN) << TILE_SHIFT) | (i & TILE_MASK);
+}
+
+float tiledMap::at(cellIndex i) {
+  auto& t = tiles[i >> (2 * TILE_SHIFT)];
+
+  if (!t.cells)
+    return t.uniform;
+
+  return t.cells->data()[i & ((1 << (2 * TILE_SHIFT)) - 1)];
+}
+
+bool tiledMap::uniformTile(int64_t tx, int64_t ty, float& w) {
+  auto& t = tiles[tx * tilesN + ty];
+
+  if (t.cells)
+    return false;
+
+  w = t.uniform;
+  return true;
+}
+
+size_t tiledMap::compact() {
+  size_t released = 0;
+
+  for (auto& t : tiles) {
+    if (t.cells && (t.cells->array() == (*t.cells)(0, 0)).all()) {
+      t.uniform = (*t.cells)(0, 0);
+      t.cells.reset();
+      released++;
+    }
+  }
+
+  return released;
+}
+
+size_t tiledMap::allocatedTiles() {
+  return std::count_if(tiles.begin(), tiles.end(), [](const mapTile& t) { return (bool)t.cells; });
+}
+
+size_t tiledMap::memoryUsage() {
+  return tiles.size() * sizeof(mapTile) + allocatedTiles() * sizeof(tileCells);
+}
@@ -0,0 +1,159 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Per-destination heuristic tables - h for every cell of the map towards one goal, kept in a
+//   bounded cache shared by the searches of many threads
+
+#pragma once
+
+#include "gridmap.hpp"
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+// What a table holds - the configured heuristic, or the exact cost to the goal
+#define HEURISTIC_TABLE_NONE       0
+#define HEURISTIC_TABLE_GEOMETRIC  1
+#define HEURISTIC_TABLE_EXACT      2
+
+// Identifies a table. Geometric tables only depend on the size and layout of the map, exact
+//   ones also on its contents (version) and the agent radius
+struct heuristicKey {
+    int64_t goalX = 0, goalY = 0;
+    int mode = HEURISTIC_TABLE_NONE;
+    int heuristic = 0;
+    int64_t rows = 0, cols = 0;
+    int storage = 0;
+    uint64_t version = 0;
+    int radius = 0;
+
+    bool operator<(const heuristicKey& o) const {
+      return std::tie(goalX, goalY, mode, heuristic, rows, cols, storage, version, radius) <
+             std::tie(o.goalX, o.goalY, o.mode, o.heuristic, o.rows, o.cols, o.storage, o.version, o.radius);
+    }
+};
+
+// h of every cell in map storage order, infinite where the goal cannot be reached
+struct heuristicTable {
+    heuristicKey key;
+    std::vector<float> values;
+
+    float at(cellIndex i) const { return values[i]; }
+    size_t bytes() const { return values.size() * sizeof(float); }
+};
+
+struct heuristicCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t uncached = 0;       // Tables over the byte budget, never built
+
+    double hitRate() { return (hits + misses) ? (double)hits / (hits + misses) : 0.0; }
+};
+
+// Interface heuristicCache - the last capacity tables used, least recently used evicted first,
+//   and no more than budget bytes of them. A table is 4 bytes per cell, so a few large maps fill
+//   the budget long before the count does; a table larger than the whole budget is not built.
+//   Tables are immutable once built and handed out as shared pointers, so a search keeps its
+//   table even if it is evicted meanwhile. Builds run outside the lock; two threads missing on
+//   the same key both build and the first one in is kept
+class heuristicCache {
+    private:
+        typedef std::shared_ptr<const heuristicTable> entry;
+
+        std::mutex lock;
+        size_t capacity;
+        size_t budget;
+        size_t used = 0;
+
+        // Front is the most recently used table
+        std::list<entry> lru;
+        std::map<heuristicKey, std::list<entry>::iterator> byKey;
+
+        heuristicCacheStats stats;
+
+    public:
+        heuristicCache(size_t capacity = HEURISTIC_CACHE_SIZE, size_t budget = HEURISTIC_CACHE_BYTES)
+          : capacity(std::max<size_t>(capacity, 1)), budget(budget) {};
+
+        // Cached table, or one made by fill(values) for a map of cells, nullptr when fill fails or
+        //   the table would not fit the budget
+        template<class F>
+        entry get(const heuristicKey& key, size_t cells, F fill);
+
+        void clear();
+        size_t size();
+        size_t bytes();
+        heuristicCacheStats getStats();
+};
+
+// Implementation heuristicCache
+
+template<class F>
+std::shared_ptr<const heuristicTable> heuristicCache::get(const heuristicKey& key, size_t cells, F fill) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (cells * sizeof(float) > budget) {
+      stats.uncached++;
+      return nullptr;
+    }
+
+    auto it = byKey.find(key);
+
+    if (it != byKey.end()) {
+      stats.hits++;
+      lru.splice(lru.begin(), lru, it->second);
+      return *it->second;
+    }
+
+    stats.misses++;
+  }
+
+  auto table = std::make_shared<heuristicTable>();
+  table->key = key;
+  if (!fill(table->values))
+    return nullptr;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = byKey.find(key);
+
+  if (it != byKey.end())
+    return *it->second;
+
+  lru.push_front(table);
+  byKey[key] = lru.begin();
+  used += table->bytes();
+
+  while (lru.size() > capacity || used > budget) {
+    used -= lru.back()->bytes();
+    byKey.erase(lru.back()->key);
+    lru.pop_back();
+    stats.evictions++;
+  }
+
+  return table;
+}
+
+void heuristicCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  lru.clear();
+  byKey.clear();
+  used = 0;
+}
+
+size_t heuristicCache::size() {
+  std::lock_guard<std::mutex> guard(lock);
+  return lru.size();
+}
+
+size_t heuristicCache::bytes() {
+  std::lock_guard<std::mutex> guard(lock);
+  return used;
+}
+
+heuristicCacheStats heuristicCache::getStats() {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
+}
@@ -0,0 +1,392 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Query latency histograms - per thread, per query class, merged without locks when read
+
+#pragma once
+
+#include "utils.hpp"
+#include "perthread.hpp"
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+// Engines, the first part of a query class
+#define QUERY_ASTAR          0   // runAlgorithm()
+#define QUERY_MULTI_GOAL     1   // runAlgorithm(goals)
+#define QUERY_MULTI_SOURCE   2   // runAlgorithm(origins)
+#define QUERY_ANYTIME        3
+#define QUERY_ANY_ANGLE      4
+#define QUERY_ENGINES        5
+
+// Path length buckets - bucket k holds lengths in [4^k, 4^(k + 1)), failed queries are in 0
+#define QUERY_LENGTHS        8
+
+#define QUERY_CLASSES        (QUERY_ENGINES * 2 * QUERY_LENGTHS)
+
+// HDR-style buckets over nanoseconds - LATENCY_SUB linear steps per power of two, so any value
+//   is known to within 1 / LATENCY_SUB. Values above 2^LATENCY_MAX_SHIFT ns share the top bucket
+#define LATENCY_SUB_SHIFT    4
+#define LATENCY_SUB          (1 << LATENCY_SUB_SHIFT)
+#define LATENCY_MAX_SHIFT    40
+#define LATENCY_BUCKETS      ((LATENCY_MAX_SHIFT - LATENCY_SUB_SHIFT + 2) * LATENCY_SUB)
+
+// Slowest queries kept per class and thread, for finding them again
+#define LATENCY_EXEMPLARS    4
+
+#define LATENCY_TEXT         0
+#define LATENCY_JSON         1
+
+const char* const queryEngineNames[QUERY_ENGINES] = { "astar", "multi_goal", "multi_source", "anytime", "any_angle" };
+
+// One recorded query
+struct queryRecord {
+    int engine = QUERY_ASTAR;
+    bool found = false;
+    size_t length = 0;              // Cells (or turning points) in the path
+    uint64_t nanos = 0;
+    int64_t ox = 0, oy = 0, dx = 0, dy = 0;
+    size_t expansions = 0;
+};
+
+// Interface latencyHistogram - written by one thread, read by any; relaxed atomics only
+class latencyHistogram {
+    private:
+        std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+        std::atomic<uint64_t> total{0}, sum{0}, least{UINT64_MAX}, most{0};
+
+    public:
+        latencyHistogram() { for (auto& c : counts) c.store(0, std::memory_order_relaxed); }
+
+        static int bucket(uint64_t nanos);
+        static uint64_t upper(int bucket);
+
+        void record(uint64_t nanos);
+
+        // Add into plain counters, the merged view
+        void mergeInto(std::vector<uint64_t>& into, uint64_t& count, uint64_t& total, uint64_t& low, uint64_t& high);
+};
+
+// A slow query, guarded by a sequence number - odd while the owner writes it
+struct latencyExemplar {
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> nanos{0}, expansions{0}, when{0};
+    std::atomic<int64_t> ox{0}, oy{0}, dx{0}, dy{0};
+    std::atomic<uint32_t> length{0};
+};
+
+struct latencyClass {
+    latencyHistogram histogram;
+    latencyExemplar slowest[LATENCY_EXEMPLARS];
+    uint64_t kept[LATENCY_EXEMPLARS] = {};      // Owner's copy of the exemplar latencies
+};
+
+// Classes of one thread, allocated on first use and then only read by others
+struct latencyShard {
+    std::atomic<latencyClass*> classes[QUERY_CLASSES];
+    int thread = 0;
+
+    latencyShard() { for (auto& c : classes) c.store(nullptr, std::memory_order_relaxed); }
+    ~latencyShard() { for (auto& c : classes) delete c.load(); }
+};
+
+// Interface latencyRecorder - one shard per recording thread. record() touches only the
+//   caller's shard; dump() sums every shard's counters as they are, with no lock held against
+//   the writers. A dump holds, per class, count, mean, percentiles and the slowest queries
+class latencyRecorder {
+    private:
+        std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+        perThread<latencyShard> shards;
+
+        std::thread dumper;
+        std::mutex dumperLock;
+        std::condition_variable dumperWake;
+        bool dumping = false;
+
+        latencyShard& local();
+        static int classOf(int engine, bool found, size_t length);
+
+    public:
+        latencyRecorder() {}
+        ~latencyRecorder() { stopDumping(); }
+        latencyRecorder(const latencyRecorder&) = delete;
+        latencyRecorder& operator=(const latencyRecorder&) = delete;
+
+        void record(const queryRecord& query);
+
+        // LATENCY_TEXT or LATENCY_JSON
+        std::string report(int format = LATENCY_TEXT);
+        int dump(const std::string& path, int format = LATENCY_TEXT);
+
+        // Rewrite the file every interval from a background thread, and once more on stop
+        void startDumping(const std::string& path, std::chrono::milliseconds interval, int format = LATENCY_TEXT);
+        void stopDumping();
+};
+
+// Implementation latencyHistogram
+
+int latencyHistogram::bucket(uint64_t nanos) {
+  if (nanos < LATENCY_SUB)
+    return nanos;
+
+  int shift = 63 - __builtin_clzll(nanos) - LATENCY_SUB_SHIFT;
+  if (shift > LATENCY_MAX_SHIFT - LATENCY_SUB_SHIFT)
+    return LATENCY_BUCKETS - 1;
+
+  return (shift + 1) * LATENCY_SUB + (int)((nanos >> shift) - LATENCY_SUB);
+}
+
+// Highest value that falls in the bucket
+uint64_t latencyHistogram::upper(int bucket) {
+  if (bucket < LATENCY_SUB)
+    return bucket;
+
+  int shift = bucket / LATENCY_SUB - 1;
+  return ((uint64_t)(LATENCY_SUB + bucket % LATENCY_SUB + 1) << shift) - 1;
+}
+
+void latencyHistogram::record(uint64_t nanos) {
+  auto& c = counts[bucket(nanos)];
+
+  // Single writer, so load and store instead of read-modify-write
+  c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  sum.store(sum.load(std::memory_order_relaxed) + nanos, std::memory_order_relaxed);
+
+  if (nanos < least.load(std::memory_order_relaxed))
+    least.store(nanos, std::memory_order_relaxed);
+  if (nanos > most.load(std::memory_order_relaxed))
+    most.store(nanos, std::memory_order_relaxed);
+}
+
+void latencyHistogram::mergeInto(std::vector<uint64_t>& into, uint64_t& count, uint64_t& total,
+                                 uint64_t& low, uint64_t& high) {
+  for (int b = 0; b < LATENCY_BUCKETS; b++)
+    into[b] += counts[b].load(std::memory_order_relaxed);
+
+  count += this->total.load(std::memory_order_relaxed);
+  total += sum.load(std::memory_order_relaxed);
+  low = std::min(low, least.load(std::memory_order_relaxed));
+  high = std::max(high, most.load(std::memory_order_relaxed));
+}
+
+// Implementation latencyRecorder
+
+latencyShard& latencyRecorder::local() {
+  return shards.local([](size_t thread) {
+    auto shard = std::make_shared<latencyShard>();
+    shard->thread = thread;
+    return shard;
+  });
+}
+
+int latencyRecorder::classOf(int engine, bool found, size_t length) {
+  int lengthBucket = 0;
+  while (found && lengthBucket + 1 < QUERY_LENGTHS && length >= ((size_t)1 << (2 * (lengthBucket + 1))))
+    lengthBucket++;
+
+  return (std::min(std::max(engine, 0), QUERY_ENGINES - 1) * 2 + (found ? 1 : 0)) * QUERY_LENGTHS + lengthBucket;
+}
+
+void latencyRecorder::record(const queryRecord& query) {
+  latencyShard& shard = local();
+  auto& slot = shard.classes[classOf(query.engine, query.found, query.length)];
+
+  latencyClass* c = slot.load(std::memory_order_acquire);
+  if (!c) {
+    c = new latencyClass();
+    slot.store(c, std::memory_order_release);
+  }
+
+  c->histogram.record(query.nanos);
+
+  // Replace the fastest of the kept exemplars if this one is slower
+  int k = std::min_element(c->kept, c->kept + LATENCY_EXEMPLARS) - c->kept;
+  if (query.nanos <= c->kept[k])
+    return;
+
+  c->kept[k] = query.nanos;
+  auto& e = c->slowest[k];
+  uint32_t s = e.sequence.load(std::memory_order_relaxed);
+
+  e.sequence.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  e.nanos.store(query.nanos, std::memory_order_relaxed);
+  e.expansions.store(query.expansions, std::memory_order_relaxed);
+  e.when.store(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - created).count(),
+               std::memory_order_relaxed);
+  e.ox.store(query.ox, std::memory_order_relaxed);
+  e.oy.store(query.oy, std::memory_order_relaxed);
+  e.dx.store(query.dx, std::memory_order_relaxed);
+  e.dy.store(query.dy, std::memory_order_relaxed);
+  e.length.store(query.length, std::memory_order_relaxed);
+  e.sequence.store(s + 2, std::memory_order_release);
+}
+
+std::string latencyRecorder::report(int format) {
+  struct slowQuery {
+    uint64_t nanos, expansions, when;
+    int64_t ox, oy, dx, dy;
+    uint32_t length;
+    int thread;
+  };
+
+  auto all = shards.all();
+
+  std::ostringstream out;
+  bool first = true;
+  auto micros = [](uint64_t nanos) { return nanos / 1000.0; };
+
+  if (format == LATENCY_JSON)
+    out << "{\"classes\":[";
+  else
+    out << std::left << std::setw(14) << "engine" << std::setw(7) << "found" << std::setw(13) << "length"
+        << std::right << std::setw(10) << "count" << std::setw(11) << "mean us" << std::setw(11) << "p50 us"
+        << std::setw(11) << "p90 us" << std::setw(11) << "p99 us" << std::setw(11) << "p999 us"
+        << std::setw(11) << "max us" << "\n";
+
+  out << std::fixed << std::setprecision(1);
+
+  for (int k = 0; k < QUERY_CLASSES; k++) {
+    std::vector<uint64_t> counts(LATENCY_BUCKETS, 0);
+    std::vector<slowQuery> slow;
+    uint64_t count = 0, total = 0, low = UINT64_MAX, high = 0;
+
+    for (auto& shard : all) {
+      latencyClass* c = shard->classes[k].load(std::memory_order_acquire);
+      if (!c)
+        continue;
+
+      c->histogram.mergeInto(counts, count, total, low, high);
+
+      // A copy is taken only if the owner did not touch the slot meanwhile
+      for (auto& e : c->slowest) {
+        for (int attempt = 0; attempt < 4; attempt++) {
+          uint32_t before = e.sequence.load(std::memory_order_acquire);
+          if (before & 1)
+            continue;
+
+          slowQuery q = { e.nanos.load(std::memory_order_relaxed), e.expansions.load(std::memory_order_relaxed),
+                          e.when.load(std::memory_order_relaxed), e.ox.load(std::memory_order_relaxed),
+                          e.oy.load(std::memory_order_relaxed), e.dx.load(std::memory_order_relaxed),
+                          e.dy.load(std::memory_order_relaxed), e.length.load(std::memory_order_relaxed),
+                          shard->thread };
+          std::atomic_thread_fence(std::memory_order_acquire);
+
+          if (e.sequence.load(std::memory_order_relaxed) == before) {
+            if (before > 0)
+              slow.push_back(q);
+            break;
+          }
+        }
+      }
+    }
+
+    if (count == 0)
+      continue;
+
+    std::sort(slow.begin(), slow.end(), [](const slowQuery& a, const slowQuery& b) { return a.nanos > b.nanos; });
+    slow.resize(std::min<size_t>(slow.size(), LATENCY_EXEMPLARS));
+
+    auto percentile = [&](double q) {
+      uint64_t rank = (uint64_t)std::ceil(q * count), seen = 0;
+      for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= std::max<uint64_t>(rank, 1))
+          return std::min(latencyHistogram::upper(b), high);
+      }
+      return high;
+    };
+
+    int engine = k / (2 * QUERY_LENGTHS), lengthBucket = k % QUERY_LENGTHS;
+    bool found = (k / QUERY_LENGTHS) % 2;
+
+    std::string lengths = found ? std::to_string(1ull << (2 * lengthBucket)) + "-" +
+                                  ((lengthBucket + 1 < QUERY_LENGTHS) ? std::to_string((1ull << (2 * lengthBucket + 2)) - 1) : "")
+                                : "-";
+
+    if (format == LATENCY_JSON) {
+      out << (first ? "" : ",") << "{\"engine\":\"" << queryEngineNames[engine] << "\",\"found\":"
+          << (found ? "true" : "false") << ",\"length\":\"" << lengths << "\",\"count\":" << count
+          << ",\"mean_us\":" << micros(total / count) << ",\"min_us\":" << micros(low)
+          << ",\"p50_us\":" << micros(percentile(0.5)) << ",\"p90_us\":" << micros(percentile(0.9))
+          << ",\"p99_us\":" << micros(percentile(0.99)) << ",\"p999_us\":" << micros(percentile(0.999))
+          << ",\"max_us\":" << micros(high) << ",\"slowest\":[";
+
+      for (size_t s = 0; s < slow.size(); s++)
+        out << (s ? "," : "") << "{\"us\":" << micros(slow[s].nanos) << ",\"origin\":[" << slow[s].ox << ","
+            << slow[s].oy << "],\"destination\":[" << slow[s].dx << "," << slow[s].dy << "],\"length\":"
+            << slow[s].length << ",\"expansions\":" << slow[s].expansions << ",\"thread\":" << slow[s].thread
+            << ",\"at_ms\":" << slow[s].when << "}";
+
+      out << "]}";
+    }
+    else {
+      out << std::left << std::setw(14) << queryEngineNames[engine] << std::setw(7) << (found ? "yes" : "no")
+          << std::setw(13) << lengths << std::right << std::setw(10) << count << std::setw(11) << micros(total / count)
+          << std::setw(11) << micros(percentile(0.5)) << std::setw(11) << micros(percentile(0.9))
+          << std::setw(11) << micros(percentile(0.99)) << std::setw(11) << micros(percentile(0.999))
+          << std::setw(11) << micros(high) << "\n";
+
+      for (auto& q : slow)
+        out << "    " << micros(q.nanos) << " us  (" << q.ox << ", " << q.oy << ") -> (" << q.dx << ", " << q.dy
+            << ")  length " << q.length << ", " << q.expansions << " expansions, thread " << q.thread << ", at "
+            << q.when << " ms\n";
+    }
+
+    first = false;
+  }
+
+  if (format == LATENCY_JSON)
+    out << "]}\n";
+
+  return out.str();
+}
+
+// Written beside the target and renamed over it, so readers never see half a dump
+int latencyRecorder::dump(const std::string& path, int format) {
+  std::string temporary = path + ".tmp";
+  std::ofstream file(temporary, std::ios::trunc);
+
+  if (!file)
+    return EXIT_FAILURE;
+
+  file << report(format);
+  file.close();
+
+  if (!file || std::rename(temporary.c_str(), path.c_str()) != 0)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+void latencyRecorder::startDumping(const std::string& path, std::chrono::milliseconds interval, int format) {
+  stopDumping();
+
+  dumping = true;
+  dumper = std::thread([this, path, interval, format]() {
+    std::unique_lock<std::mutex> guard(dumperLock);
+
+    while (dumping) {
+      dumperWake.wait_for(guard, interval, [&]() { return !dumping; });
+      dump(path, format);
+    }
+  });
+}
+
+void latencyRecorder::stopDumping() {
+  {
+    std::lock_guard<std::mutex> guard(dumperLock);
+    if (!dumping)
+      return;
+    dumping = false;
+  }
+
+  dumperWake.notify_all();
+  dumper.join();
+}
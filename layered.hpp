@@ -0,0 +1,248 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Multi-floor maps - 2D layers, each in its own gridMap layout, joined by portals
+//   (stairs, lifts) with their own traversal cost
+
+#pragma once
+
+#include "graph.hpp"
+
+struct layerPortal {
+    int fromLayer;
+    cellIndex from;     // Layer storage index
+    int toLayer;
+    cellIndex to;
+    float cost;
+};
+
+// Interface layeredGraph - a Graph over every layer. Vertex = layer base + cell index, links
+//   0-7 are Directions inside a layer, 8 + k arrived through portal k.
+//   distance(v, goal) is the cheapest of walking to the goal on its floor or to a portal
+//   and on from there, with the portal-to-goal bounds computed once per goal. Floors with no
+//   portal route to the goal get an infinite bound and are never entered
+class layeredGraph {
+    private:
+        std::vector<std::unique_ptr<gridMap>> layers;
+        std::vector<cellIndex> base;                    // First vertex of each layer, plus the end
+
+        std::vector<layerPortal> portals;
+        std::unordered_map<cellIndex, std::vector<uint32_t>> portalsAt;   // Vertex -> portals leaving it
+        std::vector<std::vector<uint32_t>> portalsFrom;                 // Layer -> portals leaving it
+
+        // Lower bound from each portal's entry to the prepared goal, and per layer if finite
+        cellIndex boundGoal = INEXISTENT;
+        std::vector<float> portalBound;
+        std::vector<bool> layerReaches;
+
+        float planar(int layer, cellIndex a, int64_t bx, int64_t by);
+        void prepare(cellIndex goal);
+
+    public:
+        typedef uint32_t link;
+        static constexpr link noLink = 0xFFFFFFFF;
+
+        layeredGraph() : base(1, 0) {};
+
+        // Layers keep their own size and layout, add them before any portal
+        int addLayer(std::unique_ptr<gridMap> map);
+        gridMap& getLayer(int layer) { return *layers[layer]; }
+        size_t layerCount() { return layers.size(); }
+
+        // Portal cost is paid as is, the cell reached is not charged again
+        int addPortal(int fromLayer, int64_t fx, int64_t fy, int toLayer, int64_t tx, int64_t ty, float cost,
+                      bool bothWays = true);
+        size_t portalCount() { return portals.size(); }
+
+        cellIndex vertex(int layer, int64_t x, int64_t y) { return base[layer] + layers[layer]->index(x, y); }
+        void position(cellIndex v, int& layer, int64_t& x, int64_t& y);
+        int layerOf(cellIndex v) { return std::upper_bound(base.begin(), base.end(), v) - base.begin() - 1; }
+
+        // Graph
+        int64_t vertexCount() { return base.back(); }
+
+        template<class F>
+        void forEachEdge(cellIndex v, link parent, F f);
+        cellIndex follow(cellIndex v, link l);
+
+        // Bounds are cached for the last goal, so one goal at a time per graph
+        float distance(cellIndex a, cellIndex b);
+};
+
+// Implementation layeredGraph
+
+int layeredGraph::addLayer(std::unique_ptr<gridMap> map) {
+  if (!map || !portals.empty())
+    return INEXISTENT;
+
+  base.push_back(base.back() + map->indexSpace());
+  layers.push_back(std::move(map));
+  portalsFrom.emplace_back();
+  boundGoal = INEXISTENT;
+
+  return layers.size() - 1;
+}
+
+int layeredGraph::addPortal(int fromLayer, int64_t fx, int64_t fy, int toLayer, int64_t tx, int64_t ty, float cost,
+                            bool bothWays) {
+  if (fromLayer < 0 || fromLayer >= (int)layers.size() || toLayer < 0 || toLayer >= (int)layers.size() || !(cost >= 0.0f))
+    return EXIT_FAILURE;
+
+  auto& a = *layers[fromLayer];
+  auto& b = *layers[toLayer];
+  if (fx < 0 || fy < 0 || fx >= a.rows() || fy >= a.cols() || tx < 0 || ty < 0 || tx >= b.rows() || ty >= b.cols())
+    return EXIT_FAILURE;
+
+  for (int k = 0; k < (bothWays ? 2 : 1); k++) {
+    layerPortal p = (k == 0) ? layerPortal{ fromLayer, a.index(fx, fy), toLayer, b.index(tx, ty), cost }
+                             : layerPortal{ toLayer, b.index(tx, ty), fromLayer, a.index(fx, fy), cost };
+
+    portalsAt[base[p.fromLayer] + p.from].push_back(portals.size());
+    portalsFrom[p.fromLayer].push_back(portals.size());
+    portals.push_back(p);
+  }
+
+  boundGoal = INEXISTENT;
+  return EXIT_SUCCESS;
+}
+
+void layeredGraph::position(cellIndex v, int& layer, int64_t& x, int64_t& y) {
+  layer = layerOf(v);
+  layers[layer]->position(v - base[layer], x, y);
+}
+
+template<class F>
+void layeredGraph::forEachEdge(cellIndex v, link parent, F f) {
+  cellIndex adjacent[8];
+  int64_t x, y;
+  int layer = layerOf(v);
+  auto& map = *layers[layer];
+  cellIndex i = v - base[layer];
+
+  map.position(i, x, y);
+  if (parent < 8)
+    map.prefetch(x, y, adjacentDelta[parent][0], adjacentDelta[parent][1]);
+
+  map.adjacent(x, y, i, adjacent);
+
+  for (auto DIR : dirList) {
+    cellIndex to = adjacent[DIR];
+    if (to == INEXISTENT)
+      continue;
+
+    float w = map.at(to);
+    if (w != INACCESSIBLE)
+      f(base[layer] + to, COST * (int)w, (link)DIR);
+  }
+
+  if (portalsAt.empty())
+    return;
+
+  auto it = portalsAt.find(v);
+  if (it == portalsAt.end())
+    return;
+
+  for (auto k : it->second) {
+    auto& p = portals[k];
+    if (layers[p.toLayer]->at(p.to) != INACCESSIBLE)
+      f(base[p.toLayer] + p.to, p.cost, (link)(8 + k));
+  }
+}
+
+cellIndex layeredGraph::follow(cellIndex v, link l) {
+  if (l >= 8)
+    return base[portals[l - 8].fromLayer] + portals[l - 8].from;
+
+  cellIndex adjacent[8];
+  int64_t x, y;
+  int layer = layerOf(v);
+
+  layers[layer]->position(v - base[layer], x, y);
+  layers[layer]->adjacent(x, y, v - base[layer], adjacent);
+  return base[layer] + adjacent[oppositeDir[l]];
+}
+
+// Chebyshev lower bound inside one layer
+float layeredGraph::planar(int layer, cellIndex a, int64_t bx, int64_t by) {
+  int64_t ax, ay;
+
+  layers[layer]->position(a, ax, ay);
+  return COST * MIN_WEIGHT * std::max(std::abs(ax - bx), std::abs(ay - by));
+}
+
+// Dijkstra over portals, backwards from the goal. A portal's bound is its cost plus the
+//   cheapest of walking from where it lands to the goal or to another portal's entry
+void layeredGraph::prepare(cellIndex goal) {
+  typedef std::pair<float, uint32_t> entry; // bound, portal
+
+  std::priority_queue<entry, std::vector<entry>, std::greater<entry>> openList;
+  int goalLayer;
+  int64_t gx, gy;
+
+  position(goal, goalLayer, gx, gy);
+  boundGoal = goal;
+  portalBound.assign(portals.size(), std::numeric_limits<float>::infinity());
+  layerReaches.assign(layers.size(), false);
+  layerReaches[goalLayer] = true;
+
+  for (uint32_t k = 0; k < portals.size(); k++)
+    if (portals[k].toLayer == goalLayer) {
+      portalBound[k] = portals[k].cost + planar(goalLayer, portals[k].to, gx, gy);
+      openList.push(entry(portalBound[k], k));
+    }
+
+  while (!openList.empty()) {
+    auto top = openList.top();
+    openList.pop();
+
+    if (top.first != portalBound[top.second])
+      continue;
+
+    auto& q = portals[top.second];
+    layerReaches[q.fromLayer] = true;
+
+    int64_t qx, qy;
+    layers[q.fromLayer]->position(q.from, qx, qy);
+
+    // Portals landing on q's layer can walk to q
+    for (uint32_t k = 0; k < portals.size(); k++) {
+      if (portals[k].toLayer != q.fromLayer)
+        continue;
+
+      float d = portals[k].cost + planar(q.fromLayer, portals[k].to, qx, qy) + top.first;
+      if (d < portalBound[k]) {
+        portalBound[k] = d;
+        openList.push(entry(d, k));
+      }
+    }
+  }
+}
+
+float layeredGraph::distance(cellIndex a, cellIndex b) {
+  if (b != boundGoal)
+    prepare(b);
+
+  int layer = layerOf(a), goalLayer = layerOf(b);
+  float best = std::numeric_limits<float>::infinity();
+
+  if (!layerReaches[layer])
+    return best;
+
+  cellIndex i = a - base[layer];
+  int64_t x, y;
+
+  if (layer == goalLayer) {
+    layers[goalLayer]->position(b - base[goalLayer], x, y);
+    best = planar(layer, i, x, y);
+  }
+
+  for (auto k : portalsFrom[layer]) {
+    if (portalBound[k] >= best)
+      continue;
+
+    layers[layer]->position(portals[k].from, x, y);
+    best = std::min(best, planar(layer, i, x, y) + portalBound[k]);
+  }
+
+  return best;
+}
@@ -0,0 +1,173 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Line of sight over bit-packed obstacle masks, 64 cells per word
+
+#pragma once
+
+#include "gridmap.hpp"
+#include "clearance.hpp"
+
+// Interface sightMap - blocked and heavy (weight above MIN_WEIGHT) cells as bitboards, once
+//   row by row and once column by column. A segment between cell centres is tested on every
+//   cell whose inside it crosses: per row (or per column, whichever is fewer) those cells form
+//   one run, checked a word at a time
+class sightMap {
+    private:
+        int64_t rows = 0, cols = 0;
+        int64_t rowWords = 0, colWords = 0;
+        int radius = 0;
+        bool built = false;
+
+        std::vector<uint64_t> blockedRows, blockedCols;     // Bit y of row x, bit x of column y
+        std::vector<uint64_t> heavyRows, heavyCols;
+
+        void mark(std::vector<uint64_t>& byRow, std::vector<uint64_t>& byCol, int64_t x, int64_t y, bool on);
+        static bool runClear(const uint64_t* bits, int64_t a, int64_t b);
+        bool sweep(int64_t x0, int64_t y0, int64_t x1, int64_t y1, bool heavy);
+
+    public:
+        // Cells the agent of this radius does not fit on count as blocked, false when the map
+        //   is larger than COMPONENT_LIMIT
+        bool build(gridMap& map, clearanceMap* clearance = nullptr, int radius = 0);
+        void invalidate() { built = false; blockedRows.clear(); blockedCols.clear(); heavyRows.clear(); heavyCols.clear(); }
+        bool isBuilt() { return built; }
+        int getRadius() { return radius; }
+
+        // Keep the masks current for radius 0, call after the cell at (x, y) changed
+        void cellChanged(int64_t x, int64_t y, float w);
+
+        // Heavy masks only, for weight edits that leave the cell accessible under a radius
+        void weightChanged(int64_t x, int64_t y, float w);
+
+        // No blocked cell touched by the segment
+        bool visible(int64_t x0, int64_t y0, int64_t x1, int64_t y1) { return sweep(x0, y0, x1, y1, false); }
+
+        // Neither blocked nor heavy cells touched - the segment costs MIN_WEIGHT per step
+        bool uniform(int64_t x0, int64_t y0, int64_t x1, int64_t y1) { return sweep(x0, y0, x1, y1, true); }
+};
+
+// Implementation sightMap
+
+bool sightMap::build(gridMap& map, clearanceMap* clearance, int radius) {
+  built = false;
+
+  if (map.rows() * map.cols() > COMPONENT_LIMIT)
+    return false;
+
+  rows = map.rows();
+  cols = map.cols();
+  rowWords = (cols + 63) >> 6;
+  colWords = (rows + 63) >> 6;
+  this->radius = radius;
+
+  blockedRows.assign(rows * rowWords, 0);
+  heavyRows.assign(rows * rowWords, 0);
+  blockedCols.assign(cols * colWords, 0);
+  heavyCols.assign(cols * colWords, 0);
+
+  for (int64_t y = 0; y < cols; y++)
+    for (int64_t x = 0; x < rows; x++) {
+      float w = map.get(x, y);
+      bool blocked = (w == INACCESSIBLE) || (clearance && radius > 0 && !clearance->fits(map.index(x, y), radius));
+
+      if (blocked)
+        mark(blockedRows, blockedCols, x, y, true);
+      else if ((int)w != (int)MIN_WEIGHT)
+        mark(heavyRows, heavyCols, x, y, true);
+    }
+
+  built = true;
+  return true;
+}
+
+void sightMap::mark(std::vector<uint64_t>& byRow, std::vector<uint64_t>& byCol, int64_t x, int64_t y, bool on) {
+  uint64_t& r = byRow[x * rowWords + (y >> 6)];
+  uint64_t& c = byCol[y * colWords + (x >> 6)];
+
+  if (on) {
+    r |= 1ull << (y & 63);
+    c |= 1ull << (x & 63);
+  }
+  else {
+    r &= ~(1ull << (y & 63));
+    c &= ~(1ull << (x & 63));
+  }
+}
+
+void sightMap::cellChanged(int64_t x, int64_t y, float w) {
+  if (!built)
+    return;
+
+  mark(blockedRows, blockedCols, x, y, w == INACCESSIBLE);
+  mark(heavyRows, heavyCols, x, y, w != INACCESSIBLE && (int)w != (int)MIN_WEIGHT);
+}
+
+void sightMap::weightChanged(int64_t x, int64_t y, float w) {
+  if (!built)
+    return;
+
+  mark(heavyRows, heavyCols, x, y, w != INACCESSIBLE && (int)w != (int)MIN_WEIGHT);
+}
+
+// Bits [a, b] of a row all zero
+bool sightMap::runClear(const uint64_t* bits, int64_t a, int64_t b) {
+  int64_t wa = a >> 6, wb = b >> 6;
+  uint64_t first = ~0ull << (a & 63);
+  uint64_t last = ~0ull >> (63 - (b & 63));
+
+  if (wa == wb)
+    return (bits[wa] & first & last) == 0;
+
+  if (bits[wa] & first)
+    return false;
+
+  for (int64_t k = wa + 1; k < wb; k++)
+    if (bits[k])
+      return false;
+
+  return (bits[wb] & last) == 0;
+}
+
+// Walks the axis with fewer steps. Along it, lane u covers [u - 0.5, u + 0.5] and the segment
+//   crosses the other axis over [lo, hi] there; the cells are those whose open square meets it
+bool sightMap::sweep(int64_t x0, int64_t y0, int64_t x1, int64_t y1, bool heavy) {
+  bool byRow = std::abs(x1 - x0) <= std::abs(y1 - y0);
+
+  // u - lanes, v - cells within a lane
+  int64_t u0 = byRow ? x0 : y0, v0 = byRow ? y0 : x0, u1 = byRow ? x1 : y1, v1 = byRow ? y1 : x1;
+  const auto& blocked = byRow ? blockedRows : blockedCols;
+  const auto& heavyBits = byRow ? heavyRows : heavyCols;
+  int64_t words = byRow ? rowWords : colWords;
+
+  if (u0 > u1) {
+    std::swap(u0, u1);
+    std::swap(v0, v1);
+  }
+
+  double slope = (u1 == u0) ? 0.0 : (double)(v1 - v0) / (u1 - u0);
+  int64_t vMin = std::min(v0, v1), vMax = std::max(v0, v1);
+
+  for (int64_t u = u0; u <= u1; u++) {
+    int64_t a = vMin, b = vMax;
+
+    if (u1 != u0) {
+      double enter = v0 + slope * (std::max(u - 0.5, (double)u0) - u0);
+      double leave = v0 + slope * (std::min(u + 0.5, (double)u1) - u0);
+
+      // Only the inside of a cell counts, passing a corner is allowed as for diagonal steps
+      a = std::max(vMin, (int64_t)std::ceil(std::min(enter, leave) - 0.5 + 1e-9));
+      b = std::min(vMax, (int64_t)std::floor(std::max(enter, leave) + 0.5 - 1e-9));
+    }
+
+    if (a > b)
+      continue;
+
+    if (!runClear(&blocked[u * words], a, b))
+      return false;
+    if (heavy && !runClear(&heavyBits[u * words], a, b))
+      return false;
+  }
+
+  return true;
+}
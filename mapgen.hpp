@@ -0,0 +1,438 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Procedural benchmark maps - open fields, obstacle densities, mazes, rooms and doors, weighted
+//   terrain and islands, with scenario sets. A map depends only on the seed and its spec: cells
+//   are hashed from their position in integer arithmetic, and the sequential choices use
+//   std::mt19937_64 with no std distributions, so every platform builds the same corpus
+
+#pragma once
+
+#include "mapio.hpp"
+#include <random>
+
+// Map kinds, and what mapSpec::param means for each
+#define MAPGEN_OPEN         0   // Unused
+#define MAPGEN_DENSITY      1   // Percentage of inaccessible cells
+#define MAPGEN_MAZE         2   // Corridor width
+#define MAPGEN_ROOMS        3   // Room side, rooms joined by doors MAPGEN_DOOR wide
+#define MAPGEN_NOISE        4   // Feature size of the weights, which span MIN_WEIGHT to MAX_WEIGHT
+#define MAPGEN_ISLANDS      5   // Islands per side, separated by inaccessible water
+#define MAPGEN_KINDS        6
+
+#define MAPGEN_SEED         1
+#define MAPGEN_BAND         256         // Rows written per setBlock
+#define MAPGEN_DOOR         2
+#define MAPGEN_EXTRA_DOORS  8           // One room wall in this many gets a door off the spanning tree
+#define MAPGEN_UNREACHABLE  4           // One island scenario in this many targets another island
+#define MAPGEN_SOLVE_LIMIT  (1 << 20)   // Cells up to which scenario costs are searched
+#define MAPGEN_FILL_LIMIT   (1 << 24)   // Cells a fill visits before it takes the pair as connected
+
+// Fixed point fractions
+#define MAPGEN_ONE          65536
+
+const char* const mapgenKindNames[MAPGEN_KINDS] = { "open", "density", "maze", "rooms", "noise", "islands" };
+
+// Square maps, named kind-param-size (kind-size for open fields)
+struct mapSpec {
+    int kind = MAPGEN_OPEN;
+    int64_t size = 64;
+    int param = 0;
+
+    std::string name() const;
+    uint64_t key() const;
+};
+
+// Interface mapGenerator
+class mapGenerator {
+    private:
+        uint64_t seed;
+
+        // Mazes and rooms - a grid of square cells side wide with one-cell walls between them,
+        //   state holds the walls opened towards +x and +y. Doors narrower than the side sit at
+        //   an offset along their wall
+        struct cellGrid {
+            int64_t n = 0, side = 1, door = 1;
+            std::vector<uint8_t> state;
+            std::vector<uint16_t> southDoor, eastDoor;
+        };
+
+        static uint64_t mix(uint64_t v);
+        uint64_t hash(uint64_t key, int64_t x, int64_t y);
+
+        // Value noise in fixed point, 0 to MAPGEN_ONE - 1
+        int64_t noise(uint64_t key, int64_t x, int64_t y, int64_t scale, int octaves);
+
+        void carve(const mapSpec& spec, cellGrid& g);
+        float gridCell(const cellGrid& g, int64_t x, int64_t y);
+        float islandCell(const mapSpec& spec, uint64_t key, int64_t x, int64_t y);
+
+        // Reachability on maps too large for component labels - a fill from one end that runs
+        //   out before MAPGEN_FILL_LIMIT cells settles it, a larger area counts as connected
+        static bool fillReaches(gridMap& map, const coords& from, const coords& to, std::vector<uint64_t>& seen);
+
+    public:
+        mapGenerator(uint64_t seed = MAPGEN_SEED) : seed(seed) {};
+        uint64_t getSeed() { return seed; }
+
+        // Resizes the world and writes the map in bands of rows
+        int generate(const mapSpec& spec, aStar& world, int storage = DENSE_STORAGE);
+
+        // Random passable pairs in one component; on island maps one in MAPGEN_UNREACHABLE pairs
+        //   is split across islands and gets optimal -1. Above COMPONENT_LIMIT cells components
+        //   come from fillReaches, exact for islands of the suite's sizes. Costs are searched up to
+        //   MAPGEN_SOLVE_LIMIT cells and left at 0 above. Buckets are optimal / 4, or the
+        //   Chebyshev distance / 4 when the cost was not searched. Moves the world's origin and
+        //   destination
+        void scenarios(const mapSpec& spec, aStar& world, size_t count, std::vector<scenarioEntry>& entries);
+
+        // dir/name.map and dir/name.map.scen; weighted maps also as dir/name.tiles, since the
+        //   Moving AI format only keeps passability
+        int save(const std::string& dir, const mapSpec& spec, aStar& world, const std::vector<scenarioEntry>& entries);
+
+        // Cell weights in row order, equal across runs and machines for equal seeds
+        static uint64_t checksum(aStar& world);
+
+        // Every kind at each power of four from minSize to maxSize - open fields, densities of 10
+        //   to 40 %, corridors 1, 4 and 16 wide, rooms of size / 16, terrain with features of
+        //   size / 16 and 4 x 4 islands
+        static std::vector<mapSpec> suite(int64_t minSize = 64, int64_t maxSize = 16384);
+};
+
+// Implementation mapSpec
+
+std::string mapSpec::name() const {
+  std::string kindName = (kind >= 0 && kind < MAPGEN_KINDS) ? mapgenKindNames[kind] : "unknown";
+
+  if (kind == MAPGEN_OPEN)
+    return kindName + "-" + std::to_string(size);
+  return kindName + "-" + std::to_string(param) + "-" + std::to_string(size);
+}
+
+// FNV-1a of the name
+uint64_t mapSpec::key() const {
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  for (unsigned char c : name())
+    h = (h ^ c) * 0x100000001b3ull;
+  return h;
+}
+
+// Implementation mapGenerator
+
+// splitmix64 finalizer
+uint64_t mapGenerator::mix(uint64_t v) {
+  v += 0x9e3779b97f4a7c15ull;
+  v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+  v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+  return v ^ (v >> 31);
+}
+
+uint64_t mapGenerator::hash(uint64_t key, int64_t x, int64_t y) {
+  return mix(mix(mix(seed ^ key) ^ (uint64_t)x) ^ (uint64_t)y);
+}
+
+int64_t mapGenerator::noise(uint64_t key, int64_t x, int64_t y, int64_t scale, int octaves) {
+  int64_t value = 0, total = 0, amplitude = 1 << octaves;
+
+  auto lerp = [](int64_t a, int64_t b, int64_t t) { return a + (b - a) * t / MAPGEN_ONE; };
+  auto smooth = [](int64_t f) { return (f * f / MAPGEN_ONE) * (3 * MAPGEN_ONE - 2 * f) / MAPGEN_ONE; };
+
+  for (int o = 0; o < octaves && scale >= 1; o++, scale /= 2, amplitude /= 2) {
+    int64_t gx = x / scale, gy = y / scale;
+    int64_t fx = smooth((x % scale) * MAPGEN_ONE / scale), fy = smooth((y % scale) * MAPGEN_ONE / scale);
+
+    // Lattice values in 16 bits
+    int64_t a = hash(key + o, gx, gy) >> 48, b = hash(key + o, gx + 1, gy) >> 48;
+    int64_t c = hash(key + o, gx, gy + 1) >> 48, d = hash(key + o, gx + 1, gy + 1) >> 48;
+
+    value += amplitude * lerp(lerp(a, b, fx), lerp(c, d, fx), fy);
+    total += amplitude;
+  }
+
+  return total ? value / total : 0;
+}
+
+// Randomized depth-first spanning tree over the cells. The low bits of a cell's state hold the
+//   direction back to its parent (1 to 4, 5 for the root, 0 while unvisited)
+void mapGenerator::carve(const mapSpec& spec, cellGrid& g) {
+  const int64_t dx[4] = { 1, -1, 0, 0 }, dy[4] = { 0, 0, 1, -1 };
+  const uint8_t opened[2] = { 8, 16 };        // Wall towards +x, towards +y
+  std::mt19937_64 rng(mix(seed ^ spec.key()));
+  bool doors = g.door < g.side;
+
+  g.state.assign(g.n * g.n, 0);
+  if (doors) {
+    g.southDoor.assign(g.n * g.n, 0);
+    g.eastDoor.assign(g.n * g.n, 0);
+  }
+
+  if (g.n == 0)
+    return;
+
+  // The wall between a cell and its neighbour in direction d belongs to the lower of the two
+  auto open = [&](int64_t cell, int d) {
+    int64_t owner = (d == 1) ? cell - g.n : (d == 3) ? cell - 1 : cell;
+    g.state[owner] |= opened[d / 2];
+
+    if (doors)
+      (d < 2 ? g.southDoor : g.eastDoor)[owner] = rng() % (g.side - g.door + 1);
+  };
+
+  int64_t current = 0;
+  g.state[0] = 5;
+
+  while (true) {
+    int64_t cx = current / g.n, cy = current % g.n;
+    int candidates[4], k = 0;
+
+    for (int d = 0; d < 4; d++) {
+      int64_t nx = cx + dx[d], ny = cy + dy[d];
+      if (nx >= 0 && ny >= 0 && nx < g.n && ny < g.n && (g.state[nx * g.n + ny] & 7) == 0)
+        candidates[k++] = d;
+    }
+
+    if (k) {
+      int d = candidates[rng() % k];
+      open(current, d);
+      current = (cx + dx[d]) * g.n + cy + dy[d];
+      g.state[current] |= (d ^ 1) + 1;
+      continue;
+    }
+
+    int back = (g.state[current] & 7) - 1;
+    if (back == 4)
+      break;
+    current = (cx + dx[back]) * g.n + cy + dy[back];
+  }
+
+  // Rooms get loops, mazes stay perfect
+  if (spec.kind != MAPGEN_ROOMS)
+    return;
+
+  for (int64_t cell = 0; cell < g.n * g.n; cell++)
+    for (int d = 0; d <= 2; d += 2) {
+      bool inside = (d == 0) ? cell / g.n + 1 < g.n : cell % g.n + 1 < g.n;
+      if (inside && !(g.state[cell] & opened[d / 2]) && rng() % MAPGEN_EXTRA_DOORS == 0)
+        open(cell, d);
+    }
+}
+
+float mapGenerator::gridCell(const cellGrid& g, int64_t x, int64_t y) {
+  int64_t pitch = g.side + 1;
+  int64_t cx = x / pitch, cy = y / pitch, px = x % pitch, py = y % pitch;
+
+  if (cx >= g.n || cy >= g.n || (px == g.side && py == g.side))
+    return INACCESSIBLE;
+
+  if (px < g.side && py < g.side)
+    return MIN_WEIGHT;
+
+  // A wall towards +x (px == side) or towards +y (py == side)
+  int64_t cell = cx * g.n + cy;
+  bool south = (px == g.side);
+  if (!(g.state[cell] & (south ? 8 : 16)))
+    return INACCESSIBLE;
+
+  int64_t along = south ? py : px;
+  int64_t offset = (g.door < g.side) ? (south ? g.southDoor[cell] : g.eastDoor[cell]) : 0;
+  return (along >= offset && along < offset + g.door) ? MIN_WEIGHT : INACCESSIBLE;
+}
+
+// Land within a noisy radius of 0.45 to 0.95 of half a cell from the cell centre, so the rows
+//   and columns on cell borders are always water
+float mapGenerator::islandCell(const mapSpec& spec, uint64_t key, int64_t x, int64_t y) {
+  int64_t side = std::max<int64_t>(2, spec.size / std::max(1, spec.param));
+  int64_t ix = x / side, iy = y / side;
+
+  if (ix >= spec.param || iy >= spec.param)
+    return INACCESSIBLE;
+
+  int64_t dx = x - (ix * side + side / 2), dy = y - (iy * side + side / 2);
+  int64_t n = noise(key, x, y, std::max<int64_t>(1, side / 4), 2);
+  int64_t limit = (side / 2) * (MAPGEN_ONE * 95 / 100 - n / 2);
+
+  return ((dx * dx + dy * dy) * MAPGEN_ONE * MAPGEN_ONE < limit * limit) ? MIN_WEIGHT : INACCESSIBLE;
+}
+
+int mapGenerator::generate(const mapSpec& spec, aStar& world, int storage) {
+  if (spec.size <= 0 || spec.kind < 0 || spec.kind >= MAPGEN_KINDS)
+    return EXIT_FAILURE;
+
+  world.setMapSize(spec.size, spec.size, storage);
+  if (spec.kind == MAPGEN_OPEN)
+    return EXIT_SUCCESS;
+
+  cellGrid g;
+  if (spec.kind == MAPGEN_MAZE || spec.kind == MAPGEN_ROOMS) {
+    g.side = std::max(1, spec.param);
+    g.door = (spec.kind == MAPGEN_MAZE) ? g.side : std::min<int64_t>(MAPGEN_DOOR, g.side);
+    g.n = (spec.size >= g.side) ? (spec.size - g.side) / (g.side + 1) + 1 : 0;
+    carve(spec, g);
+  }
+
+  uint64_t key = spec.key();
+  int64_t scale = std::max(1, spec.param);
+
+  auto value = [&](int64_t x, int64_t y) -> float {
+    switch (spec.kind) {
+      case MAPGEN_DENSITY:
+        return (int64_t)(hash(key, x, y) % 100) < spec.param ? INACCESSIBLE : MIN_WEIGHT;
+      case MAPGEN_MAZE:
+      case MAPGEN_ROOMS:
+        return gridCell(g, x, y);
+      case MAPGEN_NOISE: {
+        // Stretched so both ends of the weight range are reached
+        int64_t t = (noise(key, x, y, scale, 3) - MAPGEN_ONE / 2) * 5 / 2 + MAPGEN_ONE / 2;
+        t = std::min<int64_t>(std::max<int64_t>(t, 0), MAPGEN_ONE - 1);
+        return (float)((int64_t)MIN_WEIGHT + (t * (int64_t)(MAX_WEIGHT - MIN_WEIGHT) + MAPGEN_ONE / 2) / (MAPGEN_ONE - 1));
+      }
+      default:
+        return islandCell(spec, key, x, y);
+    }
+  };
+
+  MatrixXf band;
+  for (int64_t x0 = 0; x0 < spec.size; x0 += MAPGEN_BAND) {
+    int64_t rows = std::min<int64_t>(MAPGEN_BAND, spec.size - x0);
+    band.resize(rows, spec.size);
+
+    for (int64_t y = 0; y < spec.size; y++)
+      for (int64_t x = 0; x < rows; x++)
+        band(x, y) = value(x0 + x, y);
+
+    world.setBlock(x0, 0, band);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void mapGenerator::scenarios(const mapSpec& spec, aStar& world, size_t count, std::vector<scenarioEntry>& entries) {
+  std::mt19937_64 rng(mix(seed ^ spec.key() ^ 0x7363656eull));
+  auto& map = world.getMap();
+  int64_t rows = map.rows(), cols = map.cols();
+  bool solve = rows * cols <= MAPGEN_SOLVE_LIMIT;
+
+  entries.clear();
+  if (rows <= 0 || cols <= 0)
+    return;
+
+  auto passable = [&](coords& c) {
+    for (int tries = 0; tries < 1000; tries++) {
+      c = coords(rng() % rows, rng() % cols);
+      if (map.get(c.first, c.second) != INACCESSIBLE)
+        return true;
+    }
+    return false;
+  };
+
+  bool labelled = world.getComponents().isBuilt() || world.getComponents().build(map);
+  std::vector<uint64_t> seen;
+
+  // Exact costs need an admissible heuristic; steps cost the same in all eight directions
+  int heuristic = world.getHeuristic().getHeuristic();
+  world.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+
+  for (size_t attempts = 0; entries.size() < count && attempts < 100 * count; attempts++) {
+    bool split = spec.kind == MAPGEN_ISLANDS && entries.size() % MAPGEN_UNREACHABLE == MAPGEN_UNREACHABLE - 1;
+    scenarioEntry e;
+
+    if (!passable(e.start) || !passable(e.goal) || e.start == e.goal)
+      continue;
+
+    world.setOrigin(point(e.start.first, e.start.second));
+    world.setDestination(point(e.goal.first, e.goal.second));
+    bool connected = labelled ? world.reachable() : fillReaches(map, e.goal, e.start, seen);
+    if (connected == split)
+      continue;
+
+    int64_t distance = std::max(std::abs(e.start.first - e.goal.first), std::abs(e.start.second - e.goal.second));
+    e.map = spec.name() + ".map";
+    e.optimal = split ? -1.0 : 0.0;
+
+    std::vector<std::pair<point, float>> origin = { std::make_pair(world.getOrigin(), 0.0f) };
+    if (!split && solve && world.runAlgorithm(origin) == EXIT_SUCCESS)
+      e.optimal = world.getPathCost();
+
+    e.bucket = (int)((e.optimal > 0.0 ? e.optimal : distance) / 4);
+    entries.push_back(e);
+  }
+
+  world.getHeuristic().setHeuristic(heuristic);
+}
+
+bool mapGenerator::fillReaches(gridMap& map, const coords& from, const coords& to, std::vector<uint64_t>& seen) {
+  cellIndex first = map.index(from.first, from.second), target = map.index(to.first, to.second);
+  cellIndex adjacent[8];
+  std::vector<cellIndex> stack = { first };
+  size_t visited = 0;
+
+  seen.assign((map.indexSpace() + 63) / 64, 0);
+  seen[first >> 6] |= 1ull << (first & 63);
+
+  while (!stack.empty()) {
+    cellIndex i = stack.back();
+    stack.pop_back();
+
+    if (i == target || ++visited > MAPGEN_FILL_LIMIT)
+      return true;
+
+    int64_t x, y;
+    map.position(i, x, y);
+    map.adjacent(x, y, i, adjacent);
+
+    for (auto a : adjacent)
+      if (a != INEXISTENT && !(seen[a >> 6] >> (a & 63) & 1) && map.at(a) != INACCESSIBLE) {
+        seen[a >> 6] |= 1ull << (a & 63);
+        stack.push_back(a);
+      }
+  }
+
+  return false;
+}
+
+int mapGenerator::save(const std::string& dir, const mapSpec& spec, aStar& world,
+                       const std::vector<scenarioEntry>& entries) {
+  std::string base = dir + "/" + spec.name();
+
+  if (saveMovingAiMap(base + ".map", world) != EXIT_SUCCESS ||
+      saveMovingAiScenario(base + ".map.scen", world, entries) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (spec.kind == MAPGEN_NOISE)
+    return streamedMap::write(base + ".tiles", world.getMap());
+
+  return EXIT_SUCCESS;
+}
+
+uint64_t mapGenerator::checksum(aStar& world) {
+  auto& map = world.getMap();
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  for (int64_t x = 0; x < map.rows(); x++)
+    for (int64_t y = 0; y < map.cols(); y++)
+      h = (h ^ (uint64_t)(int64_t)map.get(x, y)) * 0x100000001b3ull;
+
+  return h;
+}
+
+std::vector<mapSpec> mapGenerator::suite(int64_t minSize, int64_t maxSize) {
+  std::vector<mapSpec> specs;
+
+  for (int64_t size = std::max<int64_t>(minSize, 1); size <= maxSize; size *= 4) {
+    int64_t feature = std::max<int64_t>(4, size / 16);
+    auto add = [&](int kind, int64_t param) { specs.push_back(mapSpec{ kind, size, (int)param }); };
+
+    add(MAPGEN_OPEN, 0);
+    for (int density = 10; density <= 40; density += 10)
+      add(MAPGEN_DENSITY, density);
+    for (int width = 1; width <= 16; width *= 4)
+      if (width * 4 <= size)
+        add(MAPGEN_MAZE, width);
+    add(MAPGEN_ROOMS, std::min<int64_t>(feature, 64));
+    add(MAPGEN_NOISE, feature);
+    add(MAPGEN_ISLANDS, 4);
+  }
+
+  return specs;
+}
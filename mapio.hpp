@@ -0,0 +1,118 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Map and scenario files in the Moving AI benchmark format
+
+#pragma once
+
+#include "astar.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// One line of a .scen file, coordinates as (row, column)
+struct scenarioEntry {
+    int bucket = 0;
+    std::string map;
+    coords start, goal;
+    double optimal = 0.0;
+};
+
+// '.', 'G' and 'S' are passable, everything else ('@', 'O', 'T', 'W') is not.
+//   Rows become the first coordinate, so (x, y) in the file is coords(y, x)
+int loadMovingAiMap(const std::string& path, aStar& world, int storage = DENSE_STORAGE) {
+  std::ifstream in(path);
+  std::string word, line;
+  int64_t height = 0, width = 0;
+
+  if (!in)
+    return EXIT_FAILURE;
+
+  while (in >> word && word != "map") {
+    if (word == "height")
+      in >> height;
+    else if (word == "width")
+      in >> width;
+    else
+      std::getline(in, line);
+  }
+
+  if (word != "map" || height <= 0 || width <= 0)
+    return EXIT_FAILURE;
+
+  std::getline(in, line);
+  world.setMapSize(height, width, storage);
+
+  for (int64_t x = 0; x < height; x++) {
+    if (!std::getline(in, line) || (int64_t)line.size() < width)
+      return EXIT_FAILURE;
+
+    for (int64_t y = 0; y < width; y++)
+      if (line[y] != '.' && line[y] != 'G' && line[y] != 'S')
+        world.setInaccessible(x, y);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int saveMovingAiMap(const std::string& path, aStar& world) {
+  std::ofstream out(path);
+  auto& map = world.getMap();
+
+  if (!out)
+    return EXIT_FAILURE;
+
+  out << "type octile" << std::endl << "height " << map.rows() << std::endl
+      << "width " << map.cols() << std::endl << "map" << std::endl;
+
+  std::string line(map.cols(), '.');
+  for (int64_t x = 0; x < map.rows(); x++) {
+    for (int64_t y = 0; y < map.cols(); y++)
+      line[y] = (map.get(x, y) == INACCESSIBLE) ? '@' : '.';
+    out << line << std::endl;
+  }
+
+  return out ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int loadMovingAiScenario(const std::string& path, std::vector<scenarioEntry>& entries) {
+  std::ifstream in(path);
+  std::string line;
+
+  if (!in)
+    return EXIT_FAILURE;
+
+  entries.clear();
+
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    scenarioEntry e;
+    int width, height, sx, sy, gx, gy;
+
+    if (line.compare(0, 7, "version") == 0)
+      continue;
+
+    if (fields >> e.bucket >> e.map >> width >> height >> sx >> sy >> gx >> gy >> e.optimal) {
+      e.start = coords(sy, sx);
+      e.goal = coords(gy, gx);
+      entries.push_back(e);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int saveMovingAiScenario(const std::string& path, aStar& world, const std::vector<scenarioEntry>& entries) {
+  std::ofstream out(path);
+
+  if (!out)
+    return EXIT_FAILURE;
+
+  out << "version 1" << std::endl;
+  for (auto& e : entries)
+    out << e.bucket << "\t" << e.map << "\t" << world.getMap().cols() << "\t" << world.getMap().rows() << "\t"
+        << e.start.second << "\t" << e.start.first << "\t" << e.goal.second << "\t" << e.goal.first << "\t"
+        << e.optimal << std::endl;
+
+  return out ? EXIT_SUCCESS : EXIT_FAILURE;
+}
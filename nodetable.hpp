@@ -0,0 +1,97 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Per-search node storage keyed by map storage index
+
+#pragma once
+
+#include "utils.hpp"
+
+// Interface nodeTable - a stamped array in map storage order while the map has at most
+//   DENSE_SEARCH_LIMIT cells, so starting a search is O(1); a hash map above that
+template<class Node>
+class nodeTable {
+    private:
+        struct slot {
+            Node node;
+            uint32_t stamp = 0;
+        };
+
+        std::vector<slot> dense;
+        std::unordered_map<int64_t, Node> sparse;
+        std::vector<int64_t> touched;
+
+        uint32_t stamp = 0;
+        bool useDense = false;
+
+    public:
+        // Forget every node, sized for indices in [0, space)
+        void reset(int64_t space);
+
+        // Node at index i, default constructed on first touch
+        Node& get(int64_t i, bool& created);
+        Node& get(int64_t i) { bool created; return get(i, created); }
+        bool contains(int64_t i);
+
+        // Indices touched since reset
+        std::vector<int64_t>& used() { return touched; }
+        size_t size() { return touched.size(); }
+};
+
+// Implementation nodeTable
+
+template<class Node>
+void nodeTable<Node>::reset(int64_t space) {
+  touched.clear();
+  sparse.clear();
+
+  useDense = (space <= DENSE_SEARCH_LIMIT);
+  if (!useDense) {
+    dense.clear();
+    dense.shrink_to_fit();
+    return;
+  }
+
+  if ((int64_t)dense.size() != space) {
+    dense.assign(space, slot());
+    stamp = 0;
+  }
+
+  // Wrapped around - old stamps could match again
+  if (++stamp == 0) {
+    for (auto& s : dense)
+      s.stamp = 0;
+    stamp = 1;
+  }
+}
+
+template<class Node>
+Node& nodeTable<Node>::get(int64_t i, bool& created) {
+  if (useDense) {
+    auto& s = dense[i];
+    created = (s.stamp != stamp);
+
+    if (created) {
+      s.node = Node();
+      s.stamp = stamp;
+      touched.push_back(i);
+    }
+
+    return s.node;
+  }
+
+  auto it = sparse.try_emplace(i);
+  created = it.second;
+  if (created)
+    touched.push_back(i);
+
+  return it.first->second;
+}
+
+template<class Node>
+bool nodeTable<Node>::contains(int64_t i) {
+  if (useDense)
+    return dense[i].stamp == stamp;
+
+  return sparse.count(i) > 0;
+}
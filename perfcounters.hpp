@@ -0,0 +1,173 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Hardware performance counters of the calling thread, read around search phases. Linux only;
+//   everywhere counters cannot be opened (containers, VMs, other systems) readings stay at -1
+
+#pragma once
+
+#include "utils.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define PERF_CYCLES          0
+#define PERF_INSTRUCTIONS    1
+#define PERF_CACHE_MISSES    2
+#define PERF_BRANCH_MISSES   3
+#define PERF_EVENTS          4
+
+// Counts over one phase, -1 for events that could not be counted
+struct perfReading {
+    int64_t cycles = -1;
+    int64_t instructions = -1;
+    int64_t cacheMisses = -1;       // Last level cache
+    int64_t branchMisses = -1;
+
+    bool valid() const { return cycles >= 0 || instructions >= 0 || cacheMisses >= 0 || branchMisses >= 0; }
+    double ipc() const { return (cycles > 0 && instructions >= 0) ? (double)instructions / cycles : 0.0; }
+
+    // Per unit of work, e.g. expansions
+    double per(int64_t count, size_t units) const { return (count >= 0 && units) ? (double)count / units : 0.0; }
+
+    perfReading& operator+=(const perfReading& o);
+};
+
+// Running totals of the counters at one instant, unscaled, with the group's times. Counts
+//   between two samples are scaled by the ratio of the time differences, so multiplexing
+//   before the first sample does not leak into the phase
+struct perfSample {
+    int64_t values[PERF_EVENTS] = { -1, -1, -1, -1 };
+    uint64_t enabled = 0, running = 0;      // ns
+};
+
+// Interface perfCounters - one event group per thread, opened on the first local() of that
+//   thread and left running; a sample is a single read of the group
+class perfCounters {
+    private:
+        int leader = -1;
+        int fds[PERF_EVENTS] = { -1, -1, -1, -1 };
+        int slot[PERF_EVENTS] = { -1, -1, -1, -1 };   // Position of each event in a group read
+        int opened = 0;
+
+        perfCounters();
+
+    public:
+        ~perfCounters();
+        perfCounters(const perfCounters&) = delete;
+        perfCounters& operator=(const perfCounters&) = delete;
+
+        // Counters of the calling thread
+        static perfCounters& local();
+
+        bool available() { return leader >= 0; }
+        perfSample sample();
+
+        // Counts between two samples
+        static perfReading difference(const perfSample& from, const perfSample& to);
+};
+
+// Implementation perfReading
+
+perfReading& perfReading::operator+=(const perfReading& o) {
+  auto add = [](int64_t& a, int64_t b) { if (b >= 0) a = (a >= 0 ? a : 0) + b; };
+
+  add(cycles, o.cycles);
+  add(instructions, o.instructions);
+  add(cacheMisses, o.cacheMisses);
+  add(branchMisses, o.branchMisses);
+  return *this;
+}
+
+// Implementation perfCounters
+
+perfCounters::perfCounters() {
+#ifdef __linux__
+  const uint64_t configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                          PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+  // The first event that opens leads the group, the others are skipped if they fail
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[e];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = (leader < 0) ? 1 : 0;
+
+    fds[e] = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fds[e] < 0)
+      continue;
+
+    if (leader < 0)
+      leader = fds[e];
+    slot[e] = opened++;
+  }
+
+  if (leader >= 0) {
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+}
+
+perfCounters::~perfCounters() {
+#ifdef __linux__
+  for (int e = PERF_EVENTS - 1; e >= 0; e--)
+    if (fds[e] >= 0)
+      close(fds[e]);
+#endif
+}
+
+perfCounters& perfCounters::local() {
+  thread_local perfCounters counters;
+  return counters;
+}
+
+perfSample perfCounters::sample() {
+  perfSample s;
+
+#ifdef __linux__
+  if (leader < 0)
+    return s;
+
+  // nr, time enabled, time running, one value per event
+  uint64_t data[3 + PERF_EVENTS];
+  if (read(leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)) || data[0] != (uint64_t)opened)
+    return s;
+
+  s.enabled = data[1];
+  s.running = data[2];
+  for (int e = 0; e < PERF_EVENTS; e++)
+    if (slot[e] >= 0)
+      s.values[e] = (int64_t)data[3 + slot[e]];
+#endif
+
+  return s;
+}
+
+perfReading perfCounters::difference(const perfSample& from, const perfSample& to) {
+  int64_t counts[PERF_EVENTS];
+
+  // Scaled up when the group shared the hardware with others during the phase
+  bool ran = to.running > from.running && to.enabled >= from.enabled;
+  double scale = ran ? (double)(to.enabled - from.enabled) / (to.running - from.running) : 0.0;
+
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    bool valid = ran && from.values[e] >= 0 && to.values[e] >= from.values[e];
+    counts[e] = valid ? (int64_t)((to.values[e] - from.values[e]) * scale) : -1;
+  }
+
+  perfReading r;
+  r.cycles = counts[PERF_CYCLES];
+  r.instructions = counts[PERF_INSTRUCTIONS];
+  r.cacheMisses = counts[PERF_CACHE_MISSES];
+  r.branchMisses = counts[PERF_BRANCH_MISSES];
+  return r;
+}
@@ -0,0 +1,81 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Per-thread state of a shared object - the ring of a tracer, the shard of a latency recorder,
+//   the buffer of a query log
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Interface perThread - one T for every thread that uses the owner, kept alive by the owner only.
+//   A thread finds its own through a thread-local list keyed by owner id. The list holds a weak
+//   token of the owner rather than the T, and drops the entries of owners that are gone each time
+//   it grows, so a long-lived thread keeps nothing of the tracers and logs it used once
+template <typename T>
+class perThread {
+    private:
+        struct entry {
+            uint64_t owner;
+            std::weak_ptr<char> alive;
+            T* item;
+        };
+
+        uint64_t id;
+        std::shared_ptr<char> alive = std::make_shared<char>();
+
+        std::mutex itemLock;       // Only taken when a thread registers for the first time
+        std::vector<std::shared_ptr<T>> items;
+
+        static std::vector<entry>& mine() {
+          thread_local std::vector<entry> entries;
+          return entries;
+        }
+
+    public:
+        perThread() {
+          static std::atomic<uint64_t> next{1};
+          id = next++;
+        }
+        perThread(const perThread&) = delete;
+        perThread& operator=(const perThread&) = delete;
+
+        // The calling thread's T, built by make(index) the first time, index counting from 0
+        template <typename F>
+        T& local(F make);
+
+        // Every T registered so far
+        std::vector<std::shared_ptr<T>> all() {
+          std::lock_guard<std::mutex> guard(itemLock);
+          return items;
+        }
+};
+
+// Implementation perThread
+
+template <typename T>
+template <typename F>
+T& perThread<T>::local(F make) {
+  auto& entries = mine();
+
+  for (auto& e : entries)
+    if (e.owner == id)
+      return *e.item;
+
+  entries.erase(std::remove_if(entries.begin(), entries.end(), [](const entry& e) { return e.alive.expired(); }),
+                entries.end());
+
+  std::shared_ptr<T> item;
+  {
+    std::lock_guard<std::mutex> guard(itemLock);
+    item = make(items.size());
+    items.push_back(item);
+  }
+
+  entries.push_back(entry{id, alive, item.get()});
+  return *item;
+}
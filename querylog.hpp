@@ -0,0 +1,230 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Query log - every query with its options, result and latency, appended to a binary file for
+//   replay against another build (bench/replay_bench)
+
+#pragma once
+
+#include "utils.hpp"
+#include "latency.hpp"
+#include "perthread.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define QUERY_LOG_MAGIC      0x474f4c595251ull   // "QRYLOG"
+#define QUERY_LOG_VERSION    1
+
+// Bytes buffered per thread before one append
+#define QUERY_LOG_BUFFER     (64 * 1024)
+
+struct queryLogHeader {
+    uint64_t magic = QUERY_LOG_MAGIC;
+    uint32_t version = QUERY_LOG_VERSION;
+    uint32_t recordSize = 0;
+};
+
+// Fixed part of a record, followed by extra points - the goals of a multi-goal query or the
+//   origins (with their initial g) of a multi-source one
+struct queryLogRecord {
+    uint64_t when;              // System clock, ns since the epoch
+    uint64_t mapVersion;
+    uint64_t nanos;             // Latency
+    uint64_t expansions;
+    int64_t ox, oy, dx, dy;
+    float cost;                 // Infinite when no path was found
+    float epsilon, delta;       // Anytime searches
+    uint32_t budget;            // Anytime searches, microseconds to the deadline
+    uint32_t length;            // Cells (or turning points) in the path
+    uint32_t extra;
+    int32_t radius;
+    uint8_t engine;             // QUERY_ASTAR ... QUERY_ANY_ANGLE
+    uint8_t heuristic;
+    uint8_t tableMode;          // HEURISTIC_TABLE_NONE ... HEURISTIC_TABLE_EXACT
+    uint8_t found;
+    uint32_t thread;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(queryLogRecord) == 104, "query log records have no padding");
+
+struct queryLogPoint {
+    int64_t x, y;
+    float g;
+    uint32_t reserved;
+};
+
+// A record with its points, as read back
+struct loggedQuery {
+    queryLogRecord record;
+    std::vector<queryLogPoint> points;
+};
+
+// Interface queryLog - each thread fills its own buffer and appends it whole with O_APPEND, so
+//   records of different threads and processes never interleave. Buffers are written when
+//   full, on flush() and on close
+class queryLog {
+    private:
+        struct buffer {
+            std::mutex lock;        // Only contended by flush()
+            std::vector<char> bytes;
+            uint32_t thread = 0;
+        };
+
+        int fd = -1;
+        std::atomic<uint64_t> records{0};
+        perThread<buffer> buffers;
+
+        buffer& local();
+        void write(buffer& b);
+
+    public:
+        queryLog() {}
+        ~queryLog() { close(); }
+        queryLog(const queryLog&) = delete;
+        queryLog& operator=(const queryLog&) = delete;
+
+        // Appends to an existing log, a new one starts with the header
+        int open(const std::string& path);
+        void close();
+        bool isOpen() { return fd >= 0; }
+
+        void append(queryLogRecord record, const std::vector<queryLogPoint>& points);
+        void flush();
+        uint64_t recordCount() { return records; }
+
+        static int read(const std::string& path, std::vector<loggedQuery>& queries);
+};
+
+// Implementation queryLog
+
+int queryLog::open(const std::string& path) {
+  close();
+
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size == 0) {
+    queryLogHeader header;
+    header.recordSize = sizeof(queryLogRecord);
+    if (::write(fd, &header, sizeof(header)) != sizeof(header)) {
+      close();
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void queryLog::close() {
+  if (fd < 0)
+    return;
+
+  flush();
+  ::close(fd);
+  fd = -1;
+}
+
+queryLog::buffer& queryLog::local() {
+  return buffers.local([](size_t thread) {
+    auto b = std::make_shared<buffer>();
+    b->bytes.reserve(QUERY_LOG_BUFFER);
+    b->thread = thread;
+    return b;
+  });
+}
+
+// Caller holds the buffer's lock. Short writes are resumed so no record is cut; on a hard error
+//   the buffer is dropped rather than kept growing while the disk stays full
+void queryLog::write(buffer& b) {
+  size_t done = 0;
+
+  while (fd >= 0 && done < b.bytes.size()) {
+    ssize_t n = ::write(fd, b.bytes.data() + done, b.bytes.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      debug << "Query log write failed, " << b.bytes.size() - done << " bytes dropped" << std::endl;
+      break;
+    }
+    done += n;
+  }
+
+  b.bytes.clear();
+}
+
+void queryLog::append(queryLogRecord record, const std::vector<queryLogPoint>& points) {
+  if (fd < 0)
+    return;
+
+  buffer& b = local();
+  std::lock_guard<std::mutex> guard(b.lock);
+
+  record.thread = b.thread;
+  record.extra = points.size();
+
+  size_t bytes = sizeof(record) + points.size() * sizeof(queryLogPoint);
+  if (b.bytes.size() + bytes > QUERY_LOG_BUFFER)
+    write(b);
+
+  const char* r = reinterpret_cast<const char*>(&record);
+  const char* p = reinterpret_cast<const char*>(points.data());
+  b.bytes.insert(b.bytes.end(), r, r + sizeof(record));
+  b.bytes.insert(b.bytes.end(), p, p + points.size() * sizeof(queryLogPoint));
+
+  records++;
+}
+
+void queryLog::flush() {
+  for (auto& b : buffers.all()) {
+    std::lock_guard<std::mutex> guard(b->lock);
+    write(*b);
+  }
+}
+
+int queryLog::read(const std::string& path, std::vector<loggedQuery>& queries) {
+  std::FILE* in = std::fopen(path.c_str(), "rb");
+  if (!in)
+    return EXIT_FAILURE;
+
+  queryLogHeader header;
+  if (std::fread(&header, sizeof(header), 1, in) != 1 || header.magic != QUERY_LOG_MAGIC ||
+      header.version != QUERY_LOG_VERSION || header.recordSize != sizeof(queryLogRecord)) {
+    std::fclose(in);
+    return EXIT_FAILURE;
+  }
+
+  struct stat info;
+  if (fstat(fileno(in), &info) != 0) {
+    std::fclose(in);
+    return EXIT_FAILURE;
+  }
+
+  queries.clear();
+  loggedQuery q;
+  uint64_t left = info.st_size - sizeof(header);
+
+  // A record cut short by a crash, or one that cannot be a record, ends the log
+  while (left >= sizeof(q.record) && std::fread(&q.record, sizeof(q.record), 1, in) == 1) {
+    left -= sizeof(q.record);
+    if (q.record.engine >= QUERY_ENGINES || q.record.extra > left / sizeof(queryLogPoint))
+      break;
+
+    left -= q.record.extra * sizeof(queryLogPoint);
+    q.points.resize(q.record.extra);
+    if (q.record.extra && std::fread(q.points.data(), sizeof(queryLogPoint), q.record.extra, in) != q.record.extra)
+      break;
+    queries.push_back(q);
+  }
+
+  std::fclose(in);
+  return EXIT_SUCCESS;
+}
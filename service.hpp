@@ -0,0 +1,500 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Local path service - maps loaded once, binary queries over a Unix domain socket, answered
+//   by a worker pool in micro-batches
+
+#pragma once
+
+#include "sharedmap.hpp"
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVICE_BATCH        32
+#define SERVICE_WINDOW_US    200
+#define SERVICE_BACKLOG      64
+#define SERVICE_READ_SIZE    4096
+
+// Request flags
+#define SERVICE_WITH_PATH    1
+
+// Response status besides EXIT_SUCCESS / EXIT_FAILURE
+#define SERVICE_BAD_MAP      2
+
+// Fixed-size request, native byte order (the socket is local)
+struct serviceRequest {
+    uint32_t id;            // Echoed in the response, requests may be answered out of order
+    uint16_t map;
+    uint16_t flags;
+    int32_t ox, oy;
+    int32_t dx, dy;
+};
+
+// Followed by length (x, y) pairs of int32 when the path was asked for
+struct serviceResponse {
+    uint32_t id;
+    int32_t status;
+    float cost;
+    uint32_t length;
+    uint32_t expansions;
+    uint32_t micros;        // Time spent on the query by the worker
+};
+
+struct serviceStats {
+    std::atomic<size_t> requests{0};
+    std::atomic<size_t> batches{0};
+    std::atomic<size_t> connections{0};
+};
+
+// Interface serviceServer - one thread accepts, one reads per connection and queues requests;
+//   workers take up to batch requests at a time, waiting up to window for a batch to fill, and
+//   answer them grouped by map and destination. Each worker searches its own aStar per map,
+//   all over one shared copy of the map. Responses to a connection go out in one write per batch
+class serviceServer {
+    private:
+        // Closed with its last user, a worker may still be answering it
+        struct connection {
+            int fd;
+            std::mutex writeLock;
+            ~connection() { ::close(fd); }
+        };
+
+        struct pending {
+            serviceRequest request;
+            std::shared_ptr<connection> from;
+        };
+
+        std::string socketPath;
+        std::string prefix;
+        int listenFd = -1;
+        std::atomic<bool> running{false};
+
+        std::vector<std::unique_ptr<sharedMapHost>> hosts;
+
+        std::deque<pending> queue;
+        std::mutex queueLock;
+        std::condition_variable queueReady;
+        size_t batch = SERVICE_BATCH;
+        std::chrono::microseconds window{SERVICE_WINDOW_US};
+
+        std::thread acceptor;
+        std::vector<std::thread> workers;
+
+        // Readers are detached and counted, stop() waits for the count to drop to zero
+        std::vector<std::shared_ptr<connection>> connections;
+        std::mutex connectionLock;
+        std::condition_variable readersDone;
+        size_t readers = 0;
+
+        serviceStats stats;
+        std::shared_ptr<latencyRecorder> latency;
+
+        void acceptLoop();
+        void readLoop(std::shared_ptr<connection> c);
+        void workLoop();
+        static bool writeAll(int fd, const char* data, size_t bytes);
+
+    public:
+        serviceServer();
+        ~serviceServer();
+
+        // Map ids follow the order of the calls, add maps before start
+        int addMap(aStar& world);
+        size_t mapCount() { return hosts.size(); }
+
+        // Search latencies of every worker go to the recorder, set before start
+        void setLatencyRecorder(std::shared_ptr<latencyRecorder> recorder) { latency = recorder; }
+
+        int start(const std::string& socketPath, int threads = std::thread::hardware_concurrency(),
+                  size_t batch = SERVICE_BATCH, std::chrono::microseconds window = std::chrono::microseconds(SERVICE_WINDOW_US));
+        void stop();
+        bool isRunning() { return running; }
+
+        size_t requestCount() { return stats.requests; }
+        size_t batchCount() { return stats.batches; }
+};
+
+// Interface serviceClient - blocking socket, requests may be sent ahead of the responses
+class serviceClient {
+    private:
+        int fd = -1;
+        std::vector<char> buffer;
+        size_t begin = 0, end = 0;
+
+        bool fill(size_t bytes);
+
+    public:
+        serviceClient() : buffer(SERVICE_READ_SIZE) {};
+        ~serviceClient() { close(); }
+
+        int connect(const std::string& socketPath);
+        void close();
+
+        int send(const serviceRequest& request);
+        int send(const std::vector<serviceRequest>& requests);
+
+        // Next response, path filled when one follows
+        int receive(serviceResponse& response, std::vector<coords>& path);
+};
+
+// Implementation serviceServer
+
+serviceServer::serviceServer() {
+  prefix = "astar_service_" + std::to_string(getpid()) + "_";
+}
+
+// The map segments live as long as the service
+serviceServer::~serviceServer() {
+  stop();
+
+  for (size_t k = 0; k < hosts.size(); k++)
+    sharedMapHost::remove(prefix + std::to_string(k));
+}
+
+int serviceServer::addMap(aStar& world) {
+  if (running)
+    return INEXISTENT;
+
+  auto host = std::make_unique<sharedMapHost>();
+  if (host->open(prefix + std::to_string(hosts.size())) != EXIT_SUCCESS || host->publish(world) != EXIT_SUCCESS)
+    return INEXISTENT;
+
+  hosts.push_back(std::move(host));
+  return hosts.size() - 1;
+}
+
+int serviceServer::start(const std::string& socketPath, int threads, size_t batch, std::chrono::microseconds window) {
+  if (running || hosts.empty())
+    return EXIT_FAILURE;
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path))
+    return EXIT_FAILURE;
+  std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0)
+    return EXIT_FAILURE;
+
+  unlink(socketPath.c_str());
+  if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SERVICE_BACKLOG) != 0) {
+    ::close(listenFd);
+    listenFd = -1;
+    return EXIT_FAILURE;
+  }
+
+  this->socketPath = socketPath;
+  this->batch = std::max<size_t>(batch, 1);
+  this->window = window;
+  running = true;
+
+  for (int t = 0; t < std::max(1, threads); t++)
+    workers.push_back(std::thread(&serviceServer::workLoop, this));
+  acceptor = std::thread(&serviceServer::acceptLoop, this);
+
+  return EXIT_SUCCESS;
+}
+
+void serviceServer::stop() {
+  if (!running.exchange(false))
+    return;
+
+  shutdown(listenFd, SHUT_RDWR);
+  ::close(listenFd);
+  listenFd = -1;
+  acceptor.join();
+
+  {
+    std::lock_guard<std::mutex> guard(connectionLock);
+    for (auto& c : connections)
+      shutdown(c->fd, SHUT_RDWR);
+  }
+
+  {
+    std::unique_lock<std::mutex> guard(connectionLock);
+    readersDone.wait(guard, [&]() { return readers == 0; });
+  }
+
+  queueReady.notify_all();
+  for (auto& t : workers)
+    t.join();
+
+  workers.clear();
+  connections.clear();
+  queue.clear();
+  unlink(socketPath.c_str());
+}
+
+void serviceServer::acceptLoop() {
+  while (running) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (!running)
+        return;
+      continue;
+    }
+
+    auto c = std::make_shared<connection>();
+    c->fd = fd;
+    stats.connections++;
+
+    std::lock_guard<std::mutex> guard(connectionLock);
+    connections.push_back(c);
+    readers++;
+    std::thread(&serviceServer::readLoop, this, c).detach();
+  }
+}
+
+// Whole requests are queued as they arrive, a partial one waits for the next read
+void serviceServer::readLoop(std::shared_ptr<connection> c) {
+  std::vector<char> buffer(SERVICE_READ_SIZE);
+  size_t filled = 0;
+
+  while (running) {
+    ssize_t got = recv(c->fd, buffer.data() + filled, buffer.size() - filled, 0);
+    if (got <= 0)
+      break;
+
+    filled += got;
+    size_t whole = filled / sizeof(serviceRequest);
+
+    if (whole > 0) {
+      std::lock_guard<std::mutex> guard(queueLock);
+      for (size_t k = 0; k < whole; k++) {
+        pending p;
+        std::memcpy(&p.request, buffer.data() + k * sizeof(serviceRequest), sizeof(serviceRequest));
+        p.from = c;
+        queue.push_back(p);
+      }
+    }
+
+    if (whole > 0)
+      queueReady.notify_one();
+
+    std::memmove(buffer.data(), buffer.data() + whole * sizeof(serviceRequest), filled - whole * sizeof(serviceRequest));
+    filled -= whole * sizeof(serviceRequest);
+  }
+
+  // Last use of the server by this thread, stop() may return once the count is zero
+  std::lock_guard<std::mutex> guard(connectionLock);
+  connections.erase(std::remove(connections.begin(), connections.end(), c), connections.end());
+  if (--readers == 0)
+    readersDone.notify_all();
+}
+
+bool serviceServer::writeAll(int fd, const char* data, size_t bytes) {
+  while (bytes > 0) {
+    ssize_t sent = ::send(fd, data, bytes, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
+
+    data += sent;
+    bytes -= sent;
+  }
+
+  return true;
+}
+
+void serviceServer::workLoop() {
+  // One search state per map, all reading the shared segments
+  std::vector<sharedMapClient> clients(hosts.size());
+  std::vector<aStar> worlds(hosts.size());
+
+  for (size_t k = 0; k < hosts.size(); k++) {
+    worlds[k].setMapSize(1, 1);
+    clients[k].attach(prefix + std::to_string(k));
+    clients[k].install(worlds[k]);
+    worlds[k].setLatencyRecorder(latency);
+  }
+
+  std::vector<pending> work;
+  std::vector<coords> path;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(queueLock);
+      queueReady.wait(guard, [&]() { return !queue.empty() || !running; });
+
+      if (!running)
+        return;
+
+      // Give the batch a moment to fill, then take what is there
+      if (queue.size() < batch)
+        queueReady.wait_for(guard, window, [&]() { return queue.size() >= batch || !running; });
+
+      // Another worker may have emptied the queue meanwhile
+      size_t take = std::min(batch, queue.size());
+      if (take == 0)
+        continue;
+
+      work.assign(queue.begin(), queue.begin() + take);
+      queue.erase(queue.begin(), queue.begin() + take);
+
+      if (!queue.empty())
+        queueReady.notify_one();
+    }
+
+    stats.batches++;
+    stats.requests += work.size();
+
+    // Same map and destination back to back, so consecutive searches touch the same parts of the map
+    std::stable_sort(work.begin(), work.end(), [](const pending& a, const pending& b) {
+      return std::tie(a.request.map, a.request.dx, a.request.dy) < std::tie(b.request.map, b.request.dx, b.request.dy);
+    });
+
+    std::unordered_map<connection*, std::vector<char>> replies;
+
+    for (auto& p : work) {
+      auto& r = p.request;
+      auto start = std::chrono::steady_clock::now();
+      serviceResponse out = { r.id, SERVICE_BAD_MAP, 0.0f, 0, 0, 0 };
+      path.clear();
+
+      if (r.map < worlds.size()) {
+        aStar& world = worlds[r.map];
+        gridMap& map = world.getMap();
+        bool inside = r.ox >= 0 && r.oy >= 0 && r.dx >= 0 && r.dy >= 0 &&
+                      r.ox < map.rows() && r.oy < map.cols() && r.dx < map.rows() && r.dy < map.cols();
+
+        out.status = EXIT_FAILURE;
+        if (inside) {
+          world.setOrigin(point(r.ox, r.oy));
+          world.setDestination(point(r.dx, r.dy));
+          out.status = world.runAlgorithm();
+          out.expansions = world.getStats().expansions;
+        }
+
+        if (out.status == EXIT_SUCCESS) {
+          path = world.getPath();
+          for (size_t k = 1; k < path.size(); k++)
+            out.cost += COST * (int)map.get(path[k].first, path[k].second);
+        }
+      }
+
+      if (r.flags & SERVICE_WITH_PATH)
+        out.length = path.size();
+      out.micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+      auto& buffer = replies[p.from.get()];
+      buffer.insert(buffer.end(), (const char*)&out, (const char*)&out + sizeof(out));
+
+      for (size_t k = 0; k < out.length; k++) {
+        int32_t xy[2] = { path[k].first, path[k].second };
+        buffer.insert(buffer.end(), (const char*)xy, (const char*)xy + sizeof(xy));
+      }
+    }
+
+    for (auto& p : work) {
+      auto it = replies.find(p.from.get());
+      if (it == replies.end())
+        continue;
+
+      std::lock_guard<std::mutex> guard(p.from->writeLock);
+      writeAll(p.from->fd, it->second.data(), it->second.size());
+      replies.erase(it);
+    }
+  }
+}
+
+// Implementation serviceClient
+
+int serviceClient::connect(const std::string& socketPath) {
+  close();
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path))
+    return EXIT_FAILURE;
+  std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  if (::connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    close();
+    return EXIT_FAILURE;
+  }
+
+  begin = end = 0;
+  return EXIT_SUCCESS;
+}
+
+void serviceClient::close() {
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+
+int serviceClient::send(const serviceRequest& request) {
+  return send(std::vector<serviceRequest>{ request });
+}
+
+int serviceClient::send(const std::vector<serviceRequest>& requests) {
+  const char* data = (const char*)requests.data();
+  size_t bytes = requests.size() * sizeof(serviceRequest);
+
+  while (bytes > 0) {
+    ssize_t sent = ::send(fd, data, bytes, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return EXIT_FAILURE;
+
+    data += sent;
+    bytes -= sent;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// At least bytes unread in the buffer
+bool serviceClient::fill(size_t bytes) {
+  if (end - begin >= bytes)
+    return true;
+
+  std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+  end -= begin;
+  begin = 0;
+
+  if (buffer.size() < bytes)
+    buffer.resize(bytes);
+
+  while (end < bytes) {
+    ssize_t got = recv(fd, buffer.data() + end, buffer.size() - end, 0);
+    if (got <= 0)
+      return false;
+    end += got;
+  }
+
+  return true;
+}
+
+int serviceClient::receive(serviceResponse& response, std::vector<coords>& path) {
+  path.clear();
+
+  if (fd < 0 || !fill(sizeof(serviceResponse)))
+    return EXIT_FAILURE;
+
+  std::memcpy(&response, buffer.data() + begin, sizeof(response));
+  begin += sizeof(response);
+
+  if (response.length == 0)
+    return EXIT_SUCCESS;
+
+  if (!fill(response.length * 2 * sizeof(int32_t)))
+    return EXIT_FAILURE;
+
+  for (uint32_t k = 0; k < response.length; k++) {
+    int32_t xy[2];
+    std::memcpy(xy, buffer.data() + begin, sizeof(xy));
+    begin += sizeof(xy);
+    path.push_back(coords(xy[0], xy[1]));
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Path service daemon - loads Moving AI maps once and answers queries on a Unix socket
+//
+// Usage: astar_daemon socket map [map ...] [-t threads] [-b batch] [-w window_us]
+//                     [-l latency_file [-i interval_ms] [-j]]
+//   Map ids follow the order of the files. Stops on SIGINT or SIGTERM. With -l the latency
+//   histograms are written every interval, on SIGUSR1 and on exit, as JSON with -j
+
+#include "service.hpp"
+#include "mapio.hpp"
+#include <csignal>
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+      cerr << "Usage: astar_daemon socket map [map ...] [-t threads] [-b batch] [-w window_us]"
+           << " [-l latency_file [-i interval_ms] [-j]]" << endl;
+      return EXIT_FAILURE;
+    }
+
+    string socketPath = argv[1];
+    int threads = thread::hardware_concurrency();
+    size_t batch = SERVICE_BATCH;
+    int window = SERVICE_WINDOW_US;
+    string latencyPath;
+    int interval = 10000;
+    int format = LATENCY_TEXT;
+    serviceServer server;
+
+    for (int i = 2; i < argc; i++) {
+      string arg = argv[i];
+
+      if (arg == "-t" && i + 1 < argc)
+        threads = atoi(argv[++i]);
+      else if (arg == "-b" && i + 1 < argc)
+        batch = atoi(argv[++i]);
+      else if (arg == "-w" && i + 1 < argc)
+        window = atoi(argv[++i]);
+      else if (arg == "-l" && i + 1 < argc)
+        latencyPath = argv[++i];
+      else if (arg == "-i" && i + 1 < argc)
+        interval = atoi(argv[++i]);
+      else if (arg == "-j")
+        format = LATENCY_JSON;
+      else {
+        aStar world;
+        if (loadMovingAiMap(arg, world) != EXIT_SUCCESS || server.addMap(world) == INEXISTENT) {
+          cerr << "Cannot load " << arg << endl;
+          return EXIT_FAILURE;
+        }
+        cout << "Map " << server.mapCount() - 1 << " : " << arg << " (" << world.getMap().rows() << " x "
+             << world.getMap().cols() << ")" << endl;
+      }
+    }
+
+    // Signals are taken synchronously, the service threads never see them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    auto latency = make_shared<latencyRecorder>();
+    if (!latencyPath.empty()) {
+      server.setLatencyRecorder(latency);
+      latency->startDumping(latencyPath, chrono::milliseconds(max(interval, 1)), format);
+    }
+
+    if (server.start(socketPath, threads, batch, chrono::microseconds(window)) != EXIT_SUCCESS) {
+      cerr << "Cannot listen on " << socketPath << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Listening on " << socketPath << ", " << threads << " workers, batches of " << batch << " within "
+         << window << " us" << endl;
+
+    int received;
+    while (sigwait(&signals, &received) == 0 && received == SIGUSR1)
+      if (!latencyPath.empty())
+        latency->dump(latencyPath, format);
+
+    server.stop();
+    if (!latencyPath.empty())
+      latency->stopDumping();
+    cout << server.requestCount() << " requests in " << server.batchCount() << " batches" << endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,399 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Shared-memory map hosting - one process publishes the map and its derived structures into
+//   POSIX shared memory, worker processes map them read-only and swap to new versions live
+
+#pragma once
+
+#include "astar.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHARED_MAP_MAGIC    0x4D485341  // "ASHM"
+#define SHARED_MAP_VERSION  1
+
+#define SHARED_COMPONENTS   1
+#define SHARED_CLEARANCE    2
+
+// Tries to open the current generation before giving up, a publish may retire it meanwhile
+#define SHARED_MAP_RETRIES  8
+
+// Control segment "/name" - the generation workers should be on, 0 before the first publish
+struct sharedMapControl {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint64_t> generation;
+};
+
+// Data segment "/name.<generation>": header, then the column-major weights (as denseMap) and,
+//   when flagged, component labels and clearance distances in the same order. Sections
+//   start on 8-byte boundaries
+struct sharedMapHeader {
+    uint32_t magic = SHARED_MAP_MAGIC;
+    uint32_t version = SHARED_MAP_VERSION;
+    uint64_t generation = 0;
+    int64_t rows = 0, cols = 0;
+    uint32_t flags = 0;
+    int32_t components = 0;     // Labels lie in [0, components)
+    uint64_t weights = 0;       // Section offsets from the start of the segment
+    uint64_t labels = 0;
+    uint64_t clearance = 0;
+    uint64_t size = 0;
+};
+
+// One mapped data segment, unmapped with its last user
+class sharedSegment {
+    private:
+        void* base = nullptr;
+        size_t size = 0;
+
+    public:
+        sharedSegment(void* base, size_t size) : base(base), size(size) {};
+        ~sharedSegment() { munmap(base, size); }
+        sharedSegment(const sharedSegment&) = delete;
+        sharedSegment& operator=(const sharedSegment&) = delete;
+
+        const sharedMapHeader& header() { return *(const sharedMapHeader*)base; }
+        const char* at(uint64_t offset) { return (const char*)base + offset; }
+};
+
+// Interface sharedMap - read-only gridMap over a data segment, laid out as denseMap. Writes
+//   throw std::logic_error; the segment stays mapped while the map lives
+class sharedMap : public gridMap {
+    private:
+        std::shared_ptr<sharedSegment> segment;
+        const float* cells = nullptr;
+
+    public:
+        sharedMap(std::shared_ptr<sharedSegment> segment);
+
+        void resize(int64_t, int64_t) override { readOnly(); }
+        float get(int64_t x, int64_t y) override { return cells[y * sizeM + x]; }
+        void set(int64_t, int64_t, float) override { readOnly(); }
+        void fill(int64_t, int64_t, int64_t, int64_t, float) override { readOnly(); }
+        void setBlock(int64_t, int64_t, const MatrixXf&) override { readOnly(); }
+
+        // Edits belong in the host's map, then a publish
+        static void readOnly() { throw std::logic_error("shared maps are read-only, edit the host's map and publish"); }
+
+        // Pages belong to the segment, not to this process
+        size_t memoryUsage() override { return 0; }
+        int storageType() override { return SHARED_STORAGE; }
+
+        cellIndex index(int64_t x, int64_t y) override { return y * sizeM + x; }
+        void position(cellIndex i, int64_t& x, int64_t& y) override { x = i % sizeM; y = i / sizeM; }
+        cellIndex indexSpace() override { return sizeM * sizeN; }
+        float at(cellIndex i) override { return cells[i]; }
+
+        std::shared_ptr<sharedSegment> getSegment() { return segment; }
+};
+
+// Interface sharedMapHost - the loader. Each publish writes a new data segment, then flips the
+//   generation; the previous segment is unlinked, workers still on it keep their mapping.
+//   Closing leaves the control and current segments in place, so attached workers keep
+//   running and a host reopening the name carries on from the same generation
+class sharedMapHost {
+    private:
+        std::string name;
+        int controlFd = -1;
+        sharedMapControl* control = nullptr;
+        uint64_t generation = 0;
+
+    public:
+        sharedMapHost() {};
+        ~sharedMapHost() { close(); }
+        sharedMapHost(const sharedMapHost&) = delete;
+        sharedMapHost& operator=(const sharedMapHost&) = delete;
+
+        // Create the control segment or reopen an existing one, EXIT_FAILURE if it cannot be made
+        int open(const std::string& name);
+        void close();
+
+        // Unlinks the control and current segments of a name, for shutting the fleet down.
+        //   Workers attached to it keep their mappings but see no further publishes
+        static void remove(const std::string& name);
+
+        // Snapshot the world's map with its component labels and clearance, built first if
+        //   needed (maps up to COMPONENT_LIMIT cells)
+        int publish(aStar& world);
+        uint64_t getGeneration() { return generation; }
+
+        static std::string segmentName(const std::string& name, uint64_t generation) {
+          return "/" + name + "." + std::to_string(generation);
+        }
+};
+
+// Interface sharedMapClient - a worker. update() moves to the published generation when it
+//   changed, install() hands it to an aStar; searches already running keep the old segment
+class sharedMapClient {
+    private:
+        std::string name;
+        sharedMapControl* control = nullptr;
+        std::shared_ptr<sharedSegment> current;
+        uint64_t generation = 0;
+
+        std::shared_ptr<sharedSegment> map(uint64_t generation);
+
+    public:
+        sharedMapClient() {};
+        ~sharedMapClient() { detach(); }
+        sharedMapClient(const sharedMapClient&) = delete;
+        sharedMapClient& operator=(const sharedMapClient&) = delete;
+
+        int attach(const std::string& name);
+        void detach();
+
+        // True when a newer generation was mapped
+        bool update();
+        bool isReady() { return current != nullptr; }
+        uint64_t getGeneration() { return generation; }
+        uint64_t publishedGeneration() { return control ? control->generation.load(std::memory_order_acquire) : 0; }
+
+        // Map, component labels and clearance of the current generation, without copying
+        int install(aStar& world);
+};
+
+// Implementation sharedMap
+
+sharedMap::sharedMap(std::shared_ptr<sharedSegment> segment) : segment(segment) {
+  sizeM = segment->header().rows;
+  sizeN = segment->header().cols;
+  cells = (const float*)segment->at(segment->header().weights);
+}
+
+// Implementation sharedMapHost
+
+int sharedMapHost::open(const std::string& name) {
+  close();
+
+  int fd = shm_open(("/" + name).c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  if (ftruncate(fd, sizeof(sharedMapControl)) != 0) {
+    ::close(fd);
+    return EXIT_FAILURE;
+  }
+
+  void* view = mmap(nullptr, sizeof(sharedMapControl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (view == MAP_FAILED) {
+    ::close(fd);
+    return EXIT_FAILURE;
+  }
+
+  this->name = name;
+  controlFd = fd;
+  control = (sharedMapControl*)view;
+
+  // A host restarting on the same name carries on from the last generation
+  if (control->magic != SHARED_MAP_MAGIC) {
+    control->magic = SHARED_MAP_MAGIC;
+    control->version = SHARED_MAP_VERSION;
+    control->generation.store(0, std::memory_order_release);
+  }
+  generation = control->generation.load(std::memory_order_acquire);
+
+  return EXIT_SUCCESS;
+}
+
+void sharedMapHost::close() {
+  if (!control)
+    return;
+
+  munmap(control, sizeof(sharedMapControl));
+  ::close(controlFd);
+  control = nullptr;
+  controlFd = -1;
+}
+
+void sharedMapHost::remove(const std::string& name) {
+  int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+  if (fd >= 0) {
+    void* view = mmap(nullptr, sizeof(sharedMapControl), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (view != MAP_FAILED) {
+      auto control = (sharedMapControl*)view;
+      uint64_t generation = control->generation.load(std::memory_order_acquire);
+      if (control->magic == SHARED_MAP_MAGIC && generation > 0)
+        shm_unlink(segmentName(name, generation).c_str());
+      munmap(view, sizeof(sharedMapControl));
+    }
+  }
+
+  shm_unlink(("/" + name).c_str());
+}
+
+int sharedMapHost::publish(aStar& world) {
+  if (!control)
+    return EXIT_FAILURE;
+
+  gridMap& map = world.getMap();
+  componentMap& components = world.getComponents();
+  clearanceMap& clearance = world.getClearance();
+
+  int64_t rows = map.rows(), cols = map.cols();
+  auto padded = [](uint64_t bytes) { return (bytes + 7) & ~(uint64_t)7; };
+
+  sharedMapHeader header;
+  header.generation = generation + 1;
+  header.rows = rows;
+  header.cols = cols;
+
+  if (components.isBuilt() || components.build(map))
+    header.flags |= SHARED_COMPONENTS;
+  if (clearance.isBuilt() || clearance.build(map))
+    header.flags |= SHARED_CLEARANCE;
+
+  header.components = (header.flags & SHARED_COMPONENTS) ? components.labelCount() : 0;
+  header.weights = padded(sizeof(sharedMapHeader));
+  header.labels = header.weights + padded(rows * cols * sizeof(float));
+  header.clearance = header.labels + ((header.flags & SHARED_COMPONENTS) ? padded(rows * cols * sizeof(int32_t)) : 0);
+  header.size = header.clearance + ((header.flags & SHARED_CLEARANCE) ? padded(rows * cols * sizeof(int32_t)) : 0);
+
+  std::string segment = segmentName(name, header.generation);
+  shm_unlink(segment.c_str());
+
+  int fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  void* view = MAP_FAILED;
+  if (ftruncate(fd, header.size) == 0)
+    view = mmap(nullptr, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (view == MAP_FAILED) {
+    shm_unlink(segment.c_str());
+    return EXIT_FAILURE;
+  }
+
+  // Column by column, cells of any source layout land in denseMap order
+  char* base = (char*)view;
+  float* weights = (float*)(base + header.weights);
+  int32_t* labels = (int32_t*)(base + header.labels);
+  int32_t* distances = (int32_t*)(base + header.clearance);
+
+  for (int64_t y = 0; y < cols; y++)
+    for (int64_t x = 0; x < rows; x++) {
+      cellIndex from = map.index(x, y), to = y * rows + x;
+
+      weights[to] = map.get(x, y);
+      if (header.flags & SHARED_COMPONENTS)
+        labels[to] = components.component(from);
+      if (header.flags & SHARED_CLEARANCE)
+        distances[to] = clearance.clearance(from) + 1;
+    }
+
+  *(sharedMapHeader*)base = header;
+  munmap(view, header.size);
+
+  // Workers see the new generation only once its segment is complete
+  control->generation.store(header.generation, std::memory_order_release);
+
+  if (generation > 0)
+    shm_unlink(segmentName(name, generation).c_str());
+  generation = header.generation;
+
+  return EXIT_SUCCESS;
+}
+
+// Implementation sharedMapClient
+
+int sharedMapClient::attach(const std::string& name) {
+  detach();
+
+  int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  void* view = mmap(nullptr, sizeof(sharedMapControl), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (view == MAP_FAILED)
+    return EXIT_FAILURE;
+
+  control = (sharedMapControl*)view;
+  if (control->magic != SHARED_MAP_MAGIC || control->version != SHARED_MAP_VERSION) {
+    detach();
+    return EXIT_FAILURE;
+  }
+
+  this->name = name;
+  update();
+  return EXIT_SUCCESS;
+}
+
+void sharedMapClient::detach() {
+  if (control)
+    munmap(control, sizeof(sharedMapControl));
+
+  control = nullptr;
+  current.reset();
+  generation = 0;
+}
+
+std::shared_ptr<sharedSegment> sharedMapClient::map(uint64_t generation) {
+  int fd = shm_open(sharedMapHost::segmentName(name, generation).c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  sharedMapHeader header;
+
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != SHARED_MAP_MAGIC || header.version != SHARED_MAP_VERSION ||
+      header.generation != generation || header.size > (uint64_t)info.st_size) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  void* view = mmap(nullptr, header.size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  return (view == MAP_FAILED) ? nullptr : std::make_shared<sharedSegment>(view, header.size);
+}
+
+bool sharedMapClient::update() {
+  if (!control)
+    return false;
+
+  for (int attempt = 0; attempt < SHARED_MAP_RETRIES; attempt++) {
+    uint64_t published = control->generation.load(std::memory_order_acquire);
+    if (published == 0 || published == generation)
+      return false;
+
+    // Gone if another publish retired it in between, then read the generation again
+    auto segment = map(published);
+    if (segment) {
+      current = segment;
+      generation = published;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int sharedMapClient::install(aStar& world) {
+  if (!current)
+    return EXIT_FAILURE;
+
+  auto segment = current;
+  const sharedMapHeader& header = segment->header();
+
+  world.setMap(std::make_unique<sharedMap>(segment));
+
+  if (header.flags & SHARED_COMPONENTS)
+    world.getComponents().attach((const int32_t*)segment->at(header.labels), header.components);
+  if (header.flags & SHARED_CLEARANCE)
+    world.getClearance().attach((const int32_t*)segment->at(header.clearance));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Summed-area tables over the map - O(1) rectangle occupancy and cost
+
+#pragma once
+
+#include "gridmap.hpp"
+
+// Interface summedArea - integral images of the inaccessible mask and of the step cost
+//   (COST * weight, accessible cells only). Entry (i, j) sums rows < i and columns < j.
+//   Edits only record the smallest row and column touched; the next query refills the
+//   entries below and right of them
+class summedArea {
+    private:
+        Matrix<int32_t, Dynamic, Dynamic> blocked;
+        Matrix<double, Dynamic, Dynamic> cost;
+
+        int64_t dirtyRow = 0, dirtyCol = 0;
+        bool built = false, dirty = false;
+
+        void fill(gridMap& map, int64_t fromRow, int64_t fromCol);
+
+    public:
+        // Build both tables, false when the map is larger than COMPONENT_LIMIT
+        bool build(gridMap& map);
+        void invalidate() { built = dirty = false; blocked.resize(0, 0); cost.resize(0, 0); }
+        bool isBuilt() { return built; }
+        bool isCurrent() { return built && !dirty; }
+
+        // Call after the cell at (x, y) changed weight or accessibility
+        void cellChanged(int64_t x, int64_t y);
+
+        // Bring the tables up to date, builds them on first use
+        bool refresh(gridMap& map);
+
+        // Inclusive corners, clipped to the map; the tables must be current
+        int64_t blockedCount(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        bool rectBlocked(int64_t x0, int64_t y0, int64_t x1, int64_t y1) { return blockedCount(x0, y0, x1, y1) > 0; }
+        double rectCost(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+};
+
+// Implementation summedArea
+
+bool summedArea::build(gridMap& map) {
+  built = dirty = false;
+
+  if (map.rows() * map.cols() > COMPONENT_LIMIT)
+    return false;
+
+  blocked.setZero(map.rows() + 1, map.cols() + 1);
+  cost.setZero(map.rows() + 1, map.cols() + 1);
+  fill(map, 0, 0);
+
+  built = true;
+  return true;
+}
+
+// Recompute entries (i, j) with i > fromRow and j > fromCol, column by column as Eigen stores them
+void summedArea::fill(gridMap& map, int64_t fromRow, int64_t fromCol) {
+  for (int64_t y = fromCol; y < map.cols(); y++) {
+    int32_t runBlocked = blocked(fromRow, y + 1) - blocked(fromRow, y);
+    double runCost = cost(fromRow, y + 1) - cost(fromRow, y);
+
+    // Running sums down column y, added to the finished column on the left
+    for (int64_t x = fromRow; x < map.rows(); x++) {
+      float w = map.get(x, y);
+
+      if (w == INACCESSIBLE)
+        runBlocked++;
+      else
+        runCost += COST * (int)w;
+
+      blocked(x + 1, y + 1) = blocked(x + 1, y) + runBlocked;
+      cost(x + 1, y + 1) = cost(x + 1, y) + runCost;
+    }
+  }
+}
+
+void summedArea::cellChanged(int64_t x, int64_t y) {
+  if (!built)
+    return;
+
+  if (!dirty) {
+    dirtyRow = x;
+    dirtyCol = y;
+    dirty = true;
+  }
+  else {
+    dirtyRow = std::min(dirtyRow, x);
+    dirtyCol = std::min(dirtyCol, y);
+  }
+}
+
+bool summedArea::refresh(gridMap& map) {
+  if (!built)
+    return build(map);
+
+  if (dirty) {
+    fill(map, dirtyRow, dirtyCol);
+    dirty = false;
+  }
+
+  return true;
+}
+
+int64_t summedArea::blockedCount(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  x0 = std::max<int64_t>(x0, 0);
+  y0 = std::max<int64_t>(y0, 0);
+  x1 = std::min<int64_t>(x1, blocked.rows() - 2);
+  y1 = std::min<int64_t>(y1, blocked.cols() - 2);
+
+  if (x0 > x1 || y0 > y1)
+    return 0;
+
+  return (int64_t)blocked(x1 + 1, y1 + 1) - blocked(x0, y1 + 1) - blocked(x1 + 1, y0) + blocked(x0, y0);
+}
+
+double summedArea::rectCost(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+  x0 = std::max<int64_t>(x0, 0);
+  y0 = std::max<int64_t>(y0, 0);
+  x1 = std::min<int64_t>(x1, cost.rows() - 2);
+  y1 = std::min<int64_t>(y1, cost.cols() - 2);
+
+  if (x0 > x1 || y0 > y1)
+    return 0.0;
+
+  return cost(x1 + 1, y1 + 1) - cost(x0, y1 + 1) - cost(x1 + 1, y0) + cost(x0, y0);
+}
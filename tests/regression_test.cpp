@@ -0,0 +1,286 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Regression tests, one CTest entry per case
+//
+// Usage: regression_test case
+
+#include "astar.hpp"
+#include "cpd.hpp"
+#include "perthread.hpp"
+#include <functional>
+#include <map>
+
+using namespace std;
+
+static bool check(bool ok, const string& what) {
+    if (!ok)
+      cerr << "Failed: " << what << endl;
+    return ok;
+}
+
+// 5 x 20 strip with a heavy band across the straight line from (2, 2) to (2, 17)
+static void heavyStrip(aStar& a) {
+    a.setMapSize(5, 20, DENSE_STORAGE);
+    a.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+    a.setOrigin(point(2, 2));
+    a.setDestination(point(2, 17));
+
+    for (int y = 5; y <= 14; y++)
+      a.setWeight(2, y, 200.0f);
+}
+
+static float gridCost(aStar& a) {
+    vector<pair<point, float>> origin = { make_pair(a.getOrigin(), 0.0f) };
+    return (a.runAlgorithm(origin) == EXIT_SUCCESS) ? a.getPathCost() : numeric_limits<float>::infinity();
+}
+
+// Any-angle paths go around heavy terrain when that is cheaper than the straight line
+static bool anyAngleWeighted() {
+    aStar a;
+    heavyStrip(a);
+
+    float grid = gridCost(a);
+    bool found = a.runAnyAngle() == EXIT_SUCCESS;
+
+    return check(found, "any-angle path found") &&
+           check(a.getAnyAngleCost() <= grid, "any-angle cost " + to_string(a.getAnyAngleCost()) +
+                                              " above the grid optimum " + to_string(grid));
+}
+
+// Weight edits under an agent radius reach the line of sight masks of a reused instance
+static bool anyAngleRadiusWeights() {
+    aStar reused, fresh;
+
+    reused.setMapSize(5, 20, DENSE_STORAGE);
+    reused.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+    reused.setAgentRadius(1);
+    reused.setOrigin(point(2, 2));
+    reused.setDestination(point(2, 17));
+    reused.runAnyAngle();
+
+    for (int y = 5; y <= 14; y++)
+      reused.setWeight(2, y, 200.0f);
+
+    heavyStrip(fresh);
+    fresh.setAgentRadius(1);
+
+    bool a = reused.runAnyAngle() == EXIT_SUCCESS, b = fresh.runAnyAngle() == EXIT_SUCCESS;
+
+    return check(a && b, "both any-angle paths found") &&
+           check(reused.getAnyAngleCost() == fresh.getAnyAngleCost(),
+                 "reused instance cost " + to_string(reused.getAnyAngleCost()) + ", fresh " +
+                 to_string(fresh.getAnyAngleCost())) &&
+           check(reused.getPath() == fresh.getPath(), "reused instance took another path");
+}
+
+// Queries on one instance do not see the state of the previous one
+static bool repeatedQuery() {
+    aStar a(10, point(0, 0), point(6, 6));
+    a.setInaccessible(1, 1);
+    a.setInaccessible(5, 5);
+
+    bool first = a.runAlgorithm() == EXIT_SUCCESS;
+    auto path = a.getPath();
+    bool second = a.runAlgorithm() == EXIT_SUCCESS;
+
+    return check(first && second, "both queries found a path") && check(!path.empty(), "first path not empty") &&
+           check(a.getPath() == path, "second query took another path");
+}
+
+// Per-thread state goes with its owner, not with the threads that used it
+static bool perThreadRelease() {
+    weak_ptr<vector<char>> item;
+    {
+      perThread<vector<char>> owner;
+      owner.local([](size_t) { return make_shared<vector<char>>(1 << 20); });
+      item = owner.all().front();
+    }
+
+    return check(item.expired(), "per-thread state outlived its owner");
+}
+
+// Heuristic tables stay within the byte budget, and maps over it still search without one
+static bool heuristicCacheBudget() {
+    aStar a(100, point(0, 0), point(99, 99));
+    auto cache = make_shared<heuristicCache>(HEURISTIC_CACHE_SIZE, 100 * 1024);
+    a.setHeuristicCache(cache);
+
+    for (int goal = 97; goal <= 99; goal++) {
+      a.setDestination(point(goal, goal));
+      a.runAlgorithm();
+    }
+
+    aStar b(100, point(0, 0), point(99, 99));
+    auto tiny = make_shared<heuristicCache>(HEURISTIC_CACHE_SIZE, 1024);
+    b.setHeuristicCache(tiny);
+
+    return check(cache->size() == 2 && cache->bytes() <= 100 * 1024,
+                 to_string(cache->size()) + " tables, " + to_string(cache->bytes()) + " bytes kept") &&
+           check(b.runAlgorithm() == EXIT_SUCCESS, "search without a table") &&
+           check(tiny->size() == 0 && tiny->getStats().uncached == 1, "table over the budget kept");
+}
+
+// Anytime bounds are only reported for admissible heuristics, and then hold against the optimum
+static bool anytimeBound() {
+    auto later = chrono::steady_clock::now() + chrono::seconds(10);
+
+    aStar euclidean;
+    heavyStrip(euclidean);
+    euclidean.getHeuristic().setHeuristic(EUCLIDEAN_DISTANCE);
+    euclidean.runAnytime(later);
+
+    aStar chebyshev;
+    heavyStrip(chebyshev);
+    float optimal = gridCost(chebyshev);
+    bool found = chebyshev.runAnytime(later) == EXIT_SUCCESS;
+    auto result = chebyshev.getAnytimeResult();
+
+    return check(isinf(euclidean.getAnytimeResult().bound), "bound reported for an inadmissible heuristic") &&
+           check(found, "anytime path found") &&
+           check(result.bound >= 1.0f && result.cost <= result.bound * optimal + 1e-3f,
+                 "cost " + to_string(result.cost) + " over bound " + to_string(result.bound) + " times " +
+                 to_string(optimal));
+}
+
+// Tile stores with a header that does not match the file are rejected, cache stats count tiles
+static bool tileStoreOpen() {
+    const string path = "regression_test.tiles";
+    aStar a(200, point(0, 0), point(199, 199));
+    a.setWeight(10, 10, 5.0f);
+
+    bool written = streamedMap::write(path, a.getMap()) == EXIT_SUCCESS;
+
+    streamedMap good(path);
+    bool opened = good.isOpen();
+
+    for (int64_t x = 0; x < TILE_SIZE; x++)
+      for (int64_t y = 0; y < TILE_SIZE; y++)
+        good.get(x, y);
+    auto stats = good.getStats();
+
+    tileStoreHeader header;
+    FILE* f = fopen(path.c_str(), "r+b");
+    bool patched = f && fread(&header, sizeof(header), 1, f) == 1;
+    header.tileCount = 1ll << 40;
+    patched = patched && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    if (f)
+      fclose(f);
+
+    streamedMap bad(path);
+    bool rejected = !bad.isOpen();
+    remove(path.c_str());
+
+    return check(written && opened, "tile store written and opened") &&
+           check(stats.hits + stats.misses == 1, to_string(stats.hits + stats.misses) + " lookups for one tile") &&
+           check(patched && rejected, "tile store with a bad tile count opened");
+}
+
+// Path databases whose counts or run offsets do not fit the file are rejected
+static bool cpdOpen() {
+    const string path = "regression_test.cpd";
+    aStar a(30, point(0, 0), point(29, 29));
+    for (int y = 0; y < 25; y++)
+      a.setInaccessible(15, y);
+
+    cpdTable built, good, badCount, badOffset;
+    bool saved = built.build(a, { coords(29, 29), coords(0, 29) }, 1) == EXIT_SUCCESS &&
+                 built.save(path) == EXIT_SUCCESS;
+
+    vector<coords> cells;
+    bool opened = good.open(path) == EXIT_SUCCESS && good.getPath(coords(0, 0), coords(29, 29), cells) == EXIT_SUCCESS;
+
+    // Header runs, then the first run offset
+    auto patch = [&](long at, int64_t value) {
+      FILE* f = fopen(path.c_str(), "r+b");
+      bool ok = f && fseek(f, at, SEEK_SET) == 0 && fwrite(&value, sizeof(value), 1, f) == 1;
+      if (f)
+        fclose(f);
+      return ok;
+    };
+
+    bool patched = patch(offsetof(cpdHeader, runs), 1ll << 60);
+    bool countRejected = badCount.open(path) != EXIT_SUCCESS;
+
+    patched = patched && built.save(path) == EXIT_SUCCESS &&
+              patch(sizeof(cpdHeader) + 2 * ((30 * 30 * sizeof(int32_t) + 7) & ~7ul) + sizeof(uint64_t), 1ll << 40);
+    bool offsetRejected = badOffset.open(path) != EXIT_SUCCESS;
+    remove(path.c_str());
+
+    return check(saved && opened, "path database built, saved and opened") &&
+           check(patched && countRejected, "path database with a bad run count opened") &&
+           check(offsetRejected, "path database with a bad run offset opened");
+}
+
+// A query log record whose point count runs past the file ends the log there
+static bool queryLogRead() {
+    const string path = "regression_test.qlog";
+    remove(path.c_str());
+
+    auto log = make_shared<queryLog>();
+    aStar a(20, point(0, 0), point(19, 19));
+    a.setQueryLog(log);
+
+    bool opened = log->open(path) == EXIT_SUCCESS;
+    for (int i = 0; i < 3; i++)
+      a.runAlgorithm();
+    log->close();
+
+    uint32_t extra = 0xFFFFFFFF;
+    FILE* f = fopen(path.c_str(), "r+b");
+    bool patched = f && fseek(f, sizeof(queryLogHeader) + sizeof(queryLogRecord) + offsetof(queryLogRecord, extra),
+                              SEEK_SET) == 0 && fwrite(&extra, sizeof(extra), 1, f) == 1;
+    if (f)
+      fclose(f);
+
+    vector<loggedQuery> queries;
+    bool read = queryLog::read(path, queries) == EXIT_SUCCESS;
+    remove(path.c_str());
+
+    return check(opened && patched && read, "query log written, patched and read") &&
+           check(queries.size() == 1, to_string(queries.size()) + " records before the corrupt one");
+}
+
+// A repaired path reports its own cost, and no cost once it is gone
+static bool repairCost() {
+    aStar a(20, point(0, 0), point(0, 19));
+    a.getHeuristic().setHeuristic(CHEBYSHEV_DISTANCE);
+    bool found = a.runAlgorithm() == EXIT_SUCCESS;
+    float before = a.getPathCost();
+
+    for (int x = 0; x < 15; x++)
+      a.setInaccessible(x, 10);
+    bool repaired = a.repairPath() == EXIT_SUCCESS;
+    float after = a.getPathCost(), fresh = gridCost(a);
+
+    for (int x = 0; x < 20; x++)
+      a.setInaccessible(x, 15);
+    bool failed = a.repairPath() != EXIT_SUCCESS;
+
+    return check(found && repaired, "path found and repaired") &&
+           check(after > before && after == fresh, "repaired cost " + to_string(after) + ", before " +
+                                                   to_string(before) + ", fresh search " + to_string(fresh)) &&
+           check(failed && isinf(a.getPathCost()), "cost " + to_string(a.getPathCost()) + " after a failed repair");
+}
+
+int main(int argc, char** argv) {
+    const map<string, function<bool()>> cases = {
+      { "anyangle_weighted", anyAngleWeighted },
+      { "anyangle_radius_weights", anyAngleRadiusWeights },
+      { "repeated_query", repeatedQuery },
+      { "perthread_release", perThreadRelease },
+      { "heuristic_cache_budget", heuristicCacheBudget },
+      { "anytime_bound", anytimeBound },
+      { "tilestore_open", tileStoreOpen },
+      { "cpd_open", cpdOpen },
+      { "querylog_read", queryLogRead },
+      { "repair_cost", repairCost },
+    };
+
+    if (argc < 2 || !cases.count(argv[1])) {
+      cerr << "Usage: regression_test case" << endl;
+      return EXIT_FAILURE;
+    }
+
+    return cases.at(argv[1])() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,496 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Out-of-core collision map - on-disk tile store behind a bounded LRU tile cache
+
+#pragma once
+
+#include "gridmap.hpp"
+#include <list>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TILE_STORE_MAGIC    0x53545341  // "ASTS"
+#define TILE_STORE_VERSION  1
+
+#define TILE_RESIDENT       1
+#define TILE_ADVISED        2
+
+// On-disk layout: header, directory of tileCount entries, then the payloads of
+//   the non-uniform tiles as TILE_SIZE x TILE_SIZE row-major floats
+struct tileStoreHeader {
+    uint32_t magic = TILE_STORE_MAGIC;
+    uint32_t version = TILE_STORE_VERSION;
+    int64_t sizeM = 0, sizeN = 0;
+    uint32_t tileSize = TILE_SIZE;
+    uint32_t reserved = 0;
+    int64_t tileCount = 0;
+};
+
+// Offset 0 means the tile is uniform and has no payload
+struct tileStoreEntry {
+    uint64_t offset = 0;
+    float uniform = MIN_WEIGHT;
+    uint32_t reserved = 0;
+};
+
+// Hits and misses count tile lookups, not cell reads - runs of reads on the last tile touched
+//   skip the lookup and are not counted
+struct cacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t writebacks = 0;
+    size_t prefetches = 0;
+    size_t shrinks = 0;     // Capacity reductions forced by failed allocations
+
+    double hitRate() { return (hits + misses) ? (double)hits / (hits + misses) : 0.0; }
+};
+
+// Interface streamedMap - not thread safe, reads go through the cache
+class streamedMap : public gridMap {
+    private:
+        struct cachedTile {
+            int64_t tile;
+            std::unique_ptr<tileCells> cells;
+            bool dirty;
+        };
+
+        int fd = -1;
+        int64_t tilesM = 0, tilesN = 0;
+        uint64_t fileEnd = 0;
+        size_t capacity = TILE_CACHE_SIZE;
+        bool directoryDirty = false;
+
+        std::vector<tileStoreEntry> directory;
+        std::vector<uint8_t> flags;
+
+        // Front is the most recently used tile
+        std::list<cachedTile> lru;
+        std::unordered_map<int64_t, std::list<cachedTile>::iterator> resident;
+
+        // Last tile touched, skips the lookup for runs of accesses to one tile
+        int64_t lastTile = INEXISTENT;
+        tileCells* lastCells = nullptr;
+
+        cacheStats stats;
+
+        int64_t tileOf(int64_t x, int64_t y) { return (x >> TILE_SHIFT) * tilesN + (y >> TILE_SHIFT); }
+        uint64_t dataStart() { return sizeof(tileStoreHeader) + directory.size() * sizeof(tileStoreEntry); }
+
+        tileCells* load(int64_t tile);
+        std::unique_ptr<tileCells> allocate();
+        void evict();
+        void writeBack(cachedTile& t);
+
+    public:
+        // Anonymous store in a temporary file
+        streamedMap(size_t capacity = TILE_CACHE_SIZE);
+        streamedMap(const std::string& path, size_t capacity = TILE_CACHE_SIZE);
+        ~streamedMap();
+
+        int open(const std::string& path);
+        bool isOpen() { return fd >= 0; }
+        void flush();
+
+        void resize(int64_t sizeM, int64_t sizeN) override;
+        float get(int64_t x, int64_t y) override;
+        void set(int64_t x, int64_t y, float w) override;
+        size_t memoryUsage() override;
+        int storageType() override { return STREAMED_STORAGE; }
+        void prefetch(int64_t x, int64_t y, int dx, int dy) override;
+        bool uniformTile(int64_t tx, int64_t ty, float& w) override;
+        bool concurrentReads() override { return false; }
+
+        // Tile by tile, as in the store
+        cellIndex index(int64_t x, int64_t y) override;
+        void position(cellIndex i, int64_t& x, int64_t& y) override;
+        cellIndex indexSpace() override { return (cellIndex)directory.size() << (2 * TILE_SHIFT); }
+        float at(cellIndex i) override;
+
+        // Cache
+        void setCapacity(size_t tiles);
+        size_t getCapacity() { return capacity; }
+        size_t residentTiles() { return lru.size(); }
+        cacheStats getStats() { return stats; }
+        void resetStats() { stats = cacheStats(); }
+
+        // Write any map out as a tile store
+        static int write(const std::string& path, gridMap& map);
+};
+
+// Implementation streamedMap
+
+#pragma region streamedMap_constructors
+
+streamedMap::streamedMap(size_t capacity) {
+  char name[] = "/tmp/astar_tilesXXXXXX";
+
+  this->capacity = std::max<size_t>(1, capacity);
+  fd = mkstemp(name);
+  if (fd >= 0)
+    unlink(name);
+
+  resize(0, 0);
+}
+
+streamedMap::streamedMap(const std::string& path, size_t capacity) {
+  this->capacity = std::max<size_t>(1, capacity);
+  open(path);
+}
+
+streamedMap::~streamedMap() {
+  if (fd < 0)
+    return;
+
+  flush();
+  close(fd);
+}
+
+#pragma endregion
+
+#pragma region Store
+
+int streamedMap::open(const std::string& path) {
+  tileStoreHeader header;
+
+  if (fd >= 0) {
+    flush();
+    close(fd);
+  }
+
+  lru.clear();
+  resident.clear();
+  lastTile = INEXISTENT;
+  lastCells = nullptr;
+
+  fd = ::open(path.c_str(), O_RDWR);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != TILE_STORE_MAGIC
+      || header.version != TILE_STORE_VERSION || header.tileSize != TILE_SIZE) {
+    debug << "Not a tile store : " << path << std::endl;
+    close(fd);
+    fd = -1;
+    return EXIT_FAILURE;
+  }
+
+  // One directory entry per tile, and the directory inside the file, checked before allocating
+  struct stat info;
+  int64_t rows = ((uint64_t)header.sizeM + TILE_MASK) >> TILE_SHIFT;
+  int64_t cols = ((uint64_t)header.sizeN + TILE_MASK) >> TILE_SHIFT;
+
+  if (fstat(fd, &info) != 0 || header.sizeM <= 0 || header.sizeN <= 0 || header.tileCount <= 0
+      || header.tileCount % cols != 0 || header.tileCount / cols != rows
+      || (uint64_t)header.tileCount > (info.st_size - sizeof(header)) / sizeof(tileStoreEntry)) {
+    debug << "Corrupt tile store : " << path << std::endl;
+    close(fd);
+    fd = -1;
+    return EXIT_FAILURE;
+  }
+
+  sizeM = header.sizeM;
+  sizeN = header.sizeN;
+  tilesM = rows;
+  tilesN = cols;
+
+  directory.resize(header.tileCount);
+  flags.assign(header.tileCount, 0);
+
+  size_t bytes = directory.size() * sizeof(tileStoreEntry);
+  if (pread(fd, directory.data(), bytes, sizeof(header)) != (ssize_t)bytes) {
+    close(fd);
+    fd = -1;
+    return EXIT_FAILURE;
+  }
+
+  fileEnd = std::max<uint64_t>(lseek(fd, 0, SEEK_END), dataStart());
+  directoryDirty = false;
+
+  return EXIT_SUCCESS;
+}
+
+void streamedMap::flush() {
+  for (auto& t : lru)
+    if (t.dirty)
+      writeBack(t);
+
+  if (fd < 0 || !directoryDirty)
+    return;
+
+  tileStoreHeader header;
+  header.sizeM = sizeM;
+  header.sizeN = sizeN;
+  header.tileCount = directory.size();
+
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)
+      || pwrite(fd, directory.data(), directory.size() * sizeof(tileStoreEntry), sizeof(header)) < 0)
+    debug << "Tile store directory write failed" << std::endl;
+
+  directoryDirty = false;
+}
+
+// Resizing starts a fresh store where every tile is uniform at MIN_WEIGHT
+void streamedMap::resize(int64_t sizeM, int64_t sizeN) {
+  this->sizeM = sizeM;
+  this->sizeN = sizeN;
+  tilesM = (sizeM + TILE_MASK) >> TILE_SHIFT;
+  tilesN = (sizeN + TILE_MASK) >> TILE_SHIFT;
+
+  lru.clear();
+  resident.clear();
+  lastTile = INEXISTENT;
+  lastCells = nullptr;
+
+  directory.assign(tilesM * tilesN, tileStoreEntry());
+  flags.assign(directory.size(), 0);
+
+  fileEnd = dataStart();
+  directoryDirty = true;
+
+  if (fd >= 0 && ftruncate(fd, fileEnd) == 0)
+    flush();
+}
+
+int streamedMap::write(const std::string& path, gridMap& map) {
+  tileStoreHeader header;
+  header.sizeM = map.rows();
+  header.sizeN = map.cols();
+
+  int64_t tilesM = (header.sizeM + TILE_MASK) >> TILE_SHIFT;
+  int64_t tilesN = (header.sizeN + TILE_MASK) >> TILE_SHIFT;
+  header.tileCount = tilesM * tilesN;
+
+  std::vector<tileStoreEntry> directory(header.tileCount);
+  uint64_t offset = sizeof(header) + directory.size() * sizeof(tileStoreEntry);
+
+  int out = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (out < 0)
+    return EXIT_FAILURE;
+
+  tileCells cells;
+  bool ok = true;
+
+  for (int64_t tx = 0; tx < tilesM && ok; tx++) {
+    for (int64_t ty = 0; ty < tilesN && ok; ty++) {
+      auto& e = directory[tx * tilesN + ty];
+
+      if (map.uniformTile(tx, ty, e.uniform))
+        continue;
+
+      // Cells past the map edge repeat the first cell so they never break uniformity
+      float first = map.get(tx << TILE_SHIFT, ty << TILE_SHIFT);
+      for (int i = 0; i < TILE_SIZE; i++) {
+        for (int j = 0; j < TILE_SIZE; j++) {
+          int64_t x = (tx << TILE_SHIFT) + i, y = (ty << TILE_SHIFT) + j;
+          cells(i, j) = (x < header.sizeM && y < header.sizeN) ? map.get(x, y) : first;
+        }
+      }
+
+      e.uniform = first;
+      if ((cells.array() == first).all())
+        continue;
+
+      e.offset = offset;
+      ok = pwrite(out, cells.data(), sizeof(tileCells), offset) == sizeof(tileCells);
+      offset += sizeof(tileCells);
+    }
+  }
+
+  ok = ok && pwrite(out, &header, sizeof(header), 0) == sizeof(header);
+  ok = ok && pwrite(out, directory.data(), directory.size() * sizeof(tileStoreEntry), sizeof(header))
+             == (ssize_t)(directory.size() * sizeof(tileStoreEntry));
+
+  close(out);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#pragma endregion
+
+#pragma region Cache
+
+std::unique_ptr<tileCells> streamedMap::allocate() {
+  std::unique_ptr<tileCells> cells;
+
+  while (!cells) {
+    try {
+      cells = std::make_unique<tileCells>();
+    }
+    catch (const std::bad_alloc&) {
+      if (lru.empty())
+        throw;
+
+      // Memory pressure - halve the cache instead of failing the search
+      size_t keep = lru.size() / 2;
+      while (lru.size() > keep)
+        evict();
+
+      capacity = std::max<size_t>(1, keep);
+      stats.shrinks++;
+      debug << "Tile cache shrunk to " << capacity << std::endl;
+    }
+  }
+
+  return cells;
+}
+
+tileCells* streamedMap::load(int64_t tile) {
+  auto it = resident.find(tile);
+
+  if (it != resident.end()) {
+    stats.hits++;
+    lru.splice(lru.begin(), lru, it->second);
+  }
+  else {
+    stats.misses++;
+
+    while (lru.size() >= capacity)
+      evict();
+
+    auto cells = allocate();
+    auto& e = directory[tile];
+
+    if (e.offset == 0)
+      cells->setConstant(e.uniform);
+    else if (pread(fd, cells->data(), sizeof(tileCells), e.offset) != sizeof(tileCells)) {
+      debug << "Tile read failed @" << tile << std::endl;
+      cells->setConstant(INACCESSIBLE);
+    }
+
+    lru.push_front(cachedTile{ tile, std::move(cells), false });
+    resident[tile] = lru.begin();
+    flags[tile] = TILE_RESIDENT;
+  }
+
+  lastTile = tile;
+  lastCells = lru.front().cells.get();
+
+  return lastCells;
+}
+
+void streamedMap::evict() {
+  auto& t = lru.back();
+
+  if (t.dirty)
+    writeBack(t);
+
+  if (t.tile == lastTile) {
+    lastTile = INEXISTENT;
+    lastCells = nullptr;
+  }
+
+  flags[t.tile] = 0;
+  resident.erase(t.tile);
+  lru.pop_back();
+  stats.evictions++;
+}
+
+void streamedMap::writeBack(cachedTile& t) {
+  auto& e = directory[t.tile];
+
+  // Tiles that were uniform on disk get their payload appended
+  if (e.offset == 0) {
+    e.offset = fileEnd;
+    fileEnd += sizeof(tileCells);
+    directoryDirty = true;
+  }
+
+  if (pwrite(fd, t.cells->data(), sizeof(tileCells), e.offset) != sizeof(tileCells))
+    debug << "Tile write failed @" << t.tile << std::endl;
+
+  t.dirty = false;
+  stats.writebacks++;
+}
+
+void streamedMap::setCapacity(size_t tiles) {
+  capacity = std::max<size_t>(1, tiles);
+
+  while (lru.size() > capacity)
+    evict();
+}
+
+#pragma endregion
+
+#pragma region Access
+
+float streamedMap::get(int64_t x, int64_t y) {
+  int64_t tile = tileOf(x, y);
+
+  if (tile == lastTile)
+    return (*lastCells)(x & TILE_MASK, y & TILE_MASK);
+
+  // Uniform tiles are answered from the directory without taking a cache slot
+  if (directory[tile].offset == 0 && !(flags[tile] & TILE_RESIDENT))
+    return directory[tile].uniform;
+
+  return (*load(tile))(x & TILE_MASK, y & TILE_MASK);
+}
+
+void streamedMap::set(int64_t x, int64_t y, float w) {
+  int64_t tile = tileOf(x, y);
+
+  if (directory[tile].offset == 0 && !(flags[tile] & TILE_RESIDENT) && directory[tile].uniform == w)
+    return;
+
+  auto cells = (tile == lastTile) ? lastCells : load(tile);
+  (*cells)(x & TILE_MASK, y & TILE_MASK) = w;
+  resident[tile]->dirty = true;
+}
+
+cellIndex streamedMap::index(int64_t x, int64_t y) {
+  return (tileOf(x, y) << (2 * TILE_SHIFT)) | ((x & TILE_MASK) << TILE_SHIFT) | (y & TILE_MASK);
+}
+
+void streamedMap::position(cellIndex i, int64_t& x, int64_t& y) {
+  cellIndex tile = i >> (2 * TILE_SHIFT);
+
+  x = ((tile / tilesN) << TILE_SHIFT) | ((i >> TILE_SHIFT) & TILE_MASK);
+  y = ((tile % tilesN) << TILE_SHIFT) | (i & TILE_MASK);
+}
+
+float streamedMap::at(cellIndex i) {
+  int64_t x, y;
+  position(i, x, y);
+  return get(x, y);
+}
+
+bool streamedMap::uniformTile(int64_t tx, int64_t ty, float& w) {
+  int64_t tile = tx * tilesN + ty;
+
+  if (directory[tile].offset != 0 || (flags[tile] & TILE_RESIDENT))
+    return false;
+
+  w = directory[tile].uniform;
+  return true;
+}
+
+// Ask the OS to read ahead the tile the search is heading into
+void streamedMap::prefetch(int64_t x, int64_t y, int dx, int dy) {
+  int64_t px = x + dx * PREFETCH_DISTANCE, py = y + dy * PREFETCH_DISTANCE;
+
+  if (px < 0 || py < 0 || px >= sizeM || py >= sizeN)
+    return;
+
+  int64_t tile = tileOf(px, py);
+  auto& e = directory[tile];
+
+  if (tile == lastTile || flags[tile] || e.offset == 0)
+    return;
+
+  flags[tile] = TILE_ADVISED;
+  stats.prefetches++;
+
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(fd, e.offset, sizeof(tileCells), POSIX_FADV_WILLNEED);
+#endif
+}
+
+size_t streamedMap::memoryUsage() {
+  return directory.size() * (sizeof(tileStoreEntry) + sizeof(uint8_t)) + lru.size() * sizeof(tileCells);
+}
+
+#pragma endregion
@@ -0,0 +1,231 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Replays a search trace - per search summary, expansion heatmap and open list size over time
+//
+// Usage: trace_replay trace [-s search] [-o prefix] [-w width] [-t top]
+//   Writes prefix_heat.pgm (expansions per cell, log scale, longest side width pixels) and
+//   prefix_open.csv (search, time, open list size, expansions). Without -s all searches of the
+//   trace go into the heatmap of the first map size seen
+
+#include "astar.hpp"
+#include <fstream>
+#include <map>
+
+using namespace std;
+
+struct searchSummary {
+    uint32_t search = 0;
+    uint16_t thread = 0;
+    int64_t rows = 0, cols = 0;
+    int storage = DENSE_STORAGE;
+    bool ended = false, found = false;
+    float cost = 0.0f;
+    uint64_t begin = 0, end = 0;
+    size_t counts[TRACE_TYPES] = {};
+    size_t reexpanded = 0;          // Expansions of a cell already expanded in this search
+    int64_t open = 0, maxOpen = 0;
+    vector<size_t> events;          // Positions in the trace
+};
+
+// Cell positions for each storage, maps are only made for the layouts that need one
+class locator {
+    private:
+        map<tuple<int64_t, int64_t, int>, unique_ptr<gridMap>> maps;
+
+    public:
+        void position(const searchSummary& s, cellIndex i, int64_t& x, int64_t& y) {
+          if (s.storage == DENSE_STORAGE || s.storage == SHARED_STORAGE) {
+            x = i % s.rows;
+            y = i / s.rows;
+            return;
+          }
+
+          // Streamed stores number their cells like tiled maps
+          int storage = (s.storage == STREAMED_STORAGE) ? TILED_STORAGE : s.storage;
+          auto& m = maps[make_tuple(s.rows, s.cols, storage)];
+
+          if (!m) {
+            if (storage == MORTON_STORAGE)
+              m = make_unique<mortonMap>();
+            else if (storage == BLOCKED_STORAGE)
+              m = make_unique<blockedMap>();
+            else
+              m = make_unique<tiledMap>();
+            m->resize(s.rows, s.cols);
+          }
+
+          m->position(i, x, y);
+        }
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+      cerr << "Usage: trace_replay trace [-s search] [-o prefix] [-w width] [-t top]" << endl;
+      return EXIT_FAILURE;
+    }
+
+    uint32_t only = 0;
+    string prefix = "trace";
+    int width = 512;
+    size_t top = 20;
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+      string arg = argv[i];
+      if (arg == "-s")
+        only = atoi(argv[i + 1]);
+      else if (arg == "-o")
+        prefix = argv[i + 1];
+      else if (arg == "-w")
+        width = max(1, atoi(argv[i + 1]));
+      else if (arg == "-t")
+        top = atoi(argv[i + 1]);
+    }
+
+    vector<traceEvent> events;
+    if (searchTracer::read(argv[1], events) != EXIT_SUCCESS) {
+      cerr << "Cannot read trace " << argv[1] << endl;
+      return EXIT_FAILURE;
+    }
+
+    // Threads flush in chunks, so events are ordered per search by time first
+    stable_sort(events.begin(), events.end(), [](const traceEvent& a, const traceEvent& b) {
+      return tie(a.search, a.nanos) < tie(b.search, b.nanos);
+    });
+
+    map<uint32_t, searchSummary> searches;
+    unordered_map<cellIndex, int> expanded;
+    uint32_t current = 0;
+
+    for (size_t k = 0; k < events.size(); k++) {
+      auto& e = events[k];
+      if (e.type >= TRACE_TYPES || (only && e.search != only))
+        continue;
+
+      auto& s = searches[e.search];
+      if (e.search != current) {
+        expanded.clear();
+        current = e.search;
+        s.search = e.search;
+        s.thread = e.thread;
+        s.begin = e.nanos;
+      }
+
+      s.counts[e.type]++;
+      s.events.push_back(k);
+      s.end = e.nanos;
+
+      switch (e.type) {
+        case TRACE_BEGIN:
+          s.rows = e.cell;
+          s.cols = e.extent();
+          s.storage = e.flags;
+          break;
+        case TRACE_PUSH:
+          s.maxOpen = max(s.maxOpen, ++s.open);
+          break;
+        case TRACE_POP:
+          s.open--;
+          break;
+        case TRACE_EXPAND:
+          if (expanded[e.cell]++ > 0)
+            s.reexpanded++;
+          break;
+        case TRACE_END:
+          s.ended = true;
+          s.found = e.flags != 0;
+          s.cost = e.g;
+          break;
+      }
+    }
+
+    if (searches.empty()) {
+      cerr << "No searches in the trace" << endl;
+      return EXIT_FAILURE;
+    }
+
+    // Summary, most expansions first
+    vector<searchSummary*> order;
+    for (auto& s : searches)
+      order.push_back(&s.second);
+    sort(order.begin(), order.end(), [](searchSummary* a, searchSummary* b) {
+      return a->counts[TRACE_EXPAND] > b->counts[TRACE_EXPAND];
+    });
+
+    cout << events.size() << " events, " << searches.size() << " searches" << endl << endl;
+    cout << "search thread       map  found      cost    micros  expanded  pushed  pruned reopened re-expanded max open"
+         << endl;
+
+    for (size_t k = 0; k < min(top, order.size()); k++) {
+      auto& s = *order[k];
+      cout << setw(6) << s.search << setw(7) << s.thread << setw(10)
+           << (to_string(s.rows) + "x" + to_string(s.cols)) << setw(7)
+           << (!s.ended ? "?" : s.found ? "yes" : "no") << setw(10) << s.cost << setw(10) << (s.end - s.begin) / 1000
+           << setw(10) << s.counts[TRACE_EXPAND] << setw(8) << s.counts[TRACE_PUSH] << setw(8) << s.counts[TRACE_PRUNE]
+           << setw(9) << s.counts[TRACE_REOPEN] << setw(12) << s.reexpanded << setw(9) << s.maxOpen << endl;
+    }
+
+    // Open list size over time, at most about a thousand rows per search
+    ofstream csv(prefix + "_open.csv");
+    csv << "search,micros,open,expanded" << endl;
+
+    for (auto& entry : searches) {
+      auto& s = entry.second;
+      size_t stride = max<size_t>(1, s.events.size() / 1000);
+      int64_t open = 0;
+      size_t expansions = 0;
+
+      for (size_t k = 0; k < s.events.size(); k++) {
+        auto& e = events[s.events[k]];
+        open += (e.type == TRACE_PUSH) - (e.type == TRACE_POP);
+        expansions += (e.type == TRACE_EXPAND);
+
+        if (k % stride == 0 || k + 1 == s.events.size())
+          csv << s.search << "," << (e.nanos - s.begin) / 1000.0 << "," << open << "," << expansions << "\n";
+      }
+    }
+
+    // Heatmap over the map of the first search, rows of the map down, columns across
+    auto& first = searches.begin()->second;
+    if (first.rows <= 0 || first.cols <= 0) {
+      cerr << "Trace has no map size, heatmap skipped" << endl;
+      return EXIT_SUCCESS;
+    }
+
+    double scale = max(1.0, (double)max(first.rows, first.cols) / width);
+    int64_t h = max<int64_t>(1, (int64_t)ceil(first.rows / scale));
+    int64_t w = max<int64_t>(1, (int64_t)ceil(first.cols / scale));
+    vector<uint64_t> heat(h * w, 0);
+    locator cells;
+
+    for (auto& entry : searches) {
+      auto& s = entry.second;
+      if (s.rows != first.rows || s.cols != first.cols || s.storage != first.storage)
+        continue;
+
+      for (auto k : s.events) {
+        auto& e = events[k];
+        if (e.type != TRACE_EXPAND)
+          continue;
+
+        int64_t x, y;
+        cells.position(s, e.cell, x, y);
+        if (x >= 0 && y >= 0 && x < s.rows && y < s.cols)
+          heat[min<int64_t>(h - 1, x / scale) * w + min<int64_t>(w - 1, y / scale)]++;
+      }
+    }
+
+    uint64_t hottest = *max_element(heat.begin(), heat.end());
+    ofstream pgm(prefix + "_heat.pgm", ios::binary);
+    pgm << "P5\n" << w << " " << h << "\n255\n";
+
+    for (auto v : heat) {
+      unsigned char pixel = hottest ? (unsigned char)(255.0 * log1p((double)v) / log1p((double)hottest)) : 0;
+      pgm.put(pixel);
+    }
+
+    cout << endl << "Wrote " << prefix << "_heat.pgm (" << w << " x " << h << ", hottest pixel " << hottest
+         << " expansions) and " << prefix << "_open.csv" << endl;
+
+    return EXIT_SUCCESS;
+}
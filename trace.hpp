@@ -0,0 +1,269 @@
+// GPL v3
+// Dragos-Ronald Rugescu
+//
+// Binary search traces - fixed-size events from each search thread into its own ring, drained
+//   to one file by a background flusher. Read back with tools/trace_replay
+
+#pragma once
+
+#include "utils.hpp"
+#include "perthread.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// Event types
+#define TRACE_BEGIN    0   // cell - rows of the map, extent() - columns, flags - storage
+#define TRACE_PUSH     1   // Node put on the open list with g and h
+#define TRACE_POP      2   // Entry taken off the open list
+#define TRACE_EXPAND   3   // Node closed, its neighbours generated
+#define TRACE_PRUNE    4   // Stale entry dropped, or neighbour rejected (closed, no better g, unreachable)
+#define TRACE_REOPEN   5   // Closed node reached again with a lower g
+#define TRACE_END      6   // cell - last node or INEXISTENT, g - path cost, flags - 1 if found
+#define TRACE_TYPES    7
+
+// Events per thread ring, a power of two. A full ring is drained by its own thread
+#define TRACE_RING_SIZE    (1 << 16)
+#define TRACE_FLUSH_MS     20
+
+#define TRACE_MAGIC        0x45434152545341ull   // "ASTRACE"
+#define TRACE_VERSION      1
+
+const char* const traceTypeNames[TRACE_TYPES] = { "begin", "push", "pop", "expand", "prune", "reopen", "end" };
+
+struct traceHeader {
+    uint64_t magic = TRACE_MAGIC;
+    uint32_t version = TRACE_VERSION;
+    uint32_t eventSize = 0;
+};
+
+struct traceEvent {
+    uint64_t nanos;         // Since the tracer was opened
+    int64_t cell;           // Map storage order
+    float g, h;
+    uint32_t search;        // Numbered across all threads from 1
+    uint16_t thread;
+    uint8_t type;
+    uint8_t flags;
+
+    // TRACE_BEGIN keeps a 64-bit column count where g and h are
+    void setExtent(int64_t cols) { std::memcpy(&g, &cols, sizeof(cols)); }
+    int64_t extent() const { int64_t cols; std::memcpy(&cols, &g, sizeof(cols)); return cols; }
+};
+
+static_assert(sizeof(traceEvent) == 32, "trace events are 32 bytes on disk");
+
+class searchTracer; // Far declaration
+
+// Interface traceRing - single producer (its thread), single consumer (whoever holds the
+//   tracer's file lock). Head and tail only grow, the slot is the position modulo the size
+class traceRing {
+    private:
+        traceEvent events[TRACE_RING_SIZE];
+        std::atomic<uint64_t> head{0}, tail{0};
+
+        searchTracer* owner;
+        uint16_t thread;
+        uint32_t search = 0;
+
+        // Next free slot, draining the ring first if it is full, then made visible to the consumer
+        traceEvent& claim(uint8_t type, cellIndex cell, float g, float h, uint8_t flags);
+        void publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+        friend class searchTracer;
+
+    public:
+        traceRing(searchTracer* owner, uint16_t thread) : owner(owner), thread(thread) {};
+
+        // Starts a search on this thread, later events carry its number
+        void begin(int64_t rows, int64_t cols, int storage);
+        void end(cellIndex last, float cost, bool found);
+
+        void record(uint8_t type, cellIndex cell, float g, float h, uint8_t flags = 0);
+};
+
+// Interface searchTracer - one file, one ring per recording thread
+class searchTracer {
+    private:
+        std::chrono::steady_clock::time_point epoch;
+        std::atomic<uint32_t> searches{0};
+
+        std::FILE* file = nullptr;
+        std::mutex fileLock;
+        uint64_t written = 0;
+
+        perThread<traceRing> rings;
+
+        std::thread flusher;
+        std::mutex flusherLock;
+        std::condition_variable flusherWake;
+        bool flushing = false;
+
+        void drain(traceRing& r);
+
+        friend class traceRing;
+
+    public:
+        searchTracer();
+        ~searchTracer() { close(); }
+        searchTracer(const searchTracer&) = delete;
+        searchTracer& operator=(const searchTracer&) = delete;
+
+        // Truncates the file and starts the flusher
+        int open(const std::string& path, std::chrono::milliseconds interval = std::chrono::milliseconds(TRACE_FLUSH_MS));
+        void close();
+        bool isOpen() { return file != nullptr; }
+
+        // Ring of the calling thread
+        traceRing& local();
+
+        // Everything recorded so far is in the file when this returns
+        void flush();
+        uint64_t eventCount() { std::lock_guard<std::mutex> guard(fileLock); return written; }
+
+        // Whole trace file, EXIT_FAILURE if it is not one
+        static int read(const std::string& path, std::vector<traceEvent>& events);
+};
+
+// Implementation traceRing
+
+void traceRing::begin(int64_t rows, int64_t cols, int storage) {
+  search = ++owner->searches;
+  claim(TRACE_BEGIN, rows, 0.0f, 0.0f, storage).setExtent(cols);
+  publish();
+}
+
+void traceRing::end(cellIndex last, float cost, bool found) {
+  record(TRACE_END, last, cost, 0.0f, found ? 1 : 0);
+}
+
+void traceRing::record(uint8_t type, cellIndex cell, float g, float h, uint8_t flags) {
+  claim(type, cell, g, h, flags);
+  publish();
+}
+
+traceEvent& traceRing::claim(uint8_t type, cellIndex cell, float g, float h, uint8_t flags) {
+  uint64_t at = head.load(std::memory_order_relaxed);
+
+  if (at - tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE) {
+    owner->flush();
+    at = head.load(std::memory_order_relaxed);
+  }
+
+  auto& e = events[at & (TRACE_RING_SIZE - 1)];
+  e.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - owner->epoch).count();
+  e.cell = cell;
+  e.g = g;
+  e.h = h;
+  e.search = search;
+  e.thread = thread;
+  e.type = type;
+  e.flags = flags;
+
+  return e;
+}
+
+// Implementation searchTracer
+
+searchTracer::searchTracer() : epoch(std::chrono::steady_clock::now()) {}
+
+int searchTracer::open(const std::string& path, std::chrono::milliseconds interval) {
+  close();
+
+  file = std::fopen(path.c_str(), "wb");
+  if (!file)
+    return EXIT_FAILURE;
+
+  traceHeader header;
+  header.eventSize = sizeof(traceEvent);
+  std::fwrite(&header, sizeof(header), 1, file);
+
+  flushing = true;
+  flusher = std::thread([this, interval]() {
+    std::unique_lock<std::mutex> guard(flusherLock);
+
+    while (flushing) {
+      flusherWake.wait_for(guard, interval, [&]() { return !flushing; });
+      flush();
+    }
+  });
+
+  return EXIT_SUCCESS;
+}
+
+void searchTracer::close() {
+  {
+    std::lock_guard<std::mutex> guard(flusherLock);
+    if (!flushing)
+      return;
+    flushing = false;
+  }
+
+  flusherWake.notify_all();
+  flusher.join();
+
+  std::lock_guard<std::mutex> guard(fileLock);
+  std::fclose(file);
+  file = nullptr;
+}
+
+traceRing& searchTracer::local() {
+  return rings.local([this](size_t thread) { return std::make_shared<traceRing>(this, (uint16_t)thread); });
+}
+
+// Caller holds fileLock
+void searchTracer::drain(traceRing& r) {
+  uint64_t from = r.tail.load(std::memory_order_relaxed);
+  uint64_t to = r.head.load(std::memory_order_acquire);
+
+  // At most two runs, split where the ring wraps
+  while (from < to) {
+    uint64_t slot = from & (TRACE_RING_SIZE - 1);
+    uint64_t count = std::min<uint64_t>(to - from, TRACE_RING_SIZE - slot);
+
+    if (file)
+      std::fwrite(&r.events[slot], sizeof(traceEvent), count, file);
+
+    written += count;
+    from += count;
+  }
+
+  r.tail.store(to, std::memory_order_release);
+}
+
+void searchTracer::flush() {
+  auto all = rings.all();
+
+  std::lock_guard<std::mutex> guard(fileLock);
+  for (auto& r : all)
+    drain(*r);
+
+  if (file)
+    std::fflush(file);
+}
+
+int searchTracer::read(const std::string& path, std::vector<traceEvent>& events) {
+  std::FILE* in = std::fopen(path.c_str(), "rb");
+  if (!in)
+    return EXIT_FAILURE;
+
+  traceHeader header;
+  if (std::fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC ||
+      header.version != TRACE_VERSION || header.eventSize != sizeof(traceEvent)) {
+    std::fclose(in);
+    return EXIT_FAILURE;
+  }
+
+  events.clear();
+  traceEvent chunk[4096];
+  size_t got;
+
+  while ((got = std::fread(chunk, sizeof(traceEvent), 4096, in)) > 0)
+    events.insert(events.end(), chunk, chunk + got);
+
+  std::fclose(in);
+  return EXIT_SUCCESS;
+}
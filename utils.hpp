@@ -1,3 +1,5 @@
+#pragma once
+
 #include <array>
 #include <queue>
 #include <vector>
@@ -8,6 +10,9 @@
 #include <iostream>
 #include "Eigen/Dense"
 #include <limits>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
 
 #undef DEBUG_FLAG
 //#define DEBUG_FLAG
@@ -21,12 +26,35 @@
 #define MANHATTAN_DISTANCE  1
 #define EUCLIDEAN_DISTANCE  2
 #define OCTOGONAL_DISTANCE  3
+#define CHEBYSHEV_DISTANCE  4
 
 #define INITIAL_SIZE      100
 
+#define DENSE_STORAGE       1
+#define TILED_STORAGE       2
+#define STREAMED_STORAGE    3
+#define MORTON_STORAGE      4
+#define BLOCKED_STORAGE     5
+#define SHARED_STORAGE      6
+
+#define TILE_SHIFT          6
+#define TILE_SIZE           (1 << TILE_SHIFT)
+#define TILE_MASK           (TILE_SIZE - 1)
+
+#define TILE_CACHE_SIZE     1024
+
+#define BLOCK_SHIFT         3
+#define BLOCK_SIZE          (1 << BLOCK_SHIFT)
+#define BLOCK_MASK          (BLOCK_SIZE - 1)
+
+#define DENSE_SEARCH_LIMIT  (1 << 24)
+#define COMPONENT_LIMIT     (1 << 26)
+#define PREFETCH_DISTANCE   (TILE_SIZE / 2)
+
 #define COST                1
 #define INEXISTENT         -1
 #define INACCESSIBLE       -1
+#define NO_PARENT        0xFF
 
 #define WITH_PATH           1
 #define WITHOUT_PATH        0
@@ -40,3 +68,23 @@
 #define QUARTER_WEIGHT      61.25f
 #define HALF_WEIGHT         122.5f
 #define MAX_WEIGHT          255.0f
+
+#define HEURISTIC_CACHE_SIZE 64
+#define HEURISTIC_CACHE_BYTES (256ull << 20)
+
+#define DIRTY_LOG_SIZE       4096
+#define PATH_REPAIR_MARGIN   16
+#define PATH_REPAIR_DETOUR   1.5f
+
+#define GOAL_BUCKET          32
+#define GOAL_INDEX_MIN       16
+
+#define WHCA_WINDOW          16
+#define RESERVATION_SHARDS   64
+
+#define CBS_NODE_BUDGET      100000
+#define CBS_CONFLICT_PROBES  4
+
+#define ANYTIME_EPSILON       3.0f
+#define ANYTIME_EPSILON_DELTA 0.5f
+#define ANYTIME_CHECK_EVERY   256